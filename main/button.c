@@ -37,8 +37,19 @@ static void button_task(void* arg)
                 ESP_LOGI(TAG, "GPIO[%"PRIu32"] intr, val: %d", io_num, gpio_get_level(io_num));
                 
                 if (io_num == GPIO_KEY1) {
-                    ESP_LOGI(TAG, "KEY1 Pressed");
-                    ui_enter_action();
+                    // Act on release, or as soon as the press becomes a long one
+                    TickType_t start = xTaskGetTickCount();
+                    while (gpio_get_level(io_num) == 0 &&
+                           xTaskGetTickCount() - start < pdMS_TO_TICKS(BUTTON_LONG_PRESS_MS)) {
+                        vTaskDelay(pdMS_TO_TICKS(10));
+                    }
+                    if (gpio_get_level(io_num) == 0) {
+                        ESP_LOGI(TAG, "KEY1 Long Pressed");
+                        ui_enter_long_action();
+                    } else {
+                        ESP_LOGI(TAG, "KEY1 Pressed");
+                        ui_enter_action();
+                    }
                 } else if (io_num == GPIO_KEY2) {
                     ESP_LOGI(TAG, "KEY2 (Left) Pressed");
                     ui_prev_page();
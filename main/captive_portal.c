@@ -0,0 +1,116 @@
+/*
+ * Captive Portal Probes
+ * Precomputed answers for OS connectivity checks
+ */
+#include <string.h>
+#include <stdio.h>
+#include "captive_portal.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+
+static const char *TAG = "captive_portal";
+
+typedef struct {
+    const char *uri;
+    const char *client;
+    // Answer that tells the OS it has Internet access
+    const char *online_status;
+    const char *online_type;
+    const char *online_body;
+    size_t online_body_len;
+} captive_probe_t;
+
+#define PROBE_BODY(s) s, sizeof(s) - 1
+
+static const char apple_success[] =
+    "<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>";
+
+static const captive_probe_t captive_probes[] = {
+    { "/generate_204",              "Android",  "204 No Content", NULL, NULL, 0 },
+    { "/gen_204",                   "Android",  "204 No Content", NULL, NULL, 0 },
+    { "/hotspot-detect.html",       "Apple",    "200 OK", "text/html", PROBE_BODY(apple_success) },
+    { "/library/test/success.html", "Apple",    "200 OK", "text/html", PROBE_BODY(apple_success) },
+    { "/connecttest.txt",           "Windows",  "200 OK", "text/plain", PROBE_BODY("Microsoft Connect Test") },
+    { "/ncsi.txt",                  "Windows",  "200 OK", "text/plain", PROBE_BODY("Microsoft NCSI") },
+    { "/success.txt",               "Firefox",  "200 OK", "text/plain", PROBE_BODY("success\n") },
+    { "/canonical.html",            "Firefox",  "200 OK", "text/html",
+      PROBE_BODY("<meta http-equiv=\"refresh\" content=\"0;url=https://support.mozilla.org/kb/captive-portal\"/>") },
+};
+
+static volatile bool s_online = false;
+static volatile int64_t s_join_time_us = 0;
+static volatile bool s_join_answered = true;
+
+void captive_portal_set_online(bool online)
+{
+    s_online = online;
+}
+
+void captive_portal_station_joined(void)
+{
+    s_join_time_us = esp_timer_get_time();
+    s_join_answered = false;
+}
+
+/* Portal URL on the live SoftAP address, matching what the DNS server answers */
+static void get_portal_url(char *buf, size_t len)
+{
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    esp_netif_ip_info_t ip_info;
+    if (netif == NULL || esp_netif_get_ip_info(netif, &ip_info) != ESP_OK || ip_info.ip.addr == 0) {
+        strlcpy(buf, CAPTIVE_PORTAL_URL, len);
+        return;
+    }
+    snprintf(buf, len, "http://" IPSTR "/", IP2STR(&ip_info.ip));
+}
+
+/* HTTP GET Handler for connectivity probe URIs */
+static esp_err_t probe_get_handler(httpd_req_t *req)
+{
+    const captive_probe_t *probe = (const captive_probe_t *)req->user_ctx;
+    bool online = s_online;
+
+    if (!s_join_answered) {
+        s_join_answered = true;
+        ESP_LOGI(TAG, "First probe after join: %s (%s) answered %s after %lld ms",
+                 probe->uri, probe->client, online ? "online" : "portal",
+                 (long long)((esp_timer_get_time() - s_join_time_us) / 1000));
+    } else {
+        ESP_LOGD(TAG, "Probe %s (%s) answered %s", probe->uri, probe->client, online ? "online" : "portal");
+    }
+
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (!online) {
+        // Absolute URL so the OS sees a redirect off the probe host
+        char url[32];
+        get_portal_url(url, sizeof(url));
+        httpd_resp_set_status(req, "302 Found");
+        httpd_resp_set_hdr(req, "Location", url);
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_status(req, probe->online_status);
+    if (probe->online_type) {
+        httpd_resp_set_type(req, probe->online_type);
+    }
+    return httpd_resp_send(req, probe->online_body, probe->online_body_len);
+}
+
+esp_err_t captive_portal_register(httpd_handle_t server)
+{
+    for (size_t i = 0; i < sizeof(captive_probes) / sizeof(captive_probes[0]); i++) {
+        const httpd_uri_t uri = {
+            .uri      = captive_probes[i].uri,
+            .method   = HTTP_GET,
+            .handler  = probe_get_handler,
+            .user_ctx = (void *)&captive_probes[i]
+        };
+        esp_err_t err = httpd_register_uri_handler(server, &uri);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register %s: %s", captive_probes[i].uri, esp_err_to_name(err));
+            return err;
+        }
+    }
+    return ESP_OK;
+}
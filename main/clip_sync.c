@@ -0,0 +1,166 @@
+/*
+ * Framed clipboard sync protocol
+ * Shared by the USB transports; see clip_sync.h for the frame layout.
+ */
+#include <string.h>
+#include "clip_sync.h"
+#include "esp_log.h"
+
+static const char *TAG = "clip_sync";
+
+void clip_sync_session_init(clip_sync_session_t *s, clip_sync_send_t send, void *arg)
+{
+    s->send = send;
+    s->arg = arg;
+    s->header_len = 0;
+    s->payload_len = 0;
+    s->payload_pos = 0;
+    s->subscribed = false;
+    s->sent_version = 0;
+}
+
+static void send_frame(clip_sync_session_t *s, uint8_t type, const uint8_t *payload, size_t len)
+{
+    uint8_t header[CLIP_SYNC_HEADER_LEN] = { CLIP_SYNC_MAGIC, type, len & 0xff, len >> 8 };
+    s->send(header, sizeof(header), s->arg);
+    if (len > 0) {
+        s->send(payload, len, s->arg);
+    }
+}
+
+static void send_version(clip_sync_session_t *s, uint8_t type, uint32_t version)
+{
+    uint8_t payload[4] = { version & 0xff, (version >> 8) & 0xff, (version >> 16) & 0xff, version >> 24 };
+    send_frame(s, type, payload, sizeof(payload));
+}
+
+static void send_error(clip_sync_session_t *s, uint8_t code)
+{
+    send_frame(s, CLIP_SYNC_ERROR, &code, 1);
+}
+
+/* The content goes out straight from the snapshot, behind a small prefix */
+static void send_clipboard(clip_sync_session_t *s)
+{
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) {
+        send_error(s, CLIP_SYNC_ERR_REJECTED);
+        return;
+    }
+    size_t type_len = strlen(snap->content_type);
+    uint8_t prefix[5 + CLIPBOARD_CONTENT_TYPE_MAX_LEN];
+    prefix[0] = snap->version & 0xff;
+    prefix[1] = (snap->version >> 8) & 0xff;
+    prefix[2] = (snap->version >> 16) & 0xff;
+    prefix[3] = snap->version >> 24;
+    prefix[4] = type_len;
+    memcpy(prefix + 5, snap->content_type, type_len);
+
+    size_t len = 5 + type_len + snap->len;
+    uint8_t header[CLIP_SYNC_HEADER_LEN] = { CLIP_SYNC_MAGIC, CLIP_SYNC_CLIPBOARD, len & 0xff, len >> 8 };
+    s->send(header, sizeof(header), s->arg);
+    s->send(prefix, 5 + type_len, s->arg);
+    if (snap->len > 0) {
+        s->send((const uint8_t *)snap->content, snap->len, s->arg);
+    }
+    s->sent_version = snap->version;
+    clipboard_service_release(snap);
+}
+
+static void handle_put(clip_sync_session_t *s)
+{
+    if (s->payload_len < 1 || s->payload[0] > s->payload_len - 1 ||
+        s->payload[0] > CLIPBOARD_CONTENT_TYPE_MAX_LEN) {
+        send_error(s, CLIP_SYNC_ERR_BAD_FRAME);
+        return;
+    }
+    size_t type_len = s->payload[0];
+    char content_type[CLIPBOARD_CONTENT_TYPE_MAX_LEN + 1];
+    memcpy(content_type, s->payload + 1, type_len);
+    content_type[type_len] = '\0';
+
+    uint32_t version = 0;
+    esp_err_t err = clipboard_service_set_bytes(s->payload + 1 + type_len, s->payload_len - 1 - type_len,
+                                                type_len > 0 ? content_type : NULL, &version);
+    if (err != ESP_OK) {
+        send_error(s, err == ESP_ERR_INVALID_SIZE ? CLIP_SYNC_ERR_TOO_LARGE : CLIP_SYNC_ERR_REJECTED);
+        return;
+    }
+    // The peer already has this version: do not echo it back. Web clients are
+    // updated by the ws_server clipboard listener, like for every other source
+    s->sent_version = version;
+    send_version(s, CLIP_SYNC_PUT_ACK, version);
+    ESP_LOGI(TAG, "Clipboard set over USB (version %lu)", (unsigned long)version);
+}
+
+static void handle_frame(clip_sync_session_t *s)
+{
+    switch (s->header[1]) {
+    case CLIP_SYNC_GET:
+        send_clipboard(s);
+        break;
+    case CLIP_SYNC_PUT:
+        handle_put(s);
+        break;
+    case CLIP_SYNC_VERSION:
+        send_version(s, CLIP_SYNC_VERSION_REPLY, clipboard_service_get_version());
+        break;
+    case CLIP_SYNC_SUBSCRIBE:
+        s->subscribed = s->payload_len > 0 && s->payload[0] != 0;
+        s->sent_version = clipboard_service_get_version();
+        send_version(s, CLIP_SYNC_VERSION_REPLY, s->sent_version);
+        break;
+    default:
+        send_error(s, CLIP_SYNC_ERR_UNKNOWN_TYPE);
+        break;
+    }
+}
+
+void clip_sync_feed(clip_sync_session_t *s, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        if (s->header_len < CLIP_SYNC_HEADER_LEN) {
+            if (s->header_len == 0 && *data != CLIP_SYNC_MAGIC) {
+                data++;     // Resynchronize on the next frame
+                len--;
+                continue;
+            }
+            s->header[s->header_len++] = *data++;
+            len--;
+            if (s->header_len < CLIP_SYNC_HEADER_LEN) {
+                continue;
+            }
+            s->payload_len = s->header[2] | (s->header[3] << 8);
+            s->payload_pos = 0;
+            if (s->payload_len > sizeof(s->payload)) {
+                // Still consumed below, but not kept
+                ESP_LOGW(TAG, "Frame of %u bytes too large", (unsigned)s->payload_len);
+            }
+        }
+
+        size_t n = s->payload_len - s->payload_pos;
+        if (n > len) n = len;
+        if (s->payload_pos + n <= sizeof(s->payload)) {
+            memcpy(s->payload + s->payload_pos, data, n);
+        }
+        s->payload_pos += n;
+        data += n;
+        len -= n;
+
+        if (s->payload_pos == s->payload_len) {
+            s->header_len = 0;
+            if (s->payload_len > sizeof(s->payload)) {
+                send_error(s, CLIP_SYNC_ERR_TOO_LARGE);
+            } else {
+                handle_frame(s);
+            }
+        }
+    }
+}
+
+void clip_sync_poll(clip_sync_session_t *s)
+{
+    if (s->subscribed && clipboard_service_get_version() != s->sent_version) {
+        send_clipboard(s);
+    }
+}
@@ -0,0 +1,275 @@
+/*
+ * REST Clipboard API
+ * Raw-bytes access to the shared clipboard for scripts and other non-browser tools
+ */
+#include <string.h>
+#include <stdlib.h>
+#include "clipboard_api.h"
+#include "clipboard_service.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "clipboard_api";
+
+#define ETAG_BUF_LEN 16
+
+/*
+ * Parked long-poll requests. The list is only touched from the httpd task
+ * (request handlers and work queued with httpd_queue_work), so no lock is needed.
+ */
+typedef struct {
+    httpd_req_t *req;
+    uint32_t wait_version;
+    int64_t deadline_us;
+} clipboard_waiter_t;
+
+static httpd_handle_t s_server = NULL;
+static clipboard_waiter_t s_waiters[CLIPBOARD_API_MAX_WAITERS];
+static volatile int s_waiter_count = 0;
+static esp_timer_handle_t s_wait_timer = NULL;
+
+static void format_etag(char *buf, size_t len, uint32_t version)
+{
+    snprintf(buf, len, "\"v%lu\"", (unsigned long)version);
+}
+
+static bool etag_matches(httpd_req_t *req, const char *etag)
+{
+    char value[64];
+    size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+    if (len == 0 || len >= sizeof(value)) {
+        return false;
+    }
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    return strstr(value, etag) != NULL;
+}
+
+static esp_err_t send_not_modified(httpd_req_t *req, uint32_t version)
+{
+    char etag[ETAG_BUF_LEN];
+    format_etag(etag, sizeof(etag), version);
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t send_snapshot(httpd_req_t *req, const clipboard_snapshot_t *snap)
+{
+    char etag[ETAG_BUF_LEN];
+    format_etag(etag, sizeof(etag), snap->version);
+    httpd_resp_set_type(req, snap->content_type);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, snap->content, snap->len);
+}
+
+/* Answer a parked request and hand it back to the server */
+static void waiter_complete(clipboard_waiter_t *waiter, const clipboard_snapshot_t *snap)
+{
+    if (snap->version != waiter->wait_version) {
+        send_snapshot(waiter->req, snap);
+    } else {
+        send_not_modified(waiter->req, snap->version);
+    }
+    httpd_req_async_handler_complete(waiter->req);
+}
+
+/* Runs on the httpd task: answer waiters whose version changed or whose wait expired */
+static void waiters_flush_work(void *arg)
+{
+    if (s_waiter_count == 0) return;
+
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) return;
+
+    int64_t now = esp_timer_get_time();
+    int kept = 0;
+    for (int i = 0; i < s_waiter_count; i++) {
+        clipboard_waiter_t *waiter = &s_waiters[i];
+        if (snap->version != waiter->wait_version || now >= waiter->deadline_us) {
+            waiter_complete(waiter, snap);
+        } else {
+            s_waiters[kept++] = *waiter;
+        }
+    }
+    s_waiter_count = kept;
+
+    clipboard_service_release(snap);
+}
+
+static void clipboard_changed(uint32_t version, void *arg)
+{
+    if (s_waiter_count > 0 && s_server) {
+        httpd_queue_work(s_server, waiters_flush_work, NULL);
+    }
+}
+
+static void wait_timer_callback(void *arg)
+{
+    if (s_waiter_count > 0 && s_server) {
+        httpd_queue_work(s_server, waiters_flush_work, NULL);
+    }
+}
+
+/* Park the request without occupying the server task. Returns ESP_OK if parked. */
+static esp_err_t park_request(httpd_req_t *req, uint32_t wait_version)
+{
+    if (s_waiter_count >= CLIPBOARD_API_MAX_WAITERS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    httpd_req_t *async_req = NULL;
+    esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to begin async request: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    clipboard_waiter_t *waiter = &s_waiters[s_waiter_count++];
+    waiter->req = async_req;
+    waiter->wait_version = wait_version;
+    waiter->deadline_us = esp_timer_get_time() + (int64_t)CLIPBOARD_API_WAIT_TIMEOUT_S * 1000000;
+    return ESP_OK;
+}
+
+/* HTTP GET Handler for "/api/clipboard" */
+static esp_err_t api_clipboard_get_handler(httpd_req_t *req)
+{
+    bool has_wait = false;
+    uint32_t wait_version = 0;
+    char query[48];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        char value[12];
+        if (httpd_query_key_value(query, "wait", value, sizeof(value)) == ESP_OK) {
+            wait_version = strtoul(value, NULL, 10);
+            has_wait = true;
+        }
+    }
+
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret;
+    if (has_wait && snap->version == wait_version) {
+        clipboard_service_release(snap);
+        ret = park_request(req, wait_version);
+        if (ret == ESP_ERR_NO_MEM) {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_set_hdr(req, "Retry-After", "1");
+            return httpd_resp_send(req, NULL, 0);
+        }
+        if (ret != ESP_OK) {
+            httpd_resp_send_500(req);
+        }
+        return ret;
+    }
+
+    char etag[ETAG_BUF_LEN];
+    format_etag(etag, sizeof(etag), snap->version);
+    if (!has_wait && etag_matches(req, etag)) {
+        ret = send_not_modified(req, snap->version);
+    } else {
+        ret = send_snapshot(req, snap);
+    }
+    clipboard_service_release(snap);
+    return ret;
+}
+
+/* HTTP PUT Handler for "/api/clipboard" */
+static esp_err_t api_clipboard_put_handler(httpd_req_t *req)
+{
+    if (req->content_len > SHARED_CLIPBOARD_MAX_LEN) {
+        httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LONG, "Clipboard content too large");
+        return ESP_FAIL;
+    }
+
+    char content_type[CLIPBOARD_CONTENT_TYPE_MAX_LEN + 1];
+    size_t type_len = httpd_req_get_hdr_value_len(req, "Content-Type");
+    if (type_len == 0 || type_len >= sizeof(content_type) ||
+        httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type)) != ESP_OK) {
+        strlcpy(content_type, CLIPBOARD_DEFAULT_CONTENT_TYPE, sizeof(content_type));
+    }
+
+    char *buf = malloc(req->content_len + 1);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for clipboard body");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    int ret;
+    size_t cur_len = 0;
+    while (cur_len < req->content_len) {
+        ret = httpd_req_recv(req, buf + cur_len, req->content_len - cur_len);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            free(buf);
+            return ESP_FAIL;
+        }
+        cur_len += ret;
+    }
+
+    uint32_t version = 0;
+    esp_err_t err = clipboard_service_set_bytes(buf, cur_len, content_type, &version);
+    free(buf);
+    if (err != ESP_OK) {
+        httpd_resp_send_500(req);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Updated shared clipboard via REST (version %lu, %u bytes)", (unsigned long)version, (unsigned)cur_len);
+
+    char etag[ETAG_BUF_LEN];
+    format_etag(etag, sizeof(etag), version);
+    httpd_resp_set_status(req, "204 No Content");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static const httpd_uri_t api_clipboard_get_uri = {
+    .uri       = "/api/clipboard",
+    .method    = HTTP_GET,
+    .handler   = api_clipboard_get_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t api_clipboard_put_uri = {
+    .uri       = "/api/clipboard",
+    .method    = HTTP_PUT,
+    .handler   = api_clipboard_put_handler,
+    .user_ctx  = NULL
+};
+
+esp_err_t clipboard_api_register(httpd_handle_t server)
+{
+    s_server = server;
+
+    if (s_wait_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = wait_timer_callback,
+            .name = "api_wait"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_wait_timer));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(s_wait_timer, 1000 * 1000));
+        if (clipboard_service_add_listener(clipboard_changed, NULL) != ESP_OK) {
+            ESP_LOGW(TAG, "No clipboard listener: long-poll waiters only wake on the timer");
+        }
+    }
+
+    esp_err_t err = httpd_register_uri_handler(server, &api_clipboard_get_uri);
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(server, &api_clipboard_put_uri);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register clipboard API: %s", esp_err_to_name(err));
+    }
+    return err;
+}
@@ -4,12 +4,114 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "mbedtls/base64.h"
+#include "metrics.h"
 
 static const char *TAG = "clipboard";
 
-static char shared_clipboard[SHARED_CLIPBOARD_MAX_LEN + 1] = {0};
+/*
+ * Clipboard content is kept in immutable, reference-counted snapshots.
+ * A snapshot holds the raw content and its cached Base64 encoding in a single
+ * allocation. Readers take a reference under the mutex and then read without
+ * holding any lock; a set publishes a new snapshot and moves the old one into
+ * the history, which holds its own reference until the entry ages out.
+ */
+typedef struct {
+    clipboard_snapshot_t snap; // Must be first
+    int refcount;
+    char storage[];
+} snapshot_block_t;
+
+typedef struct {
+    clipboard_listener_t cb;
+    void *arg;
+} clipboard_listener_entry_t;
+
+static snapshot_block_t *current_block = NULL;
+static snapshot_block_t *history_blocks[CLIPBOARD_HISTORY_LEN];   // Newest first
 static SemaphoreHandle_t clipboard_mutex = NULL;
+static uint32_t clipboard_version = 0;
+static clipboard_listener_entry_t clipboard_listeners[CLIPBOARD_LISTENER_MAX];
+static int clipboard_listener_count = 0;
+
+static snapshot_block_t *snapshot_create(const char *content, size_t len, const char *content_type)
+{
+    size_t base64_len = 4 * ((len + 2) / 3) + 1; // Including NUL
+    size_t type_len = strnlen(content_type, CLIPBOARD_CONTENT_TYPE_MAX_LEN);
+
+    snapshot_block_t *block = malloc(sizeof(snapshot_block_t) + len + 1 + base64_len + type_len + 1);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    char *data = block->storage;
+    char *base64 = data + len + 1;
+    char *type = base64 + base64_len;
+    memcpy(data, content, len);
+    data[len] = '\0';
+    memcpy(type, content_type, type_len);
+    type[type_len] = '\0';
+
+    size_t olen = 0;
+    int ret = mbedtls_base64_encode((unsigned char *)base64, base64_len, &olen,
+                                    (const unsigned char *)data, len);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Base64 encode failed: %d", ret);
+        free(block);
+        return NULL;
+    }
+    base64[olen] = '\0';
+
+    block->refcount = 1;
+    block->snap.version = 0;
+    block->snap.len = len;
+    block->snap.content = data;
+    block->snap.base64_len = olen;
+    block->snap.base64 = base64;
+    block->snap.content_type = type;
+    return block;
+}
+
+/* Must be called with clipboard_mutex held */
+static void snapshot_unref_locked(snapshot_block_t *block)
+{
+    if (--block->refcount == 0) {
+        free(block);
+    }
+}
+
+/* Publish a new snapshot. Takes ownership of the caller's reference. */
+static void snapshot_publish(snapshot_block_t *block, uint32_t *version)
+{
+    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
+    block->snap.version = ++clipboard_version;
+    snapshot_block_t *old = current_block;
+    current_block = block;
+    if (old && old->snap.len > 0) {
+        // The current reference moves into the history
+        if (history_blocks[CLIPBOARD_HISTORY_LEN - 1]) {
+            snapshot_unref_locked(history_blocks[CLIPBOARD_HISTORY_LEN - 1]);
+        }
+        memmove(&history_blocks[1], &history_blocks[0], (CLIPBOARD_HISTORY_LEN - 1) * sizeof(history_blocks[0]));
+        history_blocks[0] = old;
+    } else if (old) {
+        snapshot_unref_locked(old);
+    }
+    uint32_t new_version = block->snap.version;
+    int listener_count = clipboard_listener_count;
+    xSemaphoreGive(clipboard_mutex);
+
+    if (version) {
+        *version = new_version;
+    }
+    metrics_inc(METRIC_CLIPBOARD_UPDATES);
+
+    // Notify outside the lock so listeners may acquire snapshots
+    for (int i = 0; i < listener_count; i++) {
+        clipboard_listeners[i].cb(new_version, clipboard_listeners[i].arg);
+    }
+}
 
 esp_err_t clipboard_service_init(void)
 {
@@ -20,59 +122,126 @@ esp_err_t clipboard_service_init(void)
             return ESP_FAIL;
         }
     }
+    if (current_block == NULL) {
+        current_block = snapshot_create("", 0, CLIPBOARD_DEFAULT_CONTENT_TYPE);
+        if (current_block == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate initial snapshot");
+            return ESP_ERR_NO_MEM;
+        }
+        // Start each boot at a random version so versions cached by clients
+        // (ETags, IndexedDB) never match content from a previous boot
+        clipboard_version = esp_random() >> 1;
+        current_block->snap.version = clipboard_version;
+    }
     return ESP_OK;
 }
 
+const clipboard_snapshot_t *clipboard_service_acquire(void)
+{
+    if (clipboard_mutex == NULL) return NULL;
+
+    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
+    snapshot_block_t *block = current_block;
+    block->refcount++;
+    xSemaphoreGive(clipboard_mutex);
+
+    return &block->snap;
+}
+
+const clipboard_snapshot_t *clipboard_service_acquire_history(size_t index)
+{
+    if (index == 0) return clipboard_service_acquire();
+    if (clipboard_mutex == NULL || index > CLIPBOARD_HISTORY_LEN) return NULL;
+
+    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
+    snapshot_block_t *block = history_blocks[index - 1];
+    if (block) {
+        block->refcount++;
+    }
+    xSemaphoreGive(clipboard_mutex);
+
+    return block ? &block->snap : NULL;
+}
+
+void clipboard_service_release(const clipboard_snapshot_t *snap)
+{
+    if (snap == NULL || clipboard_mutex == NULL) return;
+
+    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
+    snapshot_unref_locked((snapshot_block_t *)snap);
+    xSemaphoreGive(clipboard_mutex);
+}
+
 esp_err_t clipboard_service_set(const char *content)
 {
     if (clipboard_mutex == NULL) return ESP_FAIL;
     
-    if (strlen(content) > SHARED_CLIPBOARD_MAX_LEN) {
+    size_t len = strlen(content);
+    if (len > SHARED_CLIPBOARD_MAX_LEN) {
         ESP_LOGE(TAG, "Content too long");
         return ESP_ERR_INVALID_SIZE;
     }
 
-    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
-    strncpy(shared_clipboard, content, SHARED_CLIPBOARD_MAX_LEN);
-    shared_clipboard[SHARED_CLIPBOARD_MAX_LEN] = '\0';
-    xSemaphoreGive(clipboard_mutex);
+    snapshot_block_t *block = snapshot_create(content, len, CLIPBOARD_DEFAULT_CONTENT_TYPE);
+    if (block == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    snapshot_publish(block, NULL);
     
     return ESP_OK;
 }
 
-esp_err_t clipboard_service_get(char *buffer, size_t buffer_len)
+esp_err_t clipboard_service_set_bytes(const void *data, size_t len, const char *content_type, uint32_t *version)
 {
     if (clipboard_mutex == NULL) return ESP_FAIL;
+
+    if (len > SHARED_CLIPBOARD_MAX_LEN) {
+        ESP_LOGE(TAG, "Content too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    snapshot_block_t *block = snapshot_create(data, len, content_type ? content_type : CLIPBOARD_DEFAULT_CONTENT_TYPE);
+    if (block == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    snapshot_publish(block, version);
+
+    return ESP_OK;
+}
+
+esp_err_t clipboard_service_get(char *buffer, size_t buffer_len)
+{
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) return ESP_FAIL;
     
-    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
-    strncpy(buffer, shared_clipboard, buffer_len - 1);
+    strncpy(buffer, snap->content, buffer_len - 1);
     buffer[buffer_len - 1] = '\0';
-    xSemaphoreGive(clipboard_mutex);
+    clipboard_service_release(snap);
     
     return ESP_OK;
 }
 
-esp_err_t clipboard_service_get_base64(char *buffer, size_t buffer_len)
+esp_err_t clipboard_service_get_base64(char *buffer, size_t buffer_len, uint32_t *version)
 {
-    if (clipboard_mutex == NULL) return ESP_FAIL;
-    
-    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
-    size_t olen = 0;
-    int ret = mbedtls_base64_encode((unsigned char *)buffer, buffer_len, &olen, 
-                                    (const unsigned char *)shared_clipboard, strlen(shared_clipboard));
-    xSemaphoreGive(clipboard_mutex);
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) return ESP_FAIL;
     
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Base64 encode failed: %d", ret);
-        return ESP_FAIL;
+    if (snap->base64_len >= buffer_len) {
+        ESP_LOGE(TAG, "Base64 buffer too small");
+        clipboard_service_release(snap);
+        return ESP_ERR_INVALID_SIZE;
     }
     
-    buffer[olen] = '\0'; // Null-terminate the string
+    memcpy(buffer, snap->base64, snap->base64_len + 1);
+    if (version) {
+        *version = snap->version;
+    }
+    clipboard_service_release(snap);
     
     return ESP_OK;
 }
 
-esp_err_t clipboard_service_set_base64(const char *base64_content)
+esp_err_t clipboard_service_set_base64(const char *base64_content, uint32_t *version)
 {
     if (clipboard_mutex == NULL) return ESP_FAIL;
     
@@ -92,13 +261,44 @@ esp_err_t clipboard_service_set_base64(const char *base64_content)
         return ESP_FAIL;
     }
     
+    // Content is treated as a C string; stop at an embedded NUL like the plain setter
     temp_buf[olen] = '\0';
+    snapshot_block_t *block = snapshot_create(temp_buf, strlen(temp_buf), CLIPBOARD_DEFAULT_CONTENT_TYPE);
+    free(temp_buf);
+    if (block == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    snapshot_publish(block, version);
     
+    return ESP_OK;
+}
+
+uint32_t clipboard_service_get_version(void)
+{
+    if (clipboard_mutex == NULL) return 0;
+
     xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
-    strncpy(shared_clipboard, temp_buf, SHARED_CLIPBOARD_MAX_LEN);
-    shared_clipboard[SHARED_CLIPBOARD_MAX_LEN] = '\0';
+    uint32_t version = clipboard_version;
     xSemaphoreGive(clipboard_mutex);
-    
-    free(temp_buf);
-    return ESP_OK;
+
+    return version;
+}
+
+esp_err_t clipboard_service_add_listener(clipboard_listener_t cb, void *arg)
+{
+    if (clipboard_mutex == NULL || cb == NULL) return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(clipboard_mutex, portMAX_DELAY);
+    if (clipboard_listener_count < CLIPBOARD_LISTENER_MAX) {
+        clipboard_listeners[clipboard_listener_count].cb = cb;
+        clipboard_listeners[clipboard_listener_count].arg = arg;
+        clipboard_listener_count++;
+    } else {
+        ESP_LOGE(TAG, "No free listener slot");
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(clipboard_mutex);
+
+    return err;
 }
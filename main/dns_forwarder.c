@@ -0,0 +1,539 @@
+/*
+ * Caching DNS forwarder for station mode
+ * Queries from clients on the router's network are relayed to the resolver
+ * learned over DHCP. Answers, including NXDOMAIN/NODATA, are kept in a small
+ * LRU cache and replayed with their TTLs aged; identical queries that arrive
+ * while one is already in flight share that single upstream request.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "lwip/sockets.h"
+#include "dns_message.h"
+#include "dns_forwarder.h"
+#include "metrics.h"
+
+static const char *TAG = "dns_forwarder";
+
+#define DNS_CACHE_ENTRIES       32
+#define DNS_CACHE_BUCKETS       64      // Power of two
+#define DNS_CACHE_MAX_TTL       3600    // Seconds; longer TTLs are clamped
+#define DNS_PENDING_MAX         8       // Distinct questions in flight upstream
+#define DNS_PENDING_WAITERS     4       // Clients sharing one upstream question
+#define DNS_FORWARD_RETRY_MS    1000
+#define DNS_FORWARD_TRIES       3       // SERVFAIL after this many unanswered sends
+#define DNS_UPSTREAM_PORT       53
+#define DNS_UPSTREAM_REFRESH_MS 1000
+#define DNS_NO_ENTRY            0xff
+
+/* A question, with the name compared case-insensitively */
+typedef struct {
+    const uint8_t *name;    // Uncompressed wire format, right after the header
+    size_t name_len;        // Including the root label
+    uint16_t qtype;
+    uint16_t qclass;
+    uint32_t hash;
+} dns_key_t;
+
+typedef struct {
+    bool used;
+    uint8_t bucket_next;
+    uint8_t lru_prev;
+    uint8_t lru_next;
+    uint32_t hash;
+    uint16_t len;
+    int64_t stored_us;
+    int64_t expires_us;
+    uint8_t response[DNS_MAX_UDP_LEN];  // Holds the key: its question section
+} dns_cache_entry_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    uint16_t id;
+    uint16_t rd;            // Client's RD flag, echoed back
+} dns_waiter_t;
+
+typedef struct {
+    bool used;
+    uint8_t tries;
+    uint8_t waiter_count;
+    uint16_t len;
+    uint32_t hash;
+    int64_t sent_us;
+    dns_waiter_t waiters[DNS_PENDING_WAITERS];
+    uint8_t query[DNS_HEADER_LEN + DNS_MAX_NAME_LEN + 4];   // As sent upstream
+} dns_pending_t;
+
+typedef struct {
+    int sock;
+    struct sockaddr_in upstream;
+    int64_t upstream_checked_us;
+    uint8_t buckets[DNS_CACHE_BUCKETS];
+    uint8_t lru_head;       // Most recently used
+    uint8_t lru_tail;       // Evicted first
+    dns_cache_entry_t entries[DNS_CACHE_ENTRIES];
+    dns_pending_t pending[DNS_PENDING_MAX];
+} dns_forwarder_t;
+
+static dns_forwarder_t *s_fwd = NULL;
+static uint32_t s_upstream_override_addr = 0;
+static uint16_t s_upstream_override_port = 0;
+
+static inline uint8_t fold_case(uint8_t c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/* Read the single question of a message. Compressed names are rejected. */
+static bool dns_read_key(const uint8_t *msg, size_t len, dns_key_t *key)
+{
+    uint32_t hash = 2166136261u;    // FNV-1a over the case-folded name
+    size_t offset = DNS_HEADER_LEN;
+
+    while (offset < len && msg[offset] != 0) {
+        uint8_t label = msg[offset];
+        if ((label & 0xc0) || offset + label + 1 >= len) {
+            return false;
+        }
+        for (size_t i = offset; i <= offset + label; i++) {
+            hash = (hash ^ fold_case(msg[i])) * 16777619u;
+        }
+        offset += label + 1;
+    }
+    if (offset + 5 > len || offset + 1 - DNS_HEADER_LEN > DNS_MAX_NAME_LEN) {
+        return false;
+    }
+
+    key->name = msg + DNS_HEADER_LEN;
+    key->name_len = offset + 1 - DNS_HEADER_LEN;
+    key->qtype = read_u16(msg + offset + 1);
+    key->qclass = read_u16(msg + offset + 3);
+    key->hash = hash ^ ((uint32_t)key->qtype << 16 | key->qclass);
+    return true;
+}
+
+/* Does the question of msg (at least a header and a question long) match key? */
+static bool dns_key_matches(const dns_key_t *key, uint32_t hash, const uint8_t *msg)
+{
+    if (hash != key->hash) {
+        return false;
+    }
+    const uint8_t *name = msg + DNS_HEADER_LEN;
+    for (size_t i = 0; i < key->name_len; i++) {
+        if (fold_case(name[i]) != fold_case(key->name[i])) {
+            return false;
+        }
+    }
+    return read_u16(name + key->name_len) == key->qtype &&
+           read_u16(name + key->name_len + 2) == key->qclass;
+}
+
+/*
+ * How long a response may be cached, in seconds; 0 if it must not be.
+ * Positive answers live as long as their shortest record. Negative answers
+ * follow RFC 2308: the SOA in the authority section bounds them, and without
+ * one they are not cached at all.
+ */
+static uint32_t dns_cache_ttl(const uint8_t *msg, size_t len)
+{
+    uint16_t flags = read_u16(msg + 2);
+    int rcode = flags & DNS_RCODE_MASK;
+    uint16_t ancount = read_u16(msg + 6);
+    uint16_t nscount = read_u16(msg + 8);
+
+    if ((flags & DNS_FLAG_TC) || read_u16(msg + 4) != 1 ||
+        (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) {
+        return 0;
+    }
+    size_t offset = dns_skip_name(msg, len, DNS_HEADER_LEN);
+    if (offset == 0 || offset + 4 > len) {
+        return 0;
+    }
+    offset += 4;
+
+    bool negative = rcode == DNS_RCODE_NXDOMAIN || ancount == 0;
+    bool have_soa = false;
+    uint32_t ttl = DNS_CACHE_MAX_TTL;
+    for (int i = 0; i < ancount + nscount; i++) {
+        size_t name_end = dns_skip_name(msg, len, offset);
+        if (name_end == 0 || name_end + 10 > len) {
+            return 0;
+        }
+        uint16_t type = read_u16(msg + name_end);
+        uint32_t rr_ttl = read_u32(msg + name_end + 4);
+        uint16_t rdlen = read_u16(msg + name_end + 8);
+        offset = name_end + 10 + rdlen;
+        if (offset > len) {
+            return 0;
+        }
+        if (type == DNS_TYPE_SOA && i >= ancount && rdlen >= 22) {
+            uint32_t minimum = read_u32(msg + offset - 4);
+            if (minimum < rr_ttl) {
+                rr_ttl = minimum;
+            }
+            have_soa = true;
+        }
+        if (rr_ttl < ttl) {
+            ttl = rr_ttl;
+        }
+    }
+    return (negative && !have_soa) ? 0 : ttl;
+}
+
+/* Subtract the time spent in the cache from every TTL of a cached response */
+static void dns_age_ttls(uint8_t *msg, size_t len, uint32_t elapsed_s)
+{
+    if (elapsed_s == 0) {
+        return;
+    }
+    size_t offset = dns_skip_name(msg, len, DNS_HEADER_LEN) + 4;
+    int rr_count = read_u16(msg + 6) + read_u16(msg + 8) + read_u16(msg + 10);
+    for (int i = 0; i < rr_count; i++) {
+        size_t name_end = dns_skip_name(msg, len, offset);
+        if (name_end == 0 || name_end + 10 > len) {
+            return;     // Validated when stored; cannot happen
+        }
+        if (read_u16(msg + name_end) != DNS_TYPE_OPT) {
+            uint32_t ttl = read_u32(msg + name_end + 4);
+            write_u32(msg + name_end + 4, ttl > elapsed_s ? ttl - elapsed_s : 0);
+        }
+        offset = name_end + 10 + read_u16(msg + name_end + 8);
+    }
+}
+
+static void lru_unlink(uint8_t index)
+{
+    dns_cache_entry_t *e = &s_fwd->entries[index];
+    if (e->lru_prev != DNS_NO_ENTRY) {
+        s_fwd->entries[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        s_fwd->lru_head = e->lru_next;
+    }
+    if (e->lru_next != DNS_NO_ENTRY) {
+        s_fwd->entries[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        s_fwd->lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push_front(uint8_t index)
+{
+    dns_cache_entry_t *e = &s_fwd->entries[index];
+    e->lru_prev = DNS_NO_ENTRY;
+    e->lru_next = s_fwd->lru_head;
+    if (s_fwd->lru_head != DNS_NO_ENTRY) {
+        s_fwd->entries[s_fwd->lru_head].lru_prev = index;
+    } else {
+        s_fwd->lru_tail = index;
+    }
+    s_fwd->lru_head = index;
+}
+
+/* Drop an entry from its hash chain and the LRU list */
+static void cache_remove(uint8_t index)
+{
+    dns_cache_entry_t *e = &s_fwd->entries[index];
+    uint8_t *link = &s_fwd->buckets[e->hash & (DNS_CACHE_BUCKETS - 1)];
+    while (*link != index) {
+        link = &s_fwd->entries[*link].bucket_next;
+    }
+    *link = e->bucket_next;
+    lru_unlink(index);
+    e->used = false;
+}
+
+static uint8_t cache_lookup(const dns_key_t *key, int64_t now)
+{
+    uint8_t index = s_fwd->buckets[key->hash & (DNS_CACHE_BUCKETS - 1)];
+    while (index != DNS_NO_ENTRY) {
+        dns_cache_entry_t *e = &s_fwd->entries[index];
+        if (dns_key_matches(key, e->hash, e->response)) {
+            if (now >= e->expires_us) {
+                cache_remove(index);
+                return DNS_NO_ENTRY;
+            }
+            lru_unlink(index);
+            lru_push_front(index);
+            return index;
+        }
+        index = e->bucket_next;
+    }
+    return DNS_NO_ENTRY;
+}
+
+static void cache_store(const dns_key_t *key, const uint8_t *msg, size_t len, uint32_t ttl, int64_t now)
+{
+    uint8_t index = cache_lookup(key, now);
+    if (index != DNS_NO_ENTRY) {
+        cache_remove(index);
+    }
+
+    // Take a free slot, or evict the least recently used entry
+    index = DNS_NO_ENTRY;
+    for (uint8_t i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        if (!s_fwd->entries[i].used) {
+            index = i;
+            break;
+        }
+    }
+    if (index == DNS_NO_ENTRY) {
+        index = s_fwd->lru_tail;
+        cache_remove(index);
+    }
+
+    dns_cache_entry_t *e = &s_fwd->entries[index];
+    uint8_t *bucket = &s_fwd->buckets[key->hash & (DNS_CACHE_BUCKETS - 1)];
+    memcpy(e->response, msg, len);
+    e->len = len;
+    e->hash = key->hash;
+    e->stored_us = now;
+    e->expires_us = now + (int64_t)ttl * 1000000;
+    e->used = true;
+    e->bucket_next = *bucket;
+    *bucket = index;
+    lru_push_front(index);
+}
+
+/* Turn msg into a bare error response carrying the first question_len bytes of the query */
+static void dns_send_error(int sock, uint8_t *msg, size_t question_len, uint16_t rd,
+                           const struct sockaddr_in *client, int rcode)
+{
+    write_u16(msg + 2, DNS_FLAG_QR | DNS_FLAG_RA | rd | rcode);
+    write_u16(msg + 4, question_len > DNS_HEADER_LEN ? 1 : 0);
+    memset(msg + 6, 0, 6);
+    sendto(sock, msg, question_len, 0, (const struct sockaddr *)client, sizeof(*client));
+}
+
+static void dns_send_upstream(dns_pending_t *p)
+{
+    sendto(s_fwd->sock, p->query, p->len, 0, (struct sockaddr *)&s_fwd->upstream, sizeof(s_fwd->upstream));
+    p->sent_us = esp_timer_get_time();
+    p->tries++;
+    metrics_inc(METRIC_DNS_UPSTREAM_QUERIES);
+}
+
+static dns_pending_t *pending_find_id(uint16_t id)
+{
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        if (s_fwd->pending[i].used && read_u16(s_fwd->pending[i].query) == id) {
+            return &s_fwd->pending[i];
+        }
+    }
+    return NULL;
+}
+
+int dns_forwarder_init(void)
+{
+    if (s_fwd) {
+        return s_fwd->sock;
+    }
+    dns_forwarder_t *fwd = calloc(1, sizeof(dns_forwarder_t));
+    if (fwd == NULL) {
+        ESP_LOGE(TAG, "No memory for the DNS cache, forwarding disabled");
+        return -1;
+    }
+    fwd->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fwd->sock < 0) {
+        ESP_LOGE(TAG, "Unable to create upstream socket: errno %d", errno);
+        free(fwd);
+        return -1;
+    }
+    memset(fwd->buckets, DNS_NO_ENTRY, sizeof(fwd->buckets));
+    fwd->lru_head = fwd->lru_tail = DNS_NO_ENTRY;
+    fwd->upstream.sin_family = AF_INET;
+    fwd->upstream.sin_port = htons(DNS_UPSTREAM_PORT);
+    s_fwd = fwd;
+    return fwd->sock;
+}
+
+void dns_forwarder_set_upstream(uint32_t addr, uint16_t port)
+{
+    s_upstream_override_addr = addr;
+    s_upstream_override_port = port;
+}
+
+bool dns_forwarder_ready(void)
+{
+    if (s_fwd == NULL) {
+        return false;
+    }
+
+    // The DHCP lease rarely changes: look at the station interface at most once per DNS_UPSTREAM_REFRESH_MS
+    int64_t now = esp_timer_get_time();
+    if (s_fwd->upstream_checked_us && now - s_fwd->upstream_checked_us < DNS_UPSTREAM_REFRESH_MS * 1000) {
+        return s_fwd->upstream.sin_addr.s_addr != 0;
+    }
+    s_fwd->upstream_checked_us = now;
+
+    esp_ip4_addr_t upstream = { .addr = 0 };
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns_info;
+    if (netif && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0) {
+        if (s_upstream_override_port) {
+            upstream.addr = s_upstream_override_addr;
+            s_fwd->upstream.sin_port = htons(s_upstream_override_port);
+        } else if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK &&
+                   dns_info.ip.type == ESP_IPADDR_TYPE_V4) {
+            upstream.addr = dns_info.ip.u_addr.ip4.addr;
+        }
+    }
+    if (upstream.addr != 0 && upstream.addr != s_fwd->upstream.sin_addr.s_addr) {
+        ESP_LOGI(TAG, "Forwarding to " IPSTR, IP2STR(&upstream));
+    }
+    s_fwd->upstream.sin_addr.s_addr = upstream.addr;
+    return upstream.addr != 0;
+}
+
+void dns_forwarder_query(int sock, uint8_t *msg, size_t len, const struct sockaddr_in *client)
+{
+    uint16_t rd = read_u16(msg + 2) & DNS_FLAG_RD;
+    dns_key_t key;
+
+    if (read_u16(msg + 2) & DNS_OPCODE_MASK) {
+        dns_send_error(sock, msg, DNS_HEADER_LEN, rd, client, DNS_RCODE_NOTIMP);
+        return;
+    }
+    if (read_u16(msg + 4) != 1 || !dns_read_key(msg, len, &key)) {
+        dns_send_error(sock, msg, DNS_HEADER_LEN, rd, client, DNS_RCODE_FORMERR);
+        return;
+    }
+    size_t question_len = DNS_HEADER_LEN + key.name_len + 4;
+
+    int64_t now = esp_timer_get_time();
+    uint8_t hit = cache_lookup(&key, now);
+    if (hit != DNS_NO_ENTRY) {
+        // Reply in place: keep the client's ID and question (and so its name
+        // spelling), take everything else from the cached response
+        const dns_cache_entry_t *e = &s_fwd->entries[hit];
+        memcpy(msg + 2, e->response + 2, DNS_HEADER_LEN - 2);
+        memcpy(msg + question_len, e->response + question_len, e->len - question_len);
+        write_u16(msg + 2, (read_u16(msg + 2) & ~DNS_FLAG_RD) | rd);
+        dns_age_ttls(msg, e->len, (now - e->stored_us) / 1000000);
+        sendto(sock, msg, e->len, 0, (const struct sockaddr *)client, sizeof(*client));
+        metrics_inc(METRIC_DNS_CACHE_HITS);
+        return;
+    }
+
+    // Same question already on its way upstream: wait for that answer
+    dns_pending_t *slot = NULL;
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        dns_pending_t *p = &s_fwd->pending[i];
+        if (!p->used) {
+            if (slot == NULL) {
+                slot = p;
+            }
+            continue;
+        }
+        if (dns_key_matches(&key, p->hash, p->query)) {
+            if (p->waiter_count < DNS_PENDING_WAITERS) {
+                dns_waiter_t *w = &p->waiters[p->waiter_count++];
+                w->addr = *client;
+                w->id = read_u16(msg);
+                w->rd = rd;
+            }
+            // Otherwise drop it: the client retries and will likely hit the cache
+            return;
+        }
+    }
+    if (slot == NULL) {
+        dns_send_error(sock, msg, question_len, rd, client, DNS_RCODE_SERVFAIL);
+        return;
+    }
+
+    // Forward only the question, under a fresh ID; any EDNS options are left
+    // out so the answer always fits DNS_MAX_UDP_LEN
+    uint16_t id;
+    do {
+        id = esp_random() & 0xffff;
+    } while (pending_find_id(id) != NULL);
+
+    slot->used = true;
+    slot->tries = 0;
+    slot->hash = key.hash;
+    slot->len = question_len;
+    slot->waiter_count = 1;
+    slot->waiters[0].addr = *client;
+    slot->waiters[0].id = read_u16(msg);
+    slot->waiters[0].rd = rd;
+    memcpy(slot->query, msg, question_len);
+    write_u16(slot->query, id);
+    write_u16(slot->query + 2, DNS_FLAG_RD);
+    memset(slot->query + 6, 0, 6);
+    dns_send_upstream(slot);
+}
+
+void dns_forwarder_receive(int sock)
+{
+    uint8_t buffer[DNS_MAX_UDP_LEN];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    dns_key_t key;
+
+    int len = recvfrom(s_fwd->sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromlen);
+    if (len < DNS_HEADER_LEN || !(read_u16(buffer + 2) & DNS_FLAG_QR)) {
+        return;
+    }
+    // Only accept the answer from the resolver we asked, to the question we asked
+    if (from.sin_addr.s_addr != s_fwd->upstream.sin_addr.s_addr || from.sin_port != s_fwd->upstream.sin_port) {
+        return;
+    }
+    dns_pending_t *p = pending_find_id(read_u16(buffer));
+    if (p == NULL || read_u16(buffer + 4) != 1 || !dns_read_key(buffer, len, &key) ||
+        !dns_key_matches(&key, p->hash, p->query)) {
+        return;
+    }
+
+    uint32_t ttl = dns_cache_ttl(buffer, len);
+    if (ttl > 0) {
+        cache_store(&key, buffer, len, ttl, esp_timer_get_time());
+    }
+
+    uint16_t flags = read_u16(buffer + 2) & ~DNS_FLAG_RD;
+    for (int i = 0; i < p->waiter_count; i++) {
+        const dns_waiter_t *w = &p->waiters[i];
+        write_u16(buffer, w->id);
+        write_u16(buffer + 2, flags | w->rd);
+        sendto(sock, buffer, len, 0, (const struct sockaddr *)&w->addr, sizeof(w->addr));
+    }
+    p->used = false;
+}
+
+int dns_forwarder_poll(int sock)
+{
+    if (s_fwd == NULL) {
+        return -1;
+    }
+    int64_t now = esp_timer_get_time();
+    int next_ms = -1;
+
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        dns_pending_t *p = &s_fwd->pending[i];
+        if (!p->used) {
+            continue;
+        }
+        int64_t wait_ms = DNS_FORWARD_RETRY_MS - (now - p->sent_us) / 1000;
+        if (wait_ms <= 0) {
+            if (p->tries >= DNS_FORWARD_TRIES) {
+                ESP_LOGW(TAG, "Upstream resolver did not answer");
+                uint8_t reply[sizeof(p->query)];
+                for (int j = 0; j < p->waiter_count; j++) {
+                    memcpy(reply, p->query, p->len);
+                    write_u16(reply, p->waiters[j].id);
+                    dns_send_error(sock, reply, p->len, p->waiters[j].rd, &p->waiters[j].addr, DNS_RCODE_SERVFAIL);
+                }
+                p->used = false;
+                continue;
+            }
+            dns_send_upstream(p);
+            wait_ms = DNS_FORWARD_RETRY_MS;
+        }
+        if (next_ms < 0 || wait_ms < next_ms) {
+            next_ms = wait_ms;
+        }
+    }
+    return next_ms;
+}
@@ -1,26 +1,259 @@
 /*
  * DNS Server for Captive Portal
- * Redirects all queries to the SoftAP IP address
+ * Answers every A query from SoftAP clients with the SoftAP address and gives
+ * immediate negative answers for everything else, so clients never sit in
+ * resolver timeouts. Queries arriving over the station interface are handed to
+ * the caching forwarder (dns_forwarder.c) instead.
  */
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_netif.h"
 #include "lwip/sockets.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
+#include "dns_message.h"
+#include "dns_forwarder.h"
+#include "metrics.h"
 
 static const char *TAG = "dns_server";
 
+#ifndef DNS_PORT
+#define DNS_PORT            53      // Overridden by the host benchmark build (tools/dns_bench)
+#endif
+#define DNS_ANSWER_TTL      60
+#define DNS_NEGATIVE_TTL    60      // SOA minimum: how long clients cache NODATA/NXDOMAIN
+#define DNS_AP_IP_REFRESH_MS 1000
+
+typedef struct {
+    uint16_t name_offset;   // Offset of the QNAME in the request, reused for compression
+    uint16_t qtype;
+    uint16_t qclass;
+} dns_question_t;
+
+#define DNS_MAX_QUESTIONS 4
+
+typedef struct {
+    uint16_t id;
+    uint16_t flags;
+    uint16_t qdcount;
+    dns_question_t questions[DNS_MAX_QUESTIONS];
+    size_t question_end;    // Offset just past the question section
+    bool has_edns;
+    uint8_t edns_version;
+    uint16_t udp_payload;   // Largest response the client accepts
+} dns_query_t;
+
+/* Parse header, questions and the EDNS0 OPT record. Returns an RCODE. */
+static int dns_parse_query(const uint8_t *msg, size_t len, dns_query_t *query)
+{
+    query->id = read_u16(msg);
+    query->flags = read_u16(msg + 2);
+    query->qdcount = read_u16(msg + 4);
+    query->has_edns = false;
+    query->edns_version = 0;
+    query->udp_payload = DNS_MAX_UDP_LEN;
+    query->question_end = DNS_HEADER_LEN;
+
+    if (query->flags & DNS_OPCODE_MASK) {
+        return DNS_RCODE_NOTIMP;
+    }
+    if (query->qdcount == 0 || query->qdcount > DNS_MAX_QUESTIONS) {
+        return DNS_RCODE_FORMERR;
+    }
+
+    size_t offset = DNS_HEADER_LEN;
+    for (int i = 0; i < query->qdcount; i++) {
+        size_t name_end = dns_skip_name(msg, len, offset);
+        if (name_end == 0 || name_end + 4 > len) {
+            return DNS_RCODE_FORMERR;
+        }
+        query->questions[i].name_offset = offset;
+        query->questions[i].qtype = read_u16(msg + name_end);
+        query->questions[i].qclass = read_u16(msg + name_end + 2);
+        offset = name_end + 4;
+    }
+    query->question_end = offset;
+
+    // Walk answer/authority (normally empty in queries) and additional records for OPT
+    uint16_t rr_count = read_u16(msg + 6) + read_u16(msg + 8) + read_u16(msg + 10);
+    for (int i = 0; i < rr_count; i++) {
+        size_t name_end = dns_skip_name(msg, len, offset);
+        if (name_end == 0 || name_end + 10 > len) {
+            return DNS_RCODE_FORMERR;
+        }
+        uint16_t type = read_u16(msg + name_end);
+        uint16_t rdlen = read_u16(msg + name_end + 8);
+        if (type == DNS_TYPE_OPT && !query->has_edns) {
+            uint16_t payload = read_u16(msg + name_end + 2);
+            query->has_edns = true;
+            query->edns_version = msg[name_end + 5];
+            query->udp_payload = payload < DNS_MAX_UDP_LEN ? DNS_MAX_UDP_LEN : payload;
+        }
+        offset = name_end + 10 + rdlen;
+        if (offset > len) {
+            return DNS_RCODE_FORMERR;
+        }
+    }
+
+    if (query->has_edns && query->edns_version != 0) {
+        return DNS_RCODE_BADVERS;
+    }
+    return DNS_RCODE_NOERROR;
+}
+
+/*
+ * Resource records are copied from precomputed templates; only the name
+ * pointer (and for OPT the extended RCODE) is patched per response.
+ */
+#define DNS_ANSWER_A_LEN   16
+#define DNS_SOA_LEN        34
+#define DNS_OPT_LEN        11
+
+static uint8_t answer_a_template[DNS_ANSWER_A_LEN] = {
+    0xc0, 0x0c,                             // Name pointer (patched)
+    0x00, DNS_TYPE_A, 0x00, DNS_CLASS_IN,
+    0x00, 0x00, 0x00, DNS_ANSWER_TTL,
+    0x00, 0x04,
+    0, 0, 0, 0                              // Address (set by dns_refresh_ap_ip)
+};
+
+/* Synthetic SOA so that negative answers are cached for DNS_NEGATIVE_TTL (RFC 2308) */
+static const uint8_t soa_template[DNS_SOA_LEN] = {
+    0xc0, 0x0c,                             // Name pointer (patched)
+    0x00, DNS_TYPE_SOA, 0x00, DNS_CLASS_IN,
+    0x00, 0x00, 0x00, DNS_NEGATIVE_TTL,
+    0x00, 22,                               // RDLEN
+    0x00,                                   // MNAME: root
+    0x00,                                   // RNAME: root
+    0x00, 0x00, 0x00, 0x01,                 // SERIAL
+    0x00, 0x00, 0x0e, 0x10,                 // REFRESH 3600
+    0x00, 0x00, 0x02, 0x58,                 // RETRY 600
+    0x00, 0x01, 0x51, 0x80,                 // EXPIRE 86400
+    0x00, 0x00, 0x00, DNS_NEGATIVE_TTL      // MINIMUM
+};
+
+static const uint8_t opt_template[DNS_OPT_LEN] = {
+    0x00,                                   // Root name
+    0x00, DNS_TYPE_OPT,
+    DNS_MAX_UDP_LEN >> 8, DNS_MAX_UDP_LEN & 0xff,
+    0x00,                                   // Extended RCODE (patched)
+    0x00,                                   // Version
+    0x00, 0x00,                             // Flags
+    0x00, 0x00                              // RDLEN
+};
+
+static inline uint8_t *put_record(uint8_t *p, const uint8_t *tmpl, size_t len, uint16_t name_offset)
+{
+    memcpy(p, tmpl, len);
+    write_u16(p, 0xc000 | name_offset);
+    return p + len;
+}
+
+/*
+ * Turn the query in msg into the response, in place. The header is rewritten,
+ * the question section is left where it is, and records are written after it,
+ * overwriting any records the query carried (already parsed into query).
+ * Returns the response length.
+ */
+static size_t dns_build_response(uint8_t *msg, size_t buf_len, const dns_query_t *query, int rcode, bool have_ip)
+{
+    size_t limit = query->udp_payload < buf_len ? query->udp_payload : buf_len;
+    uint16_t flags = DNS_FLAG_QR | DNS_FLAG_AA | (query->flags & (DNS_OPCODE_MASK | DNS_FLAG_RD));
+    uint16_t qdcount = 0, ancount = 0, nscount = 0;
+    size_t opt_len = query->has_edns ? DNS_OPT_LEN : 0;
+    uint8_t *p = msg + DNS_HEADER_LEN;
+
+    // Keep the questions when they were parsed successfully
+    if (rcode != DNS_RCODE_FORMERR && rcode != DNS_RCODE_NOTIMP) {
+        p = msg + query->question_end;
+        qdcount = query->qdcount;
+    }
+
+    if (rcode == DNS_RCODE_NOERROR) {
+        int negative = 0, nxdomain = 0;
+        for (int i = 0; i < query->qdcount; i++) {
+            const dns_question_t *q = &query->questions[i];
+            if (q->qclass == DNS_CLASS_IN && q->qtype == DNS_TYPE_A && have_ip) {
+                if ((p - msg) + DNS_ANSWER_A_LEN + opt_len > limit) {
+                    flags |= DNS_FLAG_TC;
+                    break;
+                }
+                p = put_record(p, answer_a_template, DNS_ANSWER_A_LEN, q->name_offset);
+                ancount++;
+            } else {
+                // AAAA, HTTPS/SVCB and friends: answer NODATA right away so the
+                // client falls back to A instead of waiting for a timeout.
+                // Reverse lookups have no records here at all: NXDOMAIN.
+                negative++;
+                if (q->qtype == DNS_TYPE_PTR) {
+                    nxdomain++;
+                }
+            }
+        }
+        if (ancount == 0 && negative > 0) {
+            if (nxdomain == query->qdcount) {
+                rcode = DNS_RCODE_NXDOMAIN;
+            }
+            if ((p - msg) + DNS_SOA_LEN + opt_len <= limit) {
+                p = put_record(p, soa_template, DNS_SOA_LEN, query->questions[0].name_offset);
+                nscount = 1;
+            }
+        }
+    }
+
+    if (query->has_edns) {
+        memcpy(p, opt_template, DNS_OPT_LEN);
+        p[5] = (rcode >> 4) & 0xff;
+        p += DNS_OPT_LEN;
+    }
+
+    // The ID is already in place
+    write_u16(msg + 2, flags | (rcode & 0x0f));
+    write_u16(msg + 4, qdcount);
+    write_u16(msg + 6, ancount);
+    write_u16(msg + 8, nscount);
+    write_u16(msg + 10, query->has_edns ? 1 : 0);
+    return p - msg;
+}
+
+static esp_netif_ip_info_t s_ap_ip_info;
+
+/*
+ * Load the current SoftAP address into the answer template.
+ * Returns false if the AP has no address (A queries then get NODATA).
+ */
+static bool dns_refresh_ap_ip(void)
+{
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    if (netif == NULL || esp_netif_get_ip_info(netif, &s_ap_ip_info) != ESP_OK || s_ap_ip_info.ip.addr == 0) {
+        s_ap_ip_info.ip.addr = 0;
+        return false;
+    }
+    // Already in network byte order
+    memcpy(&answer_a_template[DNS_ANSWER_A_LEN - 4], &s_ap_ip_info.ip.addr, 4);
+    return true;
+}
+
+/* Clients joined to our SoftAP get the captive portal; everyone else is forwarded */
+static inline bool dns_from_ap_client(const struct sockaddr_in *addr)
+{
+    return s_ap_ip_info.ip.addr != 0 &&
+           ((addr->sin_addr.s_addr ^ s_ap_ip_info.ip.addr) & s_ap_ip_info.netmask.addr) == 0;
+}
+
 void dns_server_task(void *pvParameters)
 {
-    char rx_buffer[512];
-    char tx_buffer[512];
+    // Requests are answered in place: one buffer, no copy of the query
+    uint8_t buffer[DNS_MAX_UDP_LEN];
     int sock = -1;
     struct sockaddr_in dest_addr;
 
     // Set up UDP socket
     dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(53);
+    dest_addr.sin_port = htons(DNS_PORT);
 
     sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (sock < 0) {
@@ -37,100 +270,70 @@ void dns_server_task(void *pvParameters)
         return;
     }
 
-    ESP_LOGI(TAG, "DNS Server started on port 53");
+    ESP_LOGI(TAG, "DNS Server started on port %d", DNS_PORT);
 
     struct sockaddr_in source_addr;
-    socklen_t socklen = sizeof(source_addr);
+    socklen_t socklen;
+    dns_query_t query;
+    bool have_ip = dns_refresh_ap_ip();
+    TickType_t ip_checked = xTaskGetTickCount();
+    int upstream_sock = dns_forwarder_init();
 
     while (1) {
-        int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
+        // Wait for a client query, an upstream answer, or the next retransmission
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(sock, &readfds);
+        int max_fd = sock;
+        int wait_ms = -1;
+        if (upstream_sock >= 0) {
+            FD_SET(upstream_sock, &readfds);
+            max_fd = upstream_sock > sock ? upstream_sock : sock;
+            wait_ms = dns_forwarder_poll(sock);
+        }
+        struct timeval timeout = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+        int ready = select(max_fd + 1, &readfds, NULL, NULL, wait_ms < 0 ? NULL : &timeout);
+        if (ready < 0) {
+            ESP_LOGE(TAG, "select failed: errno %d", errno);
+            break;
+        }
+        if (upstream_sock >= 0 && FD_ISSET(upstream_sock, &readfds)) {
+            dns_forwarder_receive(sock);
+        }
+        if (!FD_ISSET(sock, &readfds)) {
+            continue;
+        }
+
+        socklen = sizeof(source_addr);
+        int len = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_addr, &socklen);
 
         if (len < 0) {
             ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
             break;
         }
 
-        // DNS Header Processing (Simplified)
-        // We just want to spoof the answer to point to our IP
-        if (len > 12) {
-            // Prepare response
-            memcpy(tx_buffer, rx_buffer, len); // Copy query to response
-
-            // Set QR to response (bit 15), AA (Authoritative Answer, bit 10)
-            tx_buffer[2] |= 0x84;
-            
-            // Set RCODE to 0 (No Error) if it was a standard query
-            if ((tx_buffer[2] & 0x78) == 0) {
-                 tx_buffer[3] &= 0xF0; // Clear RCODE
-            }
-            
-            // Set Answer Count to 1
-            tx_buffer[6] = 0x00;
-            tx_buffer[7] = 0x01;
-
-            // Pointer to the queried name in the question section
-            // In a real DNS server we would parse the question section to find where it ends.
-            // For this simple captive portal, we assume the question section ends at 'len'
-            // and we append the answer resource record.
-            
-            // However, constructing a valid DNS packet requires parsing the QNAME.
-            // Simplified approach: Find the end of QNAME.
-            int qname_len = 0;
-            char *p = rx_buffer + 12;
-            while(p < rx_buffer + len && *p != 0) {
-                qname_len++;
-                p++;
-            }
-            if (p >= rx_buffer + len) {
-                 continue; // Malformed packet
-            }
-            qname_len++; // Include null terminator
-
-            int qtype_offset = 12 + qname_len;
-            
-            // We only answer A records (Type 1)
-            if (qtype_offset + 4 <= len) {
-                // Check QTYPE (bytes at qtype_offset and qtype_offset+1)
-                // 0x00 0x01 is A record
-                if (rx_buffer[qtype_offset] == 0x00 && rx_buffer[qtype_offset+1] == 0x01) {
-                    // Construct Answer
-                    // Name ptr (0xC00C points to header + 12)
-                    int ans_offset = len;
-                    
-                    // Check buffer space
-                    if (ans_offset + 16 < sizeof(tx_buffer)) {
-                        tx_buffer[ans_offset++] = 0xC0;
-                        tx_buffer[ans_offset++] = 0x0C;
-                        
-                        // Type: A (0x0001)
-                        tx_buffer[ans_offset++] = 0x00;
-                        tx_buffer[ans_offset++] = 0x01;
-                        
-                        // Class: IN (0x0001)
-                        tx_buffer[ans_offset++] = 0x00;
-                        tx_buffer[ans_offset++] = 0x01;
-                        
-                        // TTL: 60s
-                        tx_buffer[ans_offset++] = 0x00;
-                        tx_buffer[ans_offset++] = 0x00;
-                        tx_buffer[ans_offset++] = 0x00;
-                        tx_buffer[ans_offset++] = 0x3C;
-                        
-                        // Data Length: 4
-                        tx_buffer[ans_offset++] = 0x00;
-                        tx_buffer[ans_offset++] = 0x04;
-                        
-                        // IP Address: 192.168.4.1 (C0 A8 04 01)
-                        tx_buffer[ans_offset++] = 192;
-                        tx_buffer[ans_offset++] = 168;
-                        tx_buffer[ans_offset++] = 4;
-                        tx_buffer[ans_offset++] = 1;
-
-                        sendto(sock, tx_buffer, ans_offset, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                    }
-                }
-            }
+        // Too short to echo an ID, or not a query: drop silently
+        if (len < DNS_HEADER_LEN || (read_u16(buffer + 2) & DNS_FLAG_QR)) {
+            continue;
+        }
+        metrics_inc(METRIC_DNS_QUERIES);
+
+        // The AP address rarely changes: re-read it at most once per DNS_AP_IP_REFRESH_MS
+        TickType_t now = xTaskGetTickCount();
+        if (!have_ip || now - ip_checked >= pdMS_TO_TICKS(DNS_AP_IP_REFRESH_MS)) {
+            have_ip = dns_refresh_ap_ip();
+            ip_checked = now;
         }
+
+        if (!dns_from_ap_client(&source_addr) && dns_forwarder_ready()) {
+            dns_forwarder_query(sock, buffer, len, &source_addr);
+            continue;
+        }
+
+        int rcode = dns_parse_query(buffer, len, &query);
+        size_t resp_len = dns_build_response(buffer, sizeof(buffer), &query, rcode, have_ip);
+
+        sendto(sock, buffer, resp_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
     }
 
     close(sock);
@@ -0,0 +1,510 @@
+/*
+ * File Server
+ * Streamed upload/download of shared files stored in a SPIFFS partition
+ */
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "file_server.h"
+#include "web_worker.h"
+#include "clipboard_service.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_spiffs.h"
+#include "esp_log.h"
+
+static const char *TAG = "file_server";
+
+#define FILES_URI_PREFIX   "/files"
+#define UPLOAD_TMP_PATH    FILE_SERVER_BASE_PATH "/.upload"
+#define FILE_PATH_MAX_LEN  (sizeof(FILE_SERVER_BASE_PATH) + 1 + FILE_SERVER_NAME_MAX_LEN)
+#define URI_LIST_TYPE      "text/uri-list"
+
+typedef enum {
+    RANGE_NONE,
+    RANGE_OK,
+    RANGE_UNSATISFIABLE,
+} range_result_t;
+
+static bool s_mounted = false;
+// Only one upload at a time: they share the temporary file and compete for space
+static SemaphoreHandle_t s_upload_lock = NULL;
+
+esp_err_t file_server_init(void)
+{
+    if (s_mounted) {
+        return ESP_OK;
+    }
+
+    const esp_vfs_spiffs_conf_t conf = {
+        .base_path = FILE_SERVER_BASE_PATH,
+        .partition_label = FILE_SERVER_PARTITION_LABEL,
+        .max_files = 4,
+        .format_if_mount_failed = true
+    };
+    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount file partition: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    s_upload_lock = xSemaphoreCreateMutex();
+    if (s_upload_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // A stale temporary file means an upload was interrupted by a reset
+    unlink(UPLOAD_TMP_PATH);
+
+    size_t total = 0, used = 0;
+    esp_spiffs_info(FILE_SERVER_PARTITION_LABEL, &total, &used);
+    ESP_LOGI(TAG, "File partition mounted: %u/%u bytes used", (unsigned)used, (unsigned)total);
+    s_mounted = true;
+    return ESP_OK;
+}
+
+static bool is_valid_name(const char *name, size_t len)
+{
+    if (len == 0 || len > FILE_SERVER_NAME_MAX_LEN || name[0] == '.') {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '.' || c == '_' || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Split the request URI into the file name after "/files/".
+ * Returns the name length, 0 for the listing ("/files" or "/files/"), or -1 if invalid.
+ */
+static int get_file_name(httpd_req_t *req, char *name, size_t name_len)
+{
+    const char *p = req->uri + strlen(FILES_URI_PREFIX);
+    size_t len = strcspn(p, "?");
+    if (len == 0 || (len == 1 && p[0] == '/')) {
+        return 0;
+    }
+    if (p[0] != '/' || !is_valid_name(p + 1, len - 1) || len - 1 >= name_len) {
+        return -1;
+    }
+    memcpy(name, p + 1, len - 1);
+    name[len - 1] = '\0';
+    return len - 1;
+}
+
+static void get_file_path(char *path, size_t path_len, const char *name)
+{
+    snprintf(path, path_len, FILE_SERVER_BASE_PATH "/%s", name);
+}
+
+static const char *get_content_type(const char *name)
+{
+    static const struct {
+        const char *ext;
+        const char *type;
+    } types[] = {
+        { ".txt",  "text/plain; charset=utf-8" },
+        { ".html", "text/html" },
+        { ".json", "application/json" },
+        { ".pdf",  "application/pdf" },
+        { ".png",  "image/png" },
+        { ".jpg",  "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif",  "image/gif" },
+        { ".zip",  "application/zip" },
+    };
+    const char *ext = strrchr(name, '.');
+    if (ext != NULL) {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (strcasecmp(ext, types[i].ext) == 0) {
+                return types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+/*
+ * Parse a single "bytes=" range. Multiple ranges are not supported and are
+ * treated as no range at all, which RFC 9110 allows.
+ */
+static range_result_t parse_range(httpd_req_t *req, size_t size, size_t *start, size_t *end)
+{
+    char value[48];
+    size_t len = httpd_req_get_hdr_value_len(req, "Range");
+    if (len == 0 || len >= sizeof(value) ||
+        httpd_req_get_hdr_value_str(req, "Range", value, sizeof(value)) != ESP_OK) {
+        return RANGE_NONE;
+    }
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL) {
+        return RANGE_NONE;
+    }
+
+    const char *spec = value + 6;
+    const char *dash = strchr(spec, '-');
+    if (dash == NULL) {
+        return RANGE_NONE;
+    }
+
+    char *endp;
+    if (dash == spec) {
+        // Suffix range: last N bytes
+        unsigned long suffix = strtoul(dash + 1, &endp, 10);
+        if (endp == dash + 1 || *endp != '\0') {
+            return RANGE_NONE;
+        }
+        if (suffix == 0 || size == 0) {
+            return RANGE_UNSATISFIABLE;
+        }
+        *start = suffix >= size ? 0 : size - suffix;
+        *end = size - 1;
+        return RANGE_OK;
+    }
+
+    unsigned long first = strtoul(spec, &endp, 10);
+    if (endp != dash) {
+        return RANGE_NONE;
+    }
+    unsigned long last = size > 0 ? size - 1 : 0;
+    if (dash[1] != '\0') {
+        last = strtoul(dash + 1, &endp, 10);
+        if (*endp != '\0' || last < first) {
+            return RANGE_NONE;
+        }
+        if (last >= size) {
+            last = size - 1;
+        }
+    }
+    if (first >= size) {
+        return RANGE_UNSATISFIABLE;
+    }
+    *start = first;
+    *end = last;
+    return RANGE_OK;
+}
+
+/* Stream the directory listing as JSON, one entry per chunk */
+static esp_err_t send_listing(httpd_req_t *req)
+{
+    DIR *dir = opendir(FILE_SERVER_BASE_PATH);
+    if (dir == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    size_t total = 0, used = 0;
+    esp_spiffs_info(FILE_SERVER_PARTITION_LABEL, &total, &used);
+
+    char buf[96];
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    snprintf(buf, sizeof(buf), "{\"total\":%u,\"used\":%u,\"files\":[", (unsigned)total, (unsigned)used);
+    esp_err_t ret = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+
+    bool first = true;
+    struct dirent *entry;
+    char path[FILE_PATH_MAX_LEN];
+    while (ret == ESP_OK && (entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        // Skip the upload temporary file and anything not created through this API
+        if (!is_valid_name(entry->d_name, name_len)) {
+            continue;
+        }
+        struct stat st;
+        get_file_path(path, sizeof(path), entry->d_name);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"size\":%ld}",
+                 first ? "" : ",", entry->d_name, (long)st.st_size);
+        ret = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+        first = false;
+    }
+    closedir(dir);
+
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, "]}", 2);
+    }
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return ret;
+}
+
+static esp_err_t send_file(httpd_req_t *req, const char *name)
+{
+    char path[FILE_PATH_MAX_LEN];
+    get_file_path(path, sizeof(path), name);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+        return ESP_FAIL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    size_t size = st.st_size;
+    size_t start = 0;
+    size_t end = size > 0 ? size - 1 : 0;
+    char content_range[48];
+
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    range_result_t range = parse_range(req, size, &start, &end);
+    if (range == RANGE_UNSATISFIABLE) {
+        close(fd);
+        snprintf(content_range, sizeof(content_range), "bytes */%u", (unsigned)size);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        return httpd_resp_send(req, NULL, 0);
+    }
+    if (range == RANGE_OK) {
+        snprintf(content_range, sizeof(content_range), "bytes %u-%u/%u",
+                 (unsigned)start, (unsigned)end, (unsigned)size);
+        httpd_resp_set_status(req, "206 Partial Content");
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        if (lseek(fd, start, SEEK_SET) < 0) {
+            close(fd);
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+    }
+    httpd_resp_set_type(req, get_content_type(name));
+
+    // Read straight from flash into a fixed buffer and push it to the socket
+    char buf[FILE_SERVER_CHUNK_LEN];
+    size_t remaining = size > 0 ? end - start + 1 : 0;
+    esp_err_t ret = ESP_OK;
+    while (remaining > 0) {
+        size_t to_read = remaining < sizeof(buf) ? remaining : sizeof(buf);
+        ssize_t n = read(fd, buf, to_read);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "Read failed on %s", name);
+            ret = ESP_FAIL;
+            break;
+        }
+        ret = httpd_resp_send_chunk(req, buf, n);
+        if (ret != ESP_OK) {
+            break;
+        }
+        remaining -= n;
+    }
+    close(fd);
+
+    if (ret != ESP_OK) {
+        // Headers are already out: just drop the connection
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* HTTP GET Handler for "/files*" */
+static esp_err_t files_get_handler(httpd_req_t *req)
+{
+    // Flash reads take as long as the client takes to drain them: run on the worker pool
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, files_get_handler);
+    }
+
+    char name[FILE_SERVER_NAME_MAX_LEN + 1];
+    int len = get_file_name(req, name, sizeof(name));
+    if (len < 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+        return ESP_FAIL;
+    }
+    if (len == 0) {
+        return send_listing(req);
+    }
+    return send_file(req, name);
+}
+
+/* Point the shared clipboard at an uploaded file */
+static void set_clipboard_reference(const char *name)
+{
+    char ref[FILE_PATH_MAX_LEN];
+    get_file_path(ref, sizeof(ref), name);
+
+    uint32_t version = 0;
+    if (clipboard_service_set_bytes(ref, strlen(ref), URI_LIST_TYPE, &version) == ESP_OK) {
+        ESP_LOGI(TAG, "Shared clipboard now references %s (version %lu)", ref, (unsigned long)version);
+    }
+}
+
+/* Stream the request body into the temporary file. Sends the error response on failure. */
+static esp_err_t receive_upload(httpd_req_t *req)
+{
+    int fd = open(UPLOAD_TMP_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to create %s", UPLOAD_TMP_PATH);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    char buf[FILE_SERVER_CHUNK_LEN];
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        int ret = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+        if (ret <= 0) {
+            close(fd);
+            unlink(UPLOAD_TMP_PATH);
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            return ESP_FAIL;
+        }
+        if (write(fd, buf, ret) != ret) {
+            ESP_LOGE(TAG, "Write failed, partition full?");
+            close(fd);
+            unlink(UPLOAD_TMP_PATH);
+            httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LONG, "Not enough space");
+            return ESP_FAIL;
+        }
+        remaining -= ret;
+    }
+
+    if (close(fd) != 0) {
+        unlink(UPLOAD_TMP_PATH);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* HTTP PUT Handler for "/files/<name>" */
+static esp_err_t files_put_handler(httpd_req_t *req)
+{
+    // Flash writes are slow: run on the worker pool
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, files_put_handler);
+    }
+
+    char name[FILE_SERVER_NAME_MAX_LEN + 1];
+    if (get_file_name(req, name, sizeof(name)) <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+        return ESP_FAIL;
+    }
+
+    size_t total = 0, used = 0;
+    esp_spiffs_info(FILE_SERVER_PARTITION_LABEL, &total, &used);
+    if (req->content_len > total - used) {
+        httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LONG, "Not enough space");
+        return ESP_FAIL;
+    }
+
+    if (xSemaphoreTake(s_upload_lock, 0) != pdTRUE) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    // Upload to a temporary file so a failed upload never clobbers the old one
+    esp_err_t err = receive_upload(req);
+    if (err == ESP_OK) {
+        char path[FILE_PATH_MAX_LEN];
+        get_file_path(path, sizeof(path), name);
+        unlink(path);
+        if (rename(UPLOAD_TMP_PATH, path) != 0) {
+            ESP_LOGE(TAG, "Failed to rename upload to %s", path);
+            unlink(UPLOAD_TMP_PATH);
+            httpd_resp_send_500(req);
+            err = ESP_FAIL;
+        }
+    }
+    xSemaphoreGive(s_upload_lock);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Stored %s (%u bytes)", name, (unsigned)req->content_len);
+
+    char query[32];
+    char value[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "clip", value, sizeof(value)) == ESP_OK &&
+        strcmp(value, "1") == 0) {
+        set_clipboard_reference(name);
+    }
+
+    httpd_resp_set_status(req, "201 Created");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* HTTP DELETE Handler for "/files/<name>" */
+static esp_err_t files_delete_handler(httpd_req_t *req)
+{
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, files_delete_handler);
+    }
+
+    char name[FILE_SERVER_NAME_MAX_LEN + 1];
+    if (get_file_name(req, name, sizeof(name)) <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+        return ESP_FAIL;
+    }
+
+    char path[FILE_PATH_MAX_LEN];
+    get_file_path(path, sizeof(path), name);
+    if (unlink(path) != 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Deleted %s", name);
+    httpd_resp_set_status(req, "204 No Content");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static const httpd_uri_t files_get_uri = {
+    .uri       = "/files*",
+    .method    = HTTP_GET,
+    .handler   = files_get_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t files_put_uri = {
+    .uri       = "/files/*",
+    .method    = HTTP_PUT,
+    .handler   = files_put_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t files_delete_uri = {
+    .uri       = "/files/*",
+    .method    = HTTP_DELETE,
+    .handler   = files_delete_handler,
+    .user_ctx  = NULL
+};
+
+esp_err_t file_server_register(httpd_handle_t server)
+{
+    if (!s_mounted) {
+        ESP_LOGW(TAG, "File partition not mounted, /files disabled");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = httpd_register_uri_handler(server, &files_get_uri);
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(server, &files_put_uri);
+    }
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(server, &files_delete_uri);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register file handlers: %s", esp_err_to_name(err));
+    }
+    return err;
+}
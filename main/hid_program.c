@@ -0,0 +1,363 @@
+/*
+ * Keystroke program compiler
+ * Turns text into the rolling-chord key presses used by the USB HID task, once,
+ * so typing the same text again costs nothing but report submission. With
+ * macros enabled it also compiles {...} chords, waits and repeats.
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "hid_program.h"
+#include "class/hid/hid.h"
+
+static const struct {
+    const char *name;
+    uint8_t modifier;
+} modifier_names[] = {
+    { "CTRL", KEYBOARD_MODIFIER_LEFTCTRL },
+    { "CONTROL", KEYBOARD_MODIFIER_LEFTCTRL },
+    { "SHIFT", KEYBOARD_MODIFIER_LEFTSHIFT },
+    { "ALT", KEYBOARD_MODIFIER_LEFTALT },
+    { "GUI", KEYBOARD_MODIFIER_LEFTGUI },
+    { "WIN", KEYBOARD_MODIFIER_LEFTGUI },
+    { "CMD", KEYBOARD_MODIFIER_LEFTGUI },
+    { "RCTRL", KEYBOARD_MODIFIER_RIGHTCTRL },
+    { "RSHIFT", KEYBOARD_MODIFIER_RIGHTSHIFT },
+    { "RALT", KEYBOARD_MODIFIER_RIGHTALT },
+    { "ALTGR", KEYBOARD_MODIFIER_RIGHTALT },
+    // Right GUI is bit 7, which a MOD op cannot carry
+};
+
+static const struct {
+    const char *name;
+    uint8_t keycode;
+} key_names[] = {
+    { "ENTER", HID_KEY_ENTER },
+    { "TAB", HID_KEY_TAB },
+    { "ESC", HID_KEY_ESCAPE },
+    { "SPACE", HID_KEY_SPACE },
+    { "BACKSPACE", HID_KEY_BACKSPACE },
+    { "DELETE", HID_KEY_DELETE },
+    { "DEL", HID_KEY_DELETE },
+    { "INSERT", HID_KEY_INSERT },
+    { "HOME", HID_KEY_HOME },
+    { "END", HID_KEY_END },
+    { "PGUP", HID_KEY_PAGE_UP },
+    { "PGDN", HID_KEY_PAGE_DOWN },
+    { "UP", HID_KEY_ARROW_UP },
+    { "DOWN", HID_KEY_ARROW_DOWN },
+    { "LEFT", HID_KEY_ARROW_LEFT },
+    { "RIGHT", HID_KEY_ARROW_RIGHT },
+    { "CAPSLOCK", HID_KEY_CAPS_LOCK },
+    { "PRINTSCREEN", HID_KEY_PRINT_SCREEN },
+    { "SCROLLLOCK", HID_KEY_SCROLL_LOCK },
+    { "PAUSE", HID_KEY_PAUSE },
+    { "MENU", HID_KEY_APPLICATION },
+};
+
+void hid_compiler_init(hid_compiler_t *c, const keymap_key_t *keymap, bool macros)
+{
+    memset(c, 0, sizeof(*c));
+    c->keymap = keymap;
+    c->macros = macros;
+}
+
+static bool compiler_holds(const hid_compiler_t *c, uint8_t keycode)
+{
+    for (int i = 0; i < c->count; i++) {
+        if (c->keys[i] == keycode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Add a key to the chord. It is released first when the key needs another
+ * modifier, is already down, or the report is full.
+ */
+static uint8_t *emit_key(hid_compiler_t *c, uint8_t *out, uint8_t modifier, uint8_t keycode)
+{
+    if (c->modifier != modifier || c->count == HID_PROGRAM_ROLLOVER || compiler_holds(c, keycode)) {
+        *out++ = HID_OP_MOD | modifier;
+        c->modifier = modifier;
+        c->count = 0;
+    }
+    c->keys[c->count++] = keycode;
+    *out++ = keycode;
+    return out;
+}
+
+/* Release everything and clear the modifier, unless that is already the state */
+static uint8_t *emit_release(hid_compiler_t *c, uint8_t *out)
+{
+    if (c->count > 0 || c->modifier != 0) {
+        *out++ = HID_OP_MOD;
+        c->count = 0;
+        c->modifier = 0;
+    }
+    return out;
+}
+
+static uint8_t *emit_ext(uint8_t *out, uint8_t ext, uint16_t operand)
+{
+    *out++ = HID_OP_EXT;
+    *out++ = ext;
+    if (hid_ext_length(ext) == 4) {
+        *out++ = operand & 0xff;
+        *out++ = operand >> 8;
+    }
+    return out;
+}
+
+static uint8_t *emit_char(hid_compiler_t *c, uint8_t *out, uint32_t codepoint)
+{
+    keymap_key_t key = keymap_lookup(c->keymap, codepoint);
+    if (key.keycode == 0) {
+        // Control bytes without a key (TAB, BS, ...) were never typed; only count text
+        if (codepoint >= 0x20) {
+            if (c->unmapped++ == 0) {
+                c->first_unmapped = codepoint;
+            }
+        }
+        return out;
+    }
+    // KEYMAP_DEAD is the bit HID_OP_MOD leaves no room for; no layout uses Right GUI
+    out = emit_key(c, out, key.modifier & ~KEYMAP_DEAD, key.keycode);
+    if (key.modifier & KEYMAP_DEAD) {
+        // A dead key only produces its own character when followed by Space
+        out = emit_key(c, out, 0, HID_KEY_SPACE);
+    }
+    return out;
+}
+
+static void compiler_error(hid_compiler_t *c, const char *error)
+{
+    if (c->error == NULL) {
+        c->error = error;
+        c->error_offset = c->token_start;
+    }
+}
+
+/* Parse a decimal number up to max; the whole string must be digits */
+static bool parse_number(const char *s, uint32_t max, uint32_t *value)
+{
+    char *end;
+    while (*s == ' ') s++;
+    if (!isdigit((unsigned char)*s)) {
+        return false;
+    }
+    unsigned long v = strtoul(s, &end, 10);
+    while (*end == ' ') end++;
+    if (*end != '\0' || v > max) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+/* Resolve one part of a chord: a modifier name, a key name, F1-F24 or a single character */
+static bool parse_chord_part(hid_compiler_t *c, const char *part, size_t len,
+                             uint8_t *modifier, uint8_t *keycode, uint8_t *key_modifier)
+{
+    char name[HID_PROGRAM_MAX_TOKEN + 1];
+    memcpy(name, part, len);
+    name[len] = '\0';
+
+    for (size_t i = 0; i < sizeof(modifier_names) / sizeof(modifier_names[0]); i++) {
+        if (strcasecmp(name, modifier_names[i].name) == 0) {
+            *modifier |= modifier_names[i].modifier;
+            *keycode = 0;
+            return true;
+        }
+    }
+    for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); i++) {
+        if (strcasecmp(name, key_names[i].name) == 0) {
+            *keycode = key_names[i].keycode;
+            *key_modifier = 0;
+            return true;
+        }
+    }
+    if (len >= 2 && (name[0] == 'F' || name[0] == 'f')) {
+        uint32_t n;
+        if (parse_number(name + 1, 24, &n) && n >= 1) {
+            *keycode = n <= 12 ? HID_KEY_F1 + n - 1 : HID_KEY_F13 + n - 13;
+            *key_modifier = 0;
+            return true;
+        }
+    }
+
+    // A single character, typed with whatever the layout needs; letters name their key
+    keymap_utf8_t utf8 = {0};
+    uint32_t codepoint = 0;
+    size_t i = 0;
+    while (i < len && !keymap_utf8_decode(&utf8, (uint8_t)name[i], &codepoint)) {
+        i++;
+    }
+    if (i + 1 != len) {
+        return false;
+    }
+    if (codepoint < 0x80 && isupper((int)codepoint)) {
+        codepoint = tolower((int)codepoint);
+    }
+    keymap_key_t key = keymap_lookup(c->keymap, codepoint);
+    if (key.keycode == 0) {
+        return false;
+    }
+    *keycode = key.keycode;
+    *key_modifier = key.modifier & ~KEYMAP_DEAD;
+    return true;
+}
+
+static uint8_t *compile_chord(hid_compiler_t *c, uint8_t *out)
+{
+    uint8_t modifier = 0;
+    uint8_t keys[HID_PROGRAM_ROLLOVER];
+    uint8_t key_modifier = 0;
+    int count = 0;
+
+    // Split at '+'; a '+' that starts a part is the key itself ({CTRL++})
+    const char *p = c->token;
+    while (*p) {
+        const char *end = strchr(p + 1, '+');
+        if (end == NULL) {
+            end = p + strlen(p);
+        }
+        uint8_t keycode = 0;
+        uint8_t part_modifier = 0;
+        if (!parse_chord_part(c, p, end - p, &modifier, &keycode, &part_modifier)) {
+            compiler_error(c, "unknown key");
+            return out;
+        }
+        if (keycode != 0) {
+            for (int i = 0; i < count; i++) {
+                if (keys[i] == keycode) {
+                    compiler_error(c, "key repeated in chord");
+                    return out;
+                }
+            }
+            if (count == HID_PROGRAM_ROLLOVER) {
+                compiler_error(c, "too many keys in chord");
+                return out;
+            }
+            keys[count++] = keycode;
+            key_modifier |= part_modifier;
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    if (count == 1 && modifier == 0) {
+        // A plain key rolls into the text around it like a character
+        return emit_key(c, out, key_modifier, keys[0]);
+    }
+    if (count == 0 && modifier == 0) {
+        compiler_error(c, "empty macro");
+        return out;
+    }
+
+    *out++ = HID_OP_MOD | modifier | key_modifier;
+    for (int i = 0; i < count; i++) {
+        *out++ = keys[i];
+    }
+    if (count == 0) {
+        out = emit_ext(out, HID_EXT_PRESS, 0);
+    }
+    *out++ = HID_OP_MOD;
+    c->count = 0;
+    c->modifier = 0;
+    return out;
+}
+
+static uint8_t *compile_token(hid_compiler_t *c, uint8_t *base, uint8_t *out)
+{
+    uint32_t n;
+    if (strncasecmp(c->token, "WAIT ", 5) == 0) {
+        if (!parse_number(c->token + 5, HID_PROGRAM_MAX_WAIT_MS, &n)) {
+            compiler_error(c, "bad WAIT");
+            return out;
+        }
+        // The executor lets go of held keys before waiting
+        c->count = 0;
+        for (; n > 0; n -= n > 0xffff ? 0xffff : n) {
+            out = emit_ext(out, HID_EXT_WAIT, n > 0xffff ? 0xffff : n);
+        }
+    } else if (strncasecmp(c->token, "REPEAT ", 7) == 0) {
+        if (!parse_number(c->token + 7, 0xffff, &n)) {
+            compiler_error(c, "bad REPEAT");
+            return out;
+        }
+        if (c->depth == HID_PROGRAM_MAX_DEPTH) {
+            compiler_error(c, "REPEAT nested too deep");
+            return out;
+        }
+        // Every pass starts with nothing held
+        out = emit_release(c, out);
+        out = emit_ext(out, HID_EXT_REPEAT, n);
+        c->loop_start[c->depth++] = c->emitted + (out - base);
+    } else if (strcasecmp(c->token, "/REPEAT") == 0) {
+        if (c->depth == 0) {
+            compiler_error(c, "{/REPEAT} without {REPEAT}");
+            return out;
+        }
+        out = emit_release(c, out);
+        if (c->emitted + (out - base) - c->loop_start[--c->depth] > HID_PROGRAM_MAX_LOOP) {
+            compiler_error(c, "REPEAT body too long");
+            return out;
+        }
+        out = emit_ext(out, HID_EXT_END, 0);
+    } else {
+        out = compile_chord(c, out);
+    }
+    return out;
+}
+
+size_t hid_compiler_feed(hid_compiler_t *c, const uint8_t *text, size_t len, uint8_t *out)
+{
+    uint8_t *p = out;
+    for (size_t i = 0; i < len && c->error == NULL; i++, c->offset++) {
+        uint8_t byte = text[i];
+        if (c->macros && c->in_token) {
+            if (byte == '{' && c->token_len == 0) {
+                // "{{" is a literal brace
+                c->in_token = false;
+                p = emit_char(c, p, '{');
+            } else if (byte == '}') {
+                c->in_token = false;
+                c->token[c->token_len] = '\0';
+                p = compile_token(c, out, p);
+            } else if (c->token_len == HID_PROGRAM_MAX_TOKEN || byte == '\n') {
+                compiler_error(c, "unterminated macro");
+            } else {
+                c->token[c->token_len++] = byte;
+            }
+            continue;
+        }
+        if (c->macros && byte == '{') {
+            c->in_token = true;
+            c->token_len = 0;
+            c->token_start = c->offset;
+            continue;
+        }
+
+        uint32_t codepoint;
+        if (keymap_utf8_decode(&c->utf8, byte, &codepoint)) {
+            p = emit_char(c, p, codepoint);
+        }
+    }
+    c->emitted += p - out;
+    return p - out;
+}
+
+size_t hid_compiler_finish(hid_compiler_t *c, uint8_t *out)
+{
+    if (c->in_token) {
+        compiler_error(c, "unterminated macro");
+    } else if (c->depth > 0) {
+        c->token_start = c->offset;
+        compiler_error(c, "{REPEAT} without {/REPEAT}");
+    }
+    size_t n = emit_release(c, out) - out;
+    c->emitted += n;
+    return n;
+}
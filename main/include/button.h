@@ -11,6 +11,9 @@
 #define GPIO_KEY2     0
 #define GPIO_KEY3     39
 
+// Holding KEY1 at least this long triggers its long-press action instead
+#define BUTTON_LONG_PRESS_MS 800
+
 // Define input bitmask
 #define GPIO_INPUT_PIN_SEL  ((1ULL<<GPIO_KEY1) | (1ULL<<GPIO_KEY2) | (1ULL<<GPIO_KEY3))
 
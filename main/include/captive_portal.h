@@ -0,0 +1,39 @@
+#ifndef CAPTIVE_PORTAL_H
+#define CAPTIVE_PORTAL_H
+
+#include <stdbool.h>
+#include "esp_http_server.h"
+
+/* Used when the SoftAP address cannot be read */
+#define CAPTIVE_PORTAL_URL "http://192.168.4.1/"
+
+/**
+ * @brief Register fast-path handlers for OS connectivity probes
+ *
+ * Known probe URIs (/generate_204, /hotspot-detect.html, /connecttest.txt,
+ * /ncsi.txt, ...) get precomputed responses instead of falling through to
+ * the 404 redirect. While the device is not provisioned the answer is a
+ * bodyless 302 to the SoftAP address, which makes the OS open its portal
+ * sheet. Once online, each probe gets the exact answer its OS expects; the
+ * SoftAP stays up for WIFI_PROV_AP_GRACE_MS after that, so clients still
+ * joined can see it before the AP is stopped.
+ *
+ * @param server HTTP server handle
+ * @return ESP_OK on success
+ */
+esp_err_t captive_portal_register(httpd_handle_t server);
+
+/**
+ * @brief Set whether the device has upstream connectivity (STA got an IP)
+ */
+void captive_portal_set_online(bool online);
+
+/**
+ * @brief Record that a station joined the SoftAP
+ *
+ * Used to log the time from association to the first probe answer, which is
+ * what the user perceives as time-to-portal-popup.
+ */
+void captive_portal_station_joined(void);
+
+#endif // CAPTIVE_PORTAL_H
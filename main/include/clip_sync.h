@@ -0,0 +1,87 @@
+#ifndef CLIP_SYNC_H
+#define CLIP_SYNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "clipboard_service.h"
+
+/*
+ * Framed clipboard sync protocol for byte-stream USB transports.
+ *
+ * Every frame is a 4-byte header followed by the payload:
+ *   magic (0xCB), type, payload length (u16 little endian)
+ *
+ * Host to device:
+ *   GET        -                                   Reply CLIPBOARD
+ *   PUT        type_len u8, content type, data     Set the clipboard, reply PUT_ACK
+ *   VERSION    -                                   Reply VERSION
+ *   SUBSCRIBE  enable u8                           Reply VERSION; while enabled the
+ *                                                  device sends CLIPBOARD on each change
+ * Device to host:
+ *   CLIPBOARD  version u32, type_len u8, content type, data
+ *   PUT_ACK    version u32
+ *   VERSION    version u32
+ *   ERROR      code u8
+ *
+ * An empty content type in PUT means CLIPBOARD_DEFAULT_CONTENT_TYPE. Bytes
+ * that do not start a frame are skipped until the next magic byte.
+ */
+
+#define CLIP_SYNC_MAGIC        0xCB
+#define CLIP_SYNC_HEADER_LEN   4
+#define CLIP_SYNC_MAX_PAYLOAD  (1 + CLIPBOARD_CONTENT_TYPE_MAX_LEN + SHARED_CLIPBOARD_MAX_LEN)
+
+enum {
+    CLIP_SYNC_GET = 0x01,
+    CLIP_SYNC_PUT = 0x02,
+    CLIP_SYNC_VERSION = 0x03,
+    CLIP_SYNC_SUBSCRIBE = 0x04,
+
+    CLIP_SYNC_CLIPBOARD = 0x81,
+    CLIP_SYNC_PUT_ACK = 0x82,
+    CLIP_SYNC_VERSION_REPLY = 0x83,
+    CLIP_SYNC_ERROR = 0xFF,
+};
+
+enum {
+    CLIP_SYNC_ERR_TOO_LARGE = 1,
+    CLIP_SYNC_ERR_UNKNOWN_TYPE = 2,
+    CLIP_SYNC_ERR_BAD_FRAME = 3,
+    CLIP_SYNC_ERR_REJECTED = 4,
+};
+
+/* Write bytes to the transport; may block until the host has taken them */
+typedef void (*clip_sync_send_t)(const uint8_t *data, size_t len, void *arg);
+
+/* One peer on one transport. Only used from the transport's task. */
+typedef struct {
+    clip_sync_send_t send;
+    void *arg;
+    uint8_t header[CLIP_SYNC_HEADER_LEN];
+    size_t header_len;
+    size_t payload_len;
+    size_t payload_pos;
+    bool subscribed;
+    uint32_t sent_version;          // Last version the peer has seen
+    uint8_t payload[CLIP_SYNC_MAX_PAYLOAD];
+} clip_sync_session_t;
+
+/**
+ * @brief Start a session (also used to reset one when the host goes away)
+ */
+void clip_sync_session_init(clip_sync_session_t *s, clip_sync_send_t send, void *arg);
+
+/**
+ * @brief Process bytes received from the host; replies are sent from here
+ */
+void clip_sync_feed(clip_sync_session_t *s, const uint8_t *data, size_t len);
+
+/**
+ * @brief Send the clipboard to a subscribed peer if it has not seen the current version
+ *
+ * Call from the transport's task after a clipboard change notification.
+ */
+void clip_sync_poll(clip_sync_session_t *s);
+
+#endif // CLIP_SYNC_H
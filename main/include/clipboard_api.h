@@ -0,0 +1,22 @@
+#ifndef CLIPBOARD_API_H
+#define CLIPBOARD_API_H
+
+#include "esp_http_server.h"
+
+#define CLIPBOARD_API_MAX_WAITERS     3
+#define CLIPBOARD_API_WAIT_TIMEOUT_S  30
+
+/**
+ * @brief Register the REST clipboard API handlers
+ *
+ * GET /api/clipboard[?wait=<version>]  Raw content with ETag/If-None-Match support.
+ *                                      With wait, the request is parked until the
+ *                                      version differs from <version> or times out (304).
+ * PUT /api/clipboard                   Replace the content with the raw request body.
+ *
+ * @param server HTTP server handle
+ * @return ESP_OK on success
+ */
+esp_err_t clipboard_api_register(httpd_handle_t server);
+
+#endif // CLIPBOARD_API_H
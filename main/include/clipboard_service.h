@@ -2,10 +2,40 @@
 #define CLIPBOARD_SERVICE_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
 
 #define SHARED_CLIPBOARD_MAX_LEN 1024
+#define CLIPBOARD_CONTENT_TYPE_MAX_LEN 63
+#define CLIPBOARD_DEFAULT_CONTENT_TYPE "text/plain; charset=utf-8"
+#define CLIPBOARD_LISTENER_MAX 8          // Web API, WS/SSE broadcast and one per USB channel
+#ifndef CLIPBOARD_HISTORY_LEN
+#define CLIPBOARD_HISTORY_LEN 4         // Previous non-empty versions kept for history views
+#endif
+
+/**
+ * @brief Immutable view of the clipboard at one version
+ *
+ * Obtained with clipboard_service_acquire() and valid until released.
+ * The content and its Base64 encoding are null-terminated.
+ */
+typedef struct {
+    uint32_t version;
+    size_t len;
+    const char *content;
+    size_t base64_len;
+    const char *base64;
+    const char *content_type;
+} clipboard_snapshot_t;
+
+/**
+ * @brief Callback invoked after a new clipboard version is published
+ *
+ * Runs in the context of the task that set the clipboard, outside the
+ * clipboard lock. Must not block.
+ */
+typedef void (*clipboard_listener_t)(uint32_t version, void *arg);
 
 /**
  * @brief Initialize the clipboard service
@@ -13,6 +43,32 @@
  */
 esp_err_t clipboard_service_init(void);
 
+/**
+ * @brief Take a reference to the current clipboard snapshot
+ *
+ * Does not allocate or copy. The clipboard lock is only held while taking the
+ * reference, so the snapshot can be read at leisure.
+ * @return Snapshot (never NULL once the service is initialized)
+ */
+const clipboard_snapshot_t *clipboard_service_acquire(void);
+
+/**
+ * @brief Take a reference to a previous clipboard snapshot
+ *
+ * History only keeps non-empty content, newest first, up to
+ * CLIPBOARD_HISTORY_LEN entries. Release like any other snapshot.
+ * @param index 1 for the most recent previous version, up to CLIPBOARD_HISTORY_LEN
+ *              (0 is the current snapshot)
+ * @return Snapshot, or NULL if there is no such entry
+ */
+const clipboard_snapshot_t *clipboard_service_acquire_history(size_t index);
+
+/**
+ * @brief Release a snapshot obtained from clipboard_service_acquire()
+ * @param snap Snapshot to release (may be NULL)
+ */
+void clipboard_service_release(const clipboard_snapshot_t *snap);
+
 /**
  * @brief Set clipboard content
  * @param content Null-terminated string content
@@ -20,6 +76,16 @@ esp_err_t clipboard_service_init(void);
  */
 esp_err_t clipboard_service_set(const char *content);
 
+/**
+ * @brief Set clipboard content from raw bytes
+ * @param data Content bytes (need not be null-terminated)
+ * @param len Number of bytes
+ * @param content_type MIME type of the content (NULL for plain text)
+ * @param version Optional output for the version assigned to the new content (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if len exceeds SHARED_CLIPBOARD_MAX_LEN
+ */
+esp_err_t clipboard_service_set_bytes(const void *data, size_t len, const char *content_type, uint32_t *version);
+
 /**
  * @brief Get clipboard content
  * @param buffer Output buffer
@@ -32,15 +98,34 @@ esp_err_t clipboard_service_get(char *buffer, size_t buffer_len);
  * @brief Get clipboard content as Base64 encoded string
  * @param buffer Output buffer
  * @param buffer_len Size of output buffer
+ * @param version Optional output for the version of the returned content (may be NULL)
  * @return ESP_OK on success
  */
-esp_err_t clipboard_service_get_base64(char *buffer, size_t buffer_len);
+esp_err_t clipboard_service_get_base64(char *buffer, size_t buffer_len, uint32_t *version);
 
 /**
  * @brief Set clipboard content from Base64 encoded string
  * @param base64_content Base64 encoded string
+ * @param version Optional output for the version assigned to the new content (may be NULL)
  * @return ESP_OK on success
  */
-esp_err_t clipboard_service_set_base64(const char *base64_content);
+esp_err_t clipboard_service_set_base64(const char *base64_content, uint32_t *version);
+
+/**
+ * @brief Get the current clipboard version
+ *
+ * Starts at a random value on every boot and is incremented on every
+ * successful set. Compare versions for equality only; 0 does not mean unset.
+ * @return Current version
+ */
+uint32_t clipboard_service_get_version(void);
+
+/**
+ * @brief Register a callback for clipboard changes
+ * @param cb Callback
+ * @param arg User argument passed to the callback
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all CLIPBOARD_LISTENER_MAX slots are used
+ */
+esp_err_t clipboard_service_add_listener(clipboard_listener_t cb, void *arg);
 
 #endif // CLIPBOARD_SERVICE_H
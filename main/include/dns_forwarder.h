@@ -0,0 +1,58 @@
+#ifndef DNS_FORWARDER_H
+#define DNS_FORWARDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lwip/sockets.h"
+
+/*
+ * Caching DNS forwarder, driven by the DNS server task.
+ *
+ * Clients reaching the device over the station interface are answered from
+ * the upstream resolver the router handed out over DHCP. All calls are made
+ * from the DNS server task; none of them block.
+ */
+
+/**
+ * @brief Allocate the cache and open the upstream socket
+ * @return Upstream socket to wait on, or -1 if forwarding is unavailable
+ */
+int dns_forwarder_init(void);
+
+/**
+ * @brief Check whether queries can be forwarded right now
+ * @return true if the station has an address and an upstream resolver is known
+ */
+bool dns_forwarder_ready(void);
+
+/**
+ * @brief Answer a client query from the cache, or forward it upstream
+ * @param sock Server socket the reply is sent on
+ * @param msg Query; reused as the response buffer
+ * @param len Query length
+ * @param client Address the query came from
+ */
+void dns_forwarder_query(int sock, uint8_t *msg, size_t len, const struct sockaddr_in *client);
+
+/**
+ * @brief Read one response from the upstream socket and answer the waiting clients
+ * @param sock Server socket the replies are sent on
+ */
+void dns_forwarder_receive(int sock);
+
+/**
+ * @brief Retransmit or fail upstream queries that are overdue
+ * @param sock Server socket failures are reported on
+ * @return Milliseconds until the next deadline, or -1 if nothing is in flight
+ */
+int dns_forwarder_poll(int sock);
+
+/**
+ * @brief Use a fixed upstream resolver instead of the one learned over DHCP
+ * @param addr IPv4 address in network byte order
+ * @param port UDP port
+ */
+void dns_forwarder_set_upstream(uint32_t addr, uint16_t port);
+
+#endif // DNS_FORWARDER_H
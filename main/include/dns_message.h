@@ -0,0 +1,95 @@
+#ifndef DNS_MESSAGE_H
+#define DNS_MESSAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * DNS wire-format constants and helpers shared by the captive-portal
+ * responder (dns_server.c) and the station-mode forwarder (dns_forwarder.c).
+ */
+
+#define DNS_MAX_UDP_LEN     512     // Also the EDNS0 payload size we advertise
+#define DNS_HEADER_LEN      12
+#define DNS_MAX_NAME_LEN    255
+#define DNS_MAX_LABEL_JUMPS 16
+
+#define DNS_FLAG_QR         0x8000
+#define DNS_FLAG_AA         0x0400
+#define DNS_FLAG_TC         0x0200
+#define DNS_FLAG_RD         0x0100
+#define DNS_FLAG_RA         0x0080
+#define DNS_OPCODE_MASK     0x7800
+#define DNS_RCODE_MASK      0x000f
+
+#define DNS_RCODE_NOERROR   0
+#define DNS_RCODE_FORMERR   1
+#define DNS_RCODE_SERVFAIL  2
+#define DNS_RCODE_NXDOMAIN  3
+#define DNS_RCODE_NOTIMP    4
+#define DNS_RCODE_BADVERS   16      // Extended RCODE, carried in the OPT record
+
+#define DNS_TYPE_A          1
+#define DNS_TYPE_SOA        6
+#define DNS_TYPE_PTR        12
+#define DNS_TYPE_OPT        41
+#define DNS_CLASS_IN        1
+
+static inline uint16_t read_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint8_t *write_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+    return p + 2;
+}
+
+static inline uint8_t *write_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+    return p + 4;
+}
+
+/*
+ * Skip over a (possibly compressed) domain name starting at offset.
+ * Returns the offset just past the name in the original position, or 0 if malformed.
+ */
+static inline size_t dns_skip_name(const uint8_t *msg, size_t len, size_t offset)
+{
+    size_t end = 0;
+    int jumps = 0;
+    while (offset < len) {
+        uint8_t label = msg[offset];
+        if (label == 0) {
+            return end ? end : offset + 1;
+        }
+        if ((label & 0xc0) == 0xc0) {
+            if (offset + 1 >= len || ++jumps > DNS_MAX_LABEL_JUMPS) {
+                return 0;
+            }
+            if (!end) {
+                end = offset + 2;
+            }
+            offset = ((label & 0x3f) << 8) | msg[offset + 1];
+            continue;
+        }
+        if (label & 0xc0) {
+            return 0;   // Reserved label types
+        }
+        offset += label + 1;
+    }
+    return 0;
+}
+
+#endif // DNS_MESSAGE_H
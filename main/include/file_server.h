@@ -0,0 +1,42 @@
+#ifndef FILE_SERVER_H
+#define FILE_SERVER_H
+
+#include "esp_http_server.h"
+
+/*
+ * File sharing over HTTP.
+ *
+ * Files live on a SPIFFS filesystem in the "files" partition, mounted at
+ * FILE_SERVER_BASE_PATH. Uploads and downloads are streamed through a fixed
+ * FILE_SERVER_CHUNK_LEN buffer, so no request ever holds a whole file in RAM.
+ */
+
+#define FILE_SERVER_PARTITION_LABEL "files"
+#define FILE_SERVER_BASE_PATH       "/files"
+#define FILE_SERVER_NAME_MAX_LEN    24
+#define FILE_SERVER_CHUNK_LEN       1024
+
+/**
+ * @brief Mount the file partition (formats it on first use)
+ * @return ESP_OK on success
+ */
+esp_err_t file_server_init(void);
+
+/**
+ * @brief Register the /files handlers
+ *
+ * GET    /files              JSON listing: {"total":N,"used":N,"files":[{"name":..,"size":..}]}
+ * GET    /files/<name>       Download, with single-range "Range: bytes=" support (206/416)
+ * PUT    /files/<name>       Upload the raw request body, replacing any existing file.
+ *                            With ?clip=1 the shared clipboard is set to "/files/<name>"
+ *                            (Content-Type text/uri-list).
+ * DELETE /files/<name>       Remove a file
+ *
+ * Requires the server to use httpd_uri_match_wildcard.
+ *
+ * @param server HTTP server handle
+ * @return ESP_OK on success
+ */
+esp_err_t file_server_register(httpd_handle_t server);
+
+#endif // FILE_SERVER_H
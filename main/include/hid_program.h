@@ -0,0 +1,110 @@
+#ifndef HID_PROGRAM_H
+#define HID_PROGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "keymap.h"
+
+/*
+ * Keystroke programs: text translated once into the key presses that type it.
+ *
+ * A program is a byte stream executed by the USB HID task:
+ *   0x01-0x7f  Press this key usage in addition to the keys held, send a report
+ *   0x80-0xff  Release everything held; keys that follow use modifier (op & 0x7f)
+ *   0x00 x     Extended op x, followed by its operands (little endian):
+ *     WAIT lo hi     Release held keys, then pause for this many ms
+ *     REPEAT lo hi   Run the ops up to the matching END this many times
+ *     END            End of a REPEAT body
+ *     PRESS          Send a report with just the current modifier (e.g. {WIN})
+ *
+ * The compiler keeps at most HID_PROGRAM_ROLLOVER keys held and never holds the
+ * same key twice, so the executor only has to follow the ops. A program always
+ * ends with everything released, and every REPEAT body starts and ends that way.
+ *
+ * With macros enabled the text may contain:
+ *   {{               A literal '{'
+ *   {ENTER} {F5} {a} One key (names below, or any character the layout can type)
+ *   {CTRL+ALT+T}     A chord: modifiers plus up to HID_PROGRAM_ROLLOVER keys
+ *   {WAIT 200}       Pause in ms, at most HID_PROGRAM_MAX_WAIT_MS
+ *   {REPEAT 5}...{/REPEAT}  Repeat, nested up to HID_PROGRAM_MAX_DEPTH
+ */
+
+#define HID_PROGRAM_FORMAT        2     // Bump when the encoding changes
+#define HID_PROGRAM_ROLLOVER      6     // Keys in a boot keyboard report
+#define HID_PROGRAM_MAX_EXPANSION 4     // Program bytes per text byte, worst case (dead key)
+#define HID_PROGRAM_MAX_TOKEN     32    // Longest {macro}
+#define HID_PROGRAM_MAX_TOKEN_OUT 48    // Program bytes one {macro} may produce
+#define HID_PROGRAM_MAX_LOOP      512   // Program bytes in one REPEAT body, buffered by the executor
+#define HID_PROGRAM_MAX_DEPTH     4
+#define HID_PROGRAM_MAX_WAIT_MS   600000
+
+// Output space hid_compiler_feed() needs for len bytes of text
+#define HID_PROGRAM_OUT_SIZE(len) ((len) * HID_PROGRAM_MAX_EXPANSION + HID_PROGRAM_MAX_TOKEN_OUT)
+
+#define HID_OP_EXT                0x00
+#define HID_OP_MOD                0x80
+
+enum {
+    HID_EXT_WAIT = 1,
+    HID_EXT_REPEAT,
+    HID_EXT_END,
+    HID_EXT_PRESS,
+};
+
+static inline bool hid_op_is_mod(uint8_t op)
+{
+    return (op & HID_OP_MOD) != 0;
+}
+
+// Length of an extended op, including the 0x00 prefix
+static inline size_t hid_ext_length(uint8_t ext)
+{
+    return (ext == HID_EXT_WAIT || ext == HID_EXT_REPEAT) ? 4 : 2;
+}
+
+typedef struct {
+    const keymap_key_t *keymap;
+    keymap_utf8_t utf8;
+    bool macros;
+    uint8_t modifier;                   // Modifier the executor will be holding
+    uint8_t count;
+    uint8_t keys[HID_PROGRAM_ROLLOVER];
+    size_t unmapped;                    // Characters the layout cannot type
+    uint32_t first_unmapped;            // Code point of the first of them
+
+    // Macro parsing
+    size_t offset;                      // Text bytes consumed
+    size_t emitted;                     // Program bytes produced
+    bool in_token;
+    uint8_t token_len;
+    size_t token_start;
+    char token[HID_PROGRAM_MAX_TOKEN + 1];
+    uint8_t depth;
+    size_t loop_start[HID_PROGRAM_MAX_DEPTH];
+    const char *error;                  // First syntax error, NULL if none
+    size_t error_offset;                // Text offset of that error
+} hid_compiler_t;
+
+/**
+ * @brief Start compiling text for a keyboard layout
+ * @param macros Interpret {macros}; otherwise braces are plain text
+ */
+void hid_compiler_init(hid_compiler_t *c, const keymap_key_t *keymap, bool macros);
+
+/**
+ * @brief Compile a piece of UTF-8 text; characters and macros may span pieces
+ *
+ * After a syntax error (c->error set) the rest of the text is ignored.
+ * @param out At least HID_PROGRAM_OUT_SIZE(len) bytes
+ * @return Number of program bytes written to out
+ */
+size_t hid_compiler_feed(hid_compiler_t *c, const uint8_t *text, size_t len, uint8_t *out);
+
+/**
+ * @brief End the program: check that macros are closed and release whatever is still held
+ * @param out At least 1 byte
+ * @return Number of program bytes written to out
+ */
+size_t hid_compiler_finish(hid_compiler_t *c, uint8_t *out);
+
+#endif // HID_PROGRAM_H
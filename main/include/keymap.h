@@ -0,0 +1,82 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Keyboard layouts for typing text over USB HID.
+ *
+ * A layout is a 256-entry table indexed by Latin-1 code point (ASCII plus
+ * U+0080..U+00FF), built at compile time. Each entry is the modifier and key
+ * usage that produce the character on a host set to that layout; keycode 0
+ * means the character cannot be typed.
+ */
+
+#define KEYMAP_TABLE_SIZE 256
+
+/*
+ * Set in keymap_key_t.modifier for dead keys: the character appears only after
+ * the key is followed by Space. Bit 7 is Right GUI, which no layout needs to
+ * type a character.
+ */
+#define KEYMAP_DEAD 0x80
+
+typedef struct {
+    uint8_t modifier;   // KEYBOARD_MODIFIER_* bits, plus KEYMAP_DEAD
+    uint8_t keycode;    // HID_KEY_*, 0 if unmapped
+} keymap_key_t;
+
+typedef enum {
+    KEYMAP_LAYOUT_US,   // US QWERTY
+    KEYMAP_LAYOUT_UK,   // UK QWERTY
+    KEYMAP_LAYOUT_DE,   // German QWERTZ
+    KEYMAP_LAYOUT_FR,   // French AZERTY
+    KEYMAP_LAYOUT_MAX
+} keymap_layout_t;
+
+/* Incremental UTF-8 decoder state; zero-initialize before use */
+typedef struct {
+    uint32_t codepoint;
+    uint8_t pending;    // Continuation bytes still expected
+} keymap_utf8_t;
+
+/**
+ * @brief Get the lookup table of a layout
+ * @return KEYMAP_TABLE_SIZE entries, or NULL for an unknown layout
+ */
+const keymap_key_t *keymap_get_table(keymap_layout_t layout);
+
+/**
+ * @brief Get the short name of a layout ("us", "de", ...)
+ */
+const char *keymap_layout_name(keymap_layout_t layout);
+
+/**
+ * @brief Look up a layout by its short name
+ * @return true if the name is known
+ */
+bool keymap_layout_from_name(const char *name, keymap_layout_t *layout);
+
+/**
+ * @brief Feed one byte of UTF-8 text
+ * @param d Decoder state
+ * @param byte Next byte
+ * @param codepoint Set to the decoded character when the function returns true
+ * @return true when a complete character has been decoded
+ */
+bool keymap_utf8_decode(keymap_utf8_t *d, uint8_t byte, uint32_t *codepoint);
+
+/**
+ * @brief Translate a character with a layout table
+ * @return The key to press; keycode 0 if the character cannot be typed
+ */
+static inline keymap_key_t keymap_lookup(const keymap_key_t *table, uint32_t codepoint)
+{
+    if (codepoint >= KEYMAP_TABLE_SIZE) {
+        return (keymap_key_t){ 0, 0 };
+    }
+    return table[codepoint];
+}
+
+#endif // KEYMAP_H
@@ -0,0 +1,57 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_cpu.h"
+#include "esp_http_server.h"
+
+/*
+ * Runtime performance counters, exported in Prometheus text format on /metrics.
+ *
+ * Every counter has one slot per core. A hot path only adds to the slot of the
+ * core it runs on, with a relaxed atomic add: no lock, no contention between
+ * cores, and safe from ISRs. The slots are summed when /metrics is scraped.
+ */
+
+typedef enum {
+    METRIC_WS_FRAMES_SENT,
+    METRIC_WS_BYTES_SENT,
+    METRIC_SSE_EVENTS_SENT,
+    METRIC_SSE_BYTES_SENT,
+    METRIC_CLIPBOARD_UPDATES,
+    METRIC_DNS_QUERIES,
+    METRIC_DNS_CACHE_HITS,
+    METRIC_DNS_UPSTREAM_QUERIES,
+    METRIC_HID_KEYS_PRESSED,
+    METRIC_HID_REPORTS_SENT,
+    METRIC_LCD_TRANSACTIONS,
+    METRIC_COUNTER_MAX
+} metric_counter_t;
+
+extern uint32_t metrics_counters[portNUM_PROCESSORS][METRIC_COUNTER_MAX];
+
+static inline void metrics_add(metric_counter_t id, uint32_t n)
+{
+    __atomic_fetch_add(&metrics_counters[esp_cpu_get_core_id()][id], n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_inc(metric_counter_t id)
+{
+    metrics_add(id, 1);
+}
+
+/**
+ * @brief Record the duration of one clipboard broadcast
+ * @param us Duration in microseconds
+ */
+void metrics_observe_broadcast(uint32_t us);
+
+/**
+ * @brief Register the GET /metrics handler
+ * @param server HTTP server handle
+ * @return ESP_OK on success
+ */
+esp_err_t metrics_register(httpd_handle_t server);
+
+#endif // METRICS_H
@@ -0,0 +1,112 @@
+#ifndef PAYLOAD_STORE_H
+#define PAYLOAD_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Flash-backed store for the USB keyboard payload.
+ *
+ * The payload lives in the "usb_payload" data partition. The first sector holds
+ * a header that is written last, so an interrupted save leaves no valid payload
+ * rather than a truncated one. Writes are streamed; nothing is buffered in RAM.
+ *
+ * Next to the text the store can keep a program derived from it (the compiled
+ * key presses), starting on the sector after the text and using whatever space
+ * the text leaves. It is saved and invalidated together with the text, and is
+ * simply left out when it does not fit.
+ */
+
+#define PAYLOAD_STORE_PARTITION_LABEL "usb_payload"
+
+/**
+ * @brief Locate the partition and validate the stored payload
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the partition is missing
+ */
+esp_err_t payload_store_init(void);
+
+/**
+ * @brief Maximum payload size supported by the partition
+ */
+size_t payload_store_capacity(void);
+
+/**
+ * @brief Start replacing the payload
+ *
+ * Invalidates the current payload and erases the space for the new one.
+ * Must be followed by payload_store_write() and payload_store_write_program()
+ * calls, in any order, and payload_store_finish() or payload_store_abort().
+ * @param len Total payload length in bytes
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if len exceeds the capacity
+ */
+esp_err_t payload_store_begin(size_t len);
+
+/**
+ * @brief Append data to the payload being written
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if more than the announced length is written
+ */
+esp_err_t payload_store_write(const void *data, size_t len);
+
+/**
+ * @brief Append data to the program stored with the payload being written
+ *
+ * The program area is erased as it grows. Once a write fails the program is
+ * dropped and the payload is saved without one.
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the program no longer fits
+ */
+esp_err_t payload_store_write_program(const void *data, size_t len);
+
+/**
+ * @brief Commit the payload and its program (writes the header)
+ * @param program_tag Caller-defined value saved with the program, e.g. what it was built for
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if fewer bytes than announced were written
+ */
+esp_err_t payload_store_finish(uint32_t program_tag);
+
+/**
+ * @brief Abandon the payload being written (the store is left empty)
+ */
+void payload_store_abort(void);
+
+/**
+ * @brief Length of the committed payload (0 if none)
+ */
+size_t payload_store_get_length(void);
+
+/**
+ * @brief Generation counter, incremented on every begin
+ *
+ * Readers that stream the payload in several calls record it up front and
+ * stop when it changes.
+ */
+uint32_t payload_store_get_generation(void);
+
+/**
+ * @brief Read part of the committed payload
+ * @param offset Byte offset into the payload
+ * @param buf Output buffer
+ * @param len Number of bytes to read
+ * @param generation Generation the caller started with
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the payload changed
+ */
+esp_err_t payload_store_read(size_t offset, void *buf, size_t len, uint32_t generation);
+
+/**
+ * @brief Length of the committed program (0 if none)
+ */
+size_t payload_store_get_program_length(void);
+
+/**
+ * @brief Tag the payload was committed with
+ *
+ * Kept even when the program was left out, so it can also describe the text.
+ */
+uint32_t payload_store_get_program_tag(void);
+
+/**
+ * @brief Read part of the committed program, like payload_store_read()
+ */
+esp_err_t payload_store_read_program(size_t offset, void *buf, size_t len, uint32_t generation);
+
+#endif // PAYLOAD_STORE_H
@@ -13,6 +13,7 @@ void ui_set_page(int page);
 
 // User Actions
 void ui_enter_action(void); // For KEY1 (Enter/Action)
+void ui_enter_long_action(void); // For KEY1 held down
 
 // State Updates
 void ui_update_wifi_ap(const char *ssid, const char *ip);
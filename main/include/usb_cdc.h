@@ -0,0 +1,27 @@
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+#include "esp_err.h"
+
+/*
+ * CDC-ACM interface of the composite USB device, carrying the clip_sync
+ * protocol (clip_sync.h) at bulk speed. Only built with
+ * CONFIG_TINYUSB_CDC_ENABLED; otherwise these functions do nothing.
+ */
+
+/**
+ * @brief Create the CDC service task
+ */
+void usb_cdc_init(void);
+
+/**
+ * @brief Start serving the CDC interface (after the TinyUSB driver is installed)
+ */
+esp_err_t usb_cdc_start(void);
+
+/**
+ * @brief Stop serving the CDC interface (before the TinyUSB driver is uninstalled)
+ */
+void usb_cdc_stop(void);
+
+#endif // USB_CDC_H
@@ -3,8 +3,21 @@
 
 #include "esp_err.h"
 #include <stdbool.h>
+#include <stddef.h>
 
-#define USB_STRING_MAX_LEN 1024
+// Number of leading characters of the stored string kept in RAM for display
+#define USB_STRING_PREVIEW_LEN 160
+
+/*
+ * Keyboard endpoint polling interval (bInterval) in ms, 1-255 at full speed.
+ * Typing waits for each report to be polled, so this bounds the speed: with
+ * 1 ms, tools/hid_bench measures about 700-720 characters per second for mixed
+ * text (0.72 keys per report); about 850 is the best case for text without
+ * repeated keys. Raise it for hosts or KVM switches that cannot keep up.
+ */
+#ifndef USB_HID_POLL_INTERVAL_MS
+#define USB_HID_POLL_INTERVAL_MS 1
+#endif
 
 /**
  * @brief Initialize the USB HID service (create task)
@@ -12,30 +25,108 @@
 void usb_hid_init(void);
 
 /**
- * @brief Enable or disable USB HID (install/uninstall driver)
+ * @brief Arm or disarm the USB keyboard
+ *
+ * In on-demand mode this installs or uninstalls the TinyUSB driver, so the
+ * host enumerates the device each time. In persistent mode the device stays
+ * enumerated and only typing is allowed or stopped.
  */
 void usb_hid_set_enabled(bool enabled);
 
-// Check if USB HID is currently active
+// Check if the USB keyboard is armed
 bool usb_hid_is_active(void);
 
-// Set the string to be typed
-void usb_hid_set_string(const char *string);
+/**
+ * @brief Select persistent (always enumerated) or on-demand USB mode and save it in NVS
+ *
+ * Persistent mode keeps the PHY on USB OTG, so the USB-Serial-JTAG console is
+ * not available while it is on.
+ * @return ESP_OK on success
+ */
+esp_err_t usb_hid_set_persistent(bool persistent);
 
-// Get the stored string
+// Check if persistent USB mode is selected
+bool usb_hid_is_persistent(void);
+
+// Time from the last typing request to its first key report, in microseconds (0 if none yet)
+uint32_t usb_hid_get_first_key_latency_us(void);
+
+// Get the beginning of the stored string (at most USB_STRING_PREVIEW_LEN chars)
 const char *usb_hid_get_string(void);
 
+// Get the full length of the stored string
+size_t usb_hid_get_string_length(void);
+
+/**
+ * @brief Start streaming a new USB string into flash
+ *
+ * The string is written in pieces with usb_hid_save_append() and committed with
+ * usb_hid_save_finish(), or dropped with usb_hid_save_abort().
+ * @param len Total length in bytes
+ * @param macros Interpret {macros} (see hid_program.h) instead of typing braces literally
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the string does not fit
+ */
+esp_err_t usb_hid_save_begin(size_t len, bool macros);
+
+/**
+ * @brief Append a piece of the string being saved
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on a macro syntax error
+ */
+esp_err_t usb_hid_save_append(const char *data, size_t len);
+
+/**
+ * @brief Commit the string being saved
+ *
+ * The string is compiled into key presses for the current keyboard layout
+ * while it is saved; characters the layout cannot type are counted and skipped.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on a macro syntax error (the
+ *         save is then abandoned)
+ */
+esp_err_t usb_hid_save_finish(void);
+
+// Description of the macro syntax error that failed the last save
+const char *usb_hid_get_save_error(void);
+
+// Number of characters in the last saved string that the keyboard layout cannot type
+size_t usb_hid_get_unmapped_count(void);
+
+/**
+ * @brief Abandon the string being saved
+ */
+void usb_hid_save_abort(void);
+
 /**
- * @brief Save USB string to NVS and update internal state
+ * @brief Save a complete USB string to flash
  */
 esp_err_t usb_hid_save_string(const char *string);
 
 /**
- * @brief Load USB string from NVS to internal state
+ * @brief Open the flash store and load the USB string preview
+ *
+ * A string saved in NVS by older firmware is migrated to the flash store.
  */
 esp_err_t usb_hid_load_string(void);
 
+/**
+ * @brief Select the keyboard layout used for typing and save it in NVS
+ * @param name Layout name: "us", "uk", "de" or "fr"
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND for an unknown name
+ */
+esp_err_t usb_hid_set_layout(const char *name);
+
+// Get the name of the keyboard layout used for typing
+const char *usb_hid_get_layout(void);
+
 // Send the stored string via USB Keyboard
 void usb_hid_send_string(void);
 
+/**
+ * @brief Type the current shared clipboard via USB Keyboard
+ *
+ * The clipboard version current when typing starts is typed in full, even if
+ * the clipboard changes meanwhile. Only text content types are typed.
+ * @return ESP_OK if queued, ESP_ERR_INVALID_STATE if USB is not enabled
+ */
+esp_err_t usb_hid_type_clipboard(void);
+
 #endif // USB_HID_H
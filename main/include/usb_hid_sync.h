@@ -0,0 +1,50 @@
+#ifndef USB_HID_SYNC_H
+#define USB_HID_SYNC_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/*
+ * Vendor-defined HID interface carrying the clip_sync protocol (clip_sync.h)
+ * in 64-byte input and output reports, so no host driver is needed. The
+ * protocol byte stream is cut into reports of:
+ *   valid length u8 (1..63), data[63] (zero padded)
+ * The interface is HID instance 1, after the keyboard; it exists when
+ * CONFIG_TINYUSB_HID_COUNT is 2. Otherwise these functions do nothing.
+ */
+
+#define USB_HID_SYNC_INSTANCE     1
+#define USB_HID_SYNC_ENABLED      (CONFIG_TINYUSB_HID_COUNT > USB_HID_SYNC_INSTANCE)
+#define USB_HID_SYNC_REPORT_SIZE  64
+#define USB_HID_SYNC_USAGE_PAGE   0xFF00
+#define USB_HID_SYNC_USAGE        0x01
+
+/**
+ * @brief Create the HID sync service task
+ */
+void usb_hid_sync_init(void);
+
+/**
+ * @brief Start serving the interface (after the TinyUSB driver is installed)
+ */
+esp_err_t usb_hid_sync_start(void);
+
+/**
+ * @brief Stop serving the interface (before the TinyUSB driver is uninstalled)
+ *
+ * Returns once the sync task no longer touches the interface.
+ */
+void usb_hid_sync_stop(void);
+
+/**
+ * @brief Hand over an output report from the host (TinyUSB task context)
+ */
+void usb_hid_sync_receive(const uint8_t *report, uint16_t len);
+
+/**
+ * @brief Called when an input report of the interface has been sent
+ */
+void usb_hid_sync_report_done(void);
+
+#endif // USB_HID_SYNC_H
@@ -0,0 +1,40 @@
+#ifndef USB_MSC_H
+#define USB_MSC_H
+
+#include "esp_err.h"
+
+/*
+ * Mass-storage interface of the composite USB device: a small synthetic
+ * FAT12 volume holding clipboard.txt and the clipboard history
+ * (history-1.txt is the most recent previous version). Sectors are rendered
+ * from clipboard snapshots when the host reads them; saving clipboard.txt
+ * sets the shared clipboard. Only built with CONFIG_TINYUSB_MSC_ENABLED;
+ * otherwise these functions do nothing.
+ */
+
+#ifndef USB_MSC_SECTORS
+#define USB_MSC_SECTORS 128             // Volume size in 512-byte sectors
+#endif
+#ifndef USB_MSC_OVERLAY_SECTORS
+#define USB_MSC_OVERLAY_SECTORS 16      // Sectors written by the host kept until the clipboard changes
+#endif
+#ifndef USB_MSC_WRITE_SETTLE_MS
+#define USB_MSC_WRITE_SETTLE_MS 300     // Host write quiet time before clipboard.txt is read back
+#endif
+
+/**
+ * @brief Create the mass-storage service task
+ */
+void usb_msc_init(void);
+
+/**
+ * @brief Start serving the volume (after the TinyUSB driver is installed)
+ */
+esp_err_t usb_msc_start(void);
+
+/**
+ * @brief Stop serving the volume (before the TinyUSB driver is uninstalled)
+ */
+void usb_msc_stop(void);
+
+#endif // USB_MSC_H
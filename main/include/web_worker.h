@@ -0,0 +1,40 @@
+#ifndef WEB_WORKER_H
+#define WEB_WORKER_H
+
+#include <stdbool.h>
+#include "esp_http_server.h"
+
+#define WEB_WORKER_COUNT        2
+#define WEB_WORKER_QUEUE_DEPTH  4
+#define WEB_WORKER_STACK_SIZE   6144
+
+typedef esp_err_t (*web_worker_handler_t)(httpd_req_t *req);
+
+/**
+ * @brief Start the worker tasks that run slow HTTP handlers
+ * @return ESP_OK on success
+ */
+esp_err_t web_worker_start(void);
+
+/**
+ * @brief Check whether the caller is running on a worker task
+ */
+bool web_worker_is_worker(void);
+
+/**
+ * @brief Hand a request over to the worker pool
+ *
+ * The request is detached from the server with httpd_req_async_handler_begin
+ * and the server task returns immediately. When WEB_WORKER_QUEUE_DEPTH requests
+ * are already waiting, the client gets 503 instead.
+ *
+ * A slow handler typically starts with:
+ *     if (!web_worker_is_worker()) return web_worker_dispatch(req, my_handler);
+ *
+ * @param req Request as received by the URI handler
+ * @param handler Handler to run on the worker
+ * @return ESP_OK if queued or rejected with 503, error otherwise
+ */
+esp_err_t web_worker_dispatch(httpd_req_t *req, web_worker_handler_t handler);
+
+#endif // WEB_WORKER_H
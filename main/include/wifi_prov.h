@@ -8,6 +8,15 @@
 #define EXAMPLE_ESP_WIFI_PASS      ""
 #define EXAMPLE_MAX_STA_CONN       4
 
+/*
+ * After the station gets an IP the SoftAP stays up this long if clients are
+ * still joined, so their connectivity probes get the "online" answer (see
+ * captive_portal.h) before the AP goes away.
+ */
+#ifndef WIFI_PROV_AP_GRACE_MS
+#define WIFI_PROV_AP_GRACE_MS      30000
+#endif
+
 void wifi_prov_init(void);
 
 #endif // WIFI_PROV_H
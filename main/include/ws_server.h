@@ -1,9 +1,13 @@
 #ifndef WS_SERVER_H
 #define WS_SERVER_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_http_server.h"
 
+/* Shared budget for live sessions (WebSocket and Server-Sent Events) */
 #define WEBSOCKET_CLIENT_MAX 5
+#define SSE_HEARTBEAT_INTERVAL_S 15
 
 /**
  * @brief Initialize the WebSocket server manager
@@ -30,4 +34,68 @@ void ws_server_remove_client(int fd);
  */
 void ws_server_broadcast(const char *message);
 
+/**
+ * @brief Broadcast a message to all connected clients except one
+ * @param message Null-terminated string message
+ * @param exclude_fd Socket file descriptor to skip (-1 to send to everyone)
+ */
+void ws_server_broadcast_except(const char *message, int exclude_fd);
+
+/**
+ * @brief Push every clipboard change to the live clients
+ *
+ * Registers a clipboard_service listener, so updates from any source (web
+ * page, REST, file uploads, the USB channels) reach WebSocket and SSE
+ * clients. The listener only queues the broadcast as work on the server task.
+ * @param server HTTP server handle whose task sends the updates
+ * @return ESP_OK on success
+ */
+esp_err_t ws_server_start_broadcasts(httpd_handle_t server);
+
+/**
+ * @brief Leave the originator out of the broadcast of its own update
+ *
+ * Call on the server task right after a client's update has been stored;
+ * the queued broadcast runs after the handler returns and skips that client
+ * if the clipboard is still at this version.
+ * @param version Version created by the update
+ * @param fd Socket file descriptor of the originator
+ */
+void ws_server_set_update_origin(uint32_t version, int fd);
+
+/**
+ * @brief Send the current clipboard state to one client
+ *
+ * If the client already holds the current version, only a small
+ * {"type":"current","version":N} message is sent instead of the content.
+ * @param req WebSocket request of the client
+ * @param has_known_version Whether the client reported the version it holds
+ * @param known_version Version the client holds
+ * @return ESP_OK on success
+ */
+esp_err_t ws_server_send_clipboard(httpd_req_t *req, bool has_known_version, uint32_t known_version);
+
+/**
+ * @brief Turn a GET request into a Server-Sent Events stream of clipboard updates
+ *
+ * Sends the event-stream headers, parks the request with
+ * httpd_req_async_handler_begin and registers it in the shared client table.
+ * The current clipboard is sent first unless the client already has it
+ * (Last-Event-ID equal to the current version). Idle streams get a heartbeat
+ * comment every SSE_HEARTBEAT_INTERVAL_S seconds.
+ *
+ * @param req HTTP request
+ * @param has_last_event_id Whether the client sent a Last-Event-ID header
+ * @param last_event_id Clipboard version from Last-Event-ID
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all client slots are in use
+ */
+esp_err_t ws_server_add_sse_client(httpd_req_t *req, bool has_last_event_id, uint32_t last_event_id);
+
+/**
+ * @brief Count connected live-update clients
+ * @param websocket Output: number of WebSocket clients
+ * @param sse Output: number of Server-Sent Events clients
+ */
+void ws_server_get_client_counts(int *websocket, int *sse);
+
 #endif // WS_SERVER_H
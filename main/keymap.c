@@ -0,0 +1,181 @@
+/*
+ * Keyboard layout tables
+ * One compile-time table per layout, indexed by Latin-1 code point, so turning
+ * a character into a key press is a single array load instead of a switch.
+ */
+#include <string.h>
+#include "keymap.h"
+#include "class/hid/hid.h"
+
+#define SHIFT  KEYBOARD_MODIFIER_LEFTSHIFT
+#define ALTGR  KEYBOARD_MODIFIER_RIGHTALT
+
+#define K(key)  { 0, HID_KEY_##key }
+#define S(key)  { SHIFT, HID_KEY_##key }
+#define G(key)  { ALTGR, HID_KEY_##key }
+#define DK(key) { KEYMAP_DEAD, HID_KEY_##key }
+#define DS(key) { KEYMAP_DEAD | SHIFT, HID_KEY_##key }
+#define DG(key) { KEYMAP_DEAD | ALTGR, HID_KEY_##key }
+
+#define LETTER(c, key) [c] = K(key), [(c) - 'a' + 'A'] = S(key)
+
+/* Layout independent: Enter, Space, and ASCII control codes mapped to function keys */
+#define CONTROL_KEYS \
+    ['\n'] = K(ENTER), ['\r'] = K(ENTER), [' '] = K(SPACE), \
+    [0x01] = K(F1), [0x02] = K(F2), [0x03] = K(F3), [0x04] = K(F4), \
+    [0x05] = K(F5), [0x06] = K(F6), [0x07] = K(F7), \
+    [0x18] = K(F8),     /* 0x08 is BS */ \
+    [0x19] = K(F9),     /* 0x09 is TAB */ \
+    [0x1A] = K(F10),    /* 0x0A is LF (Enter) */ \
+    [0x0B] = K(F11), [0x0C] = K(F12)
+
+/* Letters that sit on the same key in every supported layout */
+#define COMMON_LETTERS \
+    LETTER('b', B), LETTER('c', C), LETTER('d', D), LETTER('e', E), LETTER('f', F), \
+    LETTER('g', G), LETTER('h', H), LETTER('i', I), LETTER('j', J), LETTER('k', K), \
+    LETTER('l', L), LETTER('n', N), LETTER('o', O), LETTER('p', P), LETTER('r', R), \
+    LETTER('s', S), LETTER('t', T), LETTER('u', U), LETTER('v', V), LETTER('x', X)
+
+#define DIGITS(m) \
+    ['1'] = m(1), ['2'] = m(2), ['3'] = m(3), ['4'] = m(4), ['5'] = m(5), \
+    ['6'] = m(6), ['7'] = m(7), ['8'] = m(8), ['9'] = m(9), ['0'] = m(0)
+
+static const keymap_key_t keymap_us[KEYMAP_TABLE_SIZE] = {
+    CONTROL_KEYS,
+    COMMON_LETTERS,
+    LETTER('a', A), LETTER('m', M), LETTER('q', Q), LETTER('w', W), LETTER('y', Y), LETTER('z', Z),
+    DIGITS(K),
+    ['!'] = S(1), ['@'] = S(2), ['#'] = S(3), ['$'] = S(4), ['%'] = S(5),
+    ['^'] = S(6), ['&'] = S(7), ['*'] = S(8), ['('] = S(9), [')'] = S(0),
+    ['-'] = K(MINUS), ['_'] = S(MINUS), ['='] = K(EQUAL), ['+'] = S(EQUAL),
+    ['['] = K(BRACKET_LEFT), ['{'] = S(BRACKET_LEFT), [']'] = K(BRACKET_RIGHT), ['}'] = S(BRACKET_RIGHT),
+    ['\\'] = K(BACKSLASH), ['|'] = S(BACKSLASH),
+    [';'] = K(SEMICOLON), [':'] = S(SEMICOLON), ['\''] = K(APOSTROPHE), ['"'] = S(APOSTROPHE),
+    [','] = K(COMMA), ['<'] = S(COMMA), ['.'] = K(PERIOD), ['>'] = S(PERIOD),
+    ['/'] = K(SLASH), ['?'] = S(SLASH), ['`'] = K(GRAVE), ['~'] = S(GRAVE),
+};
+
+static const keymap_key_t keymap_uk[KEYMAP_TABLE_SIZE] = {
+    CONTROL_KEYS,
+    COMMON_LETTERS,
+    LETTER('a', A), LETTER('m', M), LETTER('q', Q), LETTER('w', W), LETTER('y', Y), LETTER('z', Z),
+    DIGITS(K),
+    ['!'] = S(1), ['"'] = S(2), [0xA3] = S(3) /* £ */, ['$'] = S(4), ['%'] = S(5),
+    ['^'] = S(6), ['&'] = S(7), ['*'] = S(8), ['('] = S(9), [')'] = S(0),
+    ['-'] = K(MINUS), ['_'] = S(MINUS), ['='] = K(EQUAL), ['+'] = S(EQUAL),
+    ['['] = K(BRACKET_LEFT), ['{'] = S(BRACKET_LEFT), [']'] = K(BRACKET_RIGHT), ['}'] = S(BRACKET_RIGHT),
+    [';'] = K(SEMICOLON), [':'] = S(SEMICOLON), ['\''] = K(APOSTROPHE), ['@'] = S(APOSTROPHE),
+    ['#'] = K(EUROPE_1), ['~'] = S(EUROPE_1), ['\\'] = K(EUROPE_2), ['|'] = S(EUROPE_2),
+    [','] = K(COMMA), ['<'] = S(COMMA), ['.'] = K(PERIOD), ['>'] = S(PERIOD),
+    ['/'] = K(SLASH), ['?'] = S(SLASH),
+    ['`'] = K(GRAVE), [0xAC] = S(GRAVE) /* ¬ */, [0xA6] = G(GRAVE) /* ¦ */,
+};
+
+static const keymap_key_t keymap_de[KEYMAP_TABLE_SIZE] = {
+    CONTROL_KEYS,
+    COMMON_LETTERS,
+    LETTER('a', A), LETTER('m', M), LETTER('q', Q), LETTER('w', W), LETTER('y', Z), LETTER('z', Y),
+    DIGITS(K),
+    ['!'] = S(1), ['"'] = S(2), [0xA7] = S(3) /* § */, ['$'] = S(4), ['%'] = S(5),
+    ['&'] = S(6), ['/'] = S(7), ['('] = S(8), [')'] = S(9), ['='] = S(0),
+    [0xB2] = G(2) /* ² */, [0xB3] = G(3) /* ³ */,
+    ['{'] = G(7), ['['] = G(8), [']'] = G(9), ['}'] = G(0),
+    [0xDF] = K(MINUS) /* ß */, ['?'] = S(MINUS), ['\\'] = G(MINUS),
+    [0xB4] = DK(EQUAL) /* ´ */, ['`'] = DS(EQUAL),
+    [0xFC] = K(BRACKET_LEFT) /* ü */, [0xDC] = S(BRACKET_LEFT) /* Ü */,
+    ['+'] = K(BRACKET_RIGHT), ['*'] = S(BRACKET_RIGHT), ['~'] = G(BRACKET_RIGHT),
+    [0xF6] = K(SEMICOLON) /* ö */, [0xD6] = S(SEMICOLON) /* Ö */,
+    [0xE4] = K(APOSTROPHE) /* ä */, [0xC4] = S(APOSTROPHE) /* Ä */,
+    ['#'] = K(EUROPE_1), ['\''] = S(EUROPE_1),
+    ['^'] = DK(GRAVE), [0xB0] = S(GRAVE) /* ° */,
+    [','] = K(COMMA), [';'] = S(COMMA), ['.'] = K(PERIOD), [':'] = S(PERIOD),
+    ['-'] = K(SLASH), ['_'] = S(SLASH),
+    ['<'] = K(EUROPE_2), ['>'] = S(EUROPE_2), ['|'] = G(EUROPE_2),
+    ['@'] = G(Q), [0xB5] = G(M) /* µ */,
+};
+
+static const keymap_key_t keymap_fr[KEYMAP_TABLE_SIZE] = {
+    CONTROL_KEYS,
+    COMMON_LETTERS,
+    LETTER('a', Q), LETTER('q', A), LETTER('w', Z), LETTER('z', W), LETTER('y', Y), LETTER('m', SEMICOLON),
+    DIGITS(S),
+    ['&'] = K(1), [0xE9] = K(2) /* é */, ['"'] = K(3), ['\''] = K(4), ['('] = K(5),
+    ['-'] = K(6), [0xE8] = K(7) /* è */, ['_'] = K(8), [0xE7] = K(9) /* ç */, [0xE0] = K(0) /* à */,
+    [')'] = K(MINUS), [0xB0] = S(MINUS) /* ° */, ['='] = K(EQUAL), ['+'] = S(EQUAL),
+    ['~'] = DG(2), ['#'] = G(3), ['{'] = G(4), ['['] = G(5), ['|'] = G(6),
+    ['`'] = DG(7), ['\\'] = G(8), ['^'] = G(9), ['@'] = G(0), [']'] = G(MINUS), ['}'] = G(EQUAL),
+    [0xA8] = DS(BRACKET_LEFT) /* ¨ */,
+    ['$'] = K(BRACKET_RIGHT), [0xA3] = S(BRACKET_RIGHT) /* £ */, [0xA4] = G(BRACKET_RIGHT) /* ¤ */,
+    [0xF9] = K(APOSTROPHE) /* ù */, ['%'] = S(APOSTROPHE),
+    ['*'] = K(EUROPE_1), [0xB5] = S(EUROPE_1) /* µ */,
+    [0xB2] = K(GRAVE) /* ² */,
+    [','] = K(M), ['?'] = S(M), [';'] = K(COMMA), ['.'] = S(COMMA),
+    [':'] = K(PERIOD), ['/'] = S(PERIOD), ['!'] = K(SLASH), [0xA7] = S(SLASH) /* § */,
+    ['<'] = K(EUROPE_2), ['>'] = S(EUROPE_2),
+};
+
+static const struct {
+    const char *name;
+    const keymap_key_t *table;
+} keymap_layouts[KEYMAP_LAYOUT_MAX] = {
+    [KEYMAP_LAYOUT_US] = { "us", keymap_us },
+    [KEYMAP_LAYOUT_UK] = { "uk", keymap_uk },
+    [KEYMAP_LAYOUT_DE] = { "de", keymap_de },
+    [KEYMAP_LAYOUT_FR] = { "fr", keymap_fr },
+};
+
+const keymap_key_t *keymap_get_table(keymap_layout_t layout)
+{
+    if ((unsigned)layout >= KEYMAP_LAYOUT_MAX) {
+        return NULL;
+    }
+    return keymap_layouts[layout].table;
+}
+
+const char *keymap_layout_name(keymap_layout_t layout)
+{
+    if ((unsigned)layout >= KEYMAP_LAYOUT_MAX) {
+        return NULL;
+    }
+    return keymap_layouts[layout].name;
+}
+
+bool keymap_layout_from_name(const char *name, keymap_layout_t *layout)
+{
+    for (int i = 0; i < KEYMAP_LAYOUT_MAX; i++) {
+        if (strcmp(name, keymap_layouts[i].name) == 0) {
+            *layout = (keymap_layout_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool keymap_utf8_decode(keymap_utf8_t *d, uint8_t byte, uint32_t *codepoint)
+{
+    if (d->pending > 0 && (byte & 0xc0) == 0x80) {
+        d->codepoint = (d->codepoint << 6) | (byte & 0x3f);
+        if (--d->pending == 0) {
+            *codepoint = d->codepoint;
+            return true;
+        }
+        return false;
+    }
+
+    // Start of a new character; an unfinished sequence before it is dropped
+    d->pending = 0;
+    if (byte < 0x80) {
+        *codepoint = byte;
+        return true;
+    } else if ((byte & 0xe0) == 0xc0) {
+        d->codepoint = byte & 0x1f;
+        d->pending = 1;
+    } else if ((byte & 0xf0) == 0xe0) {
+        d->codepoint = byte & 0x0f;
+        d->pending = 2;
+    } else if ((byte & 0xf8) == 0xf0) {
+        d->codepoint = byte & 0x07;
+        d->pending = 3;
+    }
+    return false;
+}
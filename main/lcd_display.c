@@ -10,6 +10,7 @@
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "font.h"
+#include "metrics.h"
 #include <string.h>
 #include <assert.h>
 
@@ -40,6 +41,7 @@ static bool is_inverted = true;
 static bool notify_lcd_draw_ready(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx)
 {
     BaseType_t high_task_awoken = pdFALSE;
+    metrics_inc(METRIC_LCD_TRANSACTIONS);
     xSemaphoreGiveFromISR(lcd_trans_done_sem, &high_task_awoken);
     return high_task_awoken == pdTRUE;
 }
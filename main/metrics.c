@@ -0,0 +1,234 @@
+/*
+ * Metrics
+ * Prometheus text exposition of heap, task and service counters
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include "metrics.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "clipboard_service.h"
+#include "ws_server.h"
+#include "usb_hid.h"
+
+static const char *TAG = "metrics";
+
+#define METRICS_BUF_LEN 512
+
+/* Upper bounds of the broadcast latency buckets, in microseconds */
+static const uint32_t broadcast_buckets_us[] = { 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 };
+#define BROADCAST_BUCKET_COUNT (sizeof(broadcast_buckets_us) / sizeof(broadcast_buckets_us[0]))
+
+uint32_t metrics_counters[portNUM_PROCESSORS][METRIC_COUNTER_MAX];
+
+/* Per-core, non-cumulative bucket counts; the last one is +Inf */
+static uint32_t broadcast_hist[portNUM_PROCESSORS][BROADCAST_BUCKET_COUNT + 1];
+static uint32_t broadcast_sum_us[portNUM_PROCESSORS];
+
+void metrics_observe_broadcast(uint32_t us)
+{
+    int core = esp_cpu_get_core_id();
+    size_t bucket = 0;
+    while (bucket < BROADCAST_BUCKET_COUNT && us > broadcast_buckets_us[bucket]) {
+        bucket++;
+    }
+    __atomic_fetch_add(&broadcast_hist[core][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&broadcast_sum_us[core], us, __ATOMIC_RELAXED);
+}
+
+static uint32_t counter_total(metric_counter_t id)
+{
+    uint32_t total = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        total += __atomic_load_n(&metrics_counters[core][id], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/* Batches output lines into a stack buffer and sends it as HTTP chunks */
+typedef struct {
+    httpd_req_t *req;
+    char buf[METRICS_BUF_LEN];
+    size_t len;
+    esp_err_t err;
+} metrics_writer_t;
+
+static void writer_flush(metrics_writer_t *w)
+{
+    if (w->err == ESP_OK && w->len > 0) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void writer_printf(metrics_writer_t *w, const char *fmt, ...)
+{
+    va_list args;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_start(args, fmt);
+        int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            return;
+        }
+        if (w->len + n < sizeof(w->buf)) {
+            w->len += n;
+            return;
+        }
+        // Line did not fit: flush and retry once with an empty buffer
+        writer_flush(w);
+    }
+}
+
+static void write_counter(metrics_writer_t *w, const char *name, const char *help, metric_counter_t id)
+{
+    writer_printf(w, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+                  name, help, name, name, (unsigned long)counter_total(id));
+}
+
+static void write_heap(metrics_writer_t *w)
+{
+    writer_printf(w, "# HELP clipkit_heap_free_bytes Free heap.\n# TYPE clipkit_heap_free_bytes gauge\n"
+                     "clipkit_heap_free_bytes %lu\n", (unsigned long)esp_get_free_heap_size());
+    writer_printf(w, "# HELP clipkit_heap_min_free_bytes Lowest free heap since boot.\n# TYPE clipkit_heap_min_free_bytes gauge\n"
+                     "clipkit_heap_min_free_bytes %lu\n", (unsigned long)esp_get_minimum_free_heap_size());
+    writer_printf(w, "# HELP clipkit_heap_largest_free_block_bytes Largest allocatable block.\n"
+                     "# TYPE clipkit_heap_largest_free_block_bytes gauge\n"
+                     "clipkit_heap_largest_free_block_bytes %u\n",
+                  (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+static void write_tasks(metrics_writer_t *w)
+{
+#if configUSE_TRACE_FACILITY
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *tasks = malloc(capacity * sizeof(TaskStatus_t));
+    if (tasks == NULL) {
+        ESP_LOGW(TAG, "No memory for task list");
+        return;
+    }
+
+    configRUN_TIME_COUNTER_TYPE total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, capacity, &total_runtime);
+
+    writer_printf(w, "# HELP clipkit_task_stack_high_water_bytes Minimum free stack seen for the task.\n"
+                     "# TYPE clipkit_task_stack_high_water_bytes gauge\n");
+    for (UBaseType_t i = 0; i < count; i++) {
+        writer_printf(w, "clipkit_task_stack_high_water_bytes{task=\"%s\"} %u\n",
+                      tasks[i].pcTaskName, (unsigned)tasks[i].usStackHighWaterMark);
+    }
+
+#if configGENERATE_RUN_TIME_STATS
+    // Run time is counted in esp_timer microseconds; rate() of this gives the CPU share
+    writer_printf(w, "# HELP clipkit_task_cpu_seconds_total CPU time used by the task.\n"
+                     "# TYPE clipkit_task_cpu_seconds_total counter\n");
+    for (UBaseType_t i = 0; i < count; i++) {
+        writer_printf(w, "clipkit_task_cpu_seconds_total{task=\"%s\"} %.3f\n",
+                      tasks[i].pcTaskName, tasks[i].ulRunTimeCounter / 1e6);
+    }
+    if (total_runtime > 0) {
+        // Total run time is per core, so shares add up to the number of cores
+        writer_printf(w, "# HELP clipkit_task_cpu_ratio Share of one core used by the task since boot.\n"
+                         "# TYPE clipkit_task_cpu_ratio gauge\n");
+        for (UBaseType_t i = 0; i < count; i++) {
+            writer_printf(w, "clipkit_task_cpu_ratio{task=\"%s\"} %.4f\n",
+                          tasks[i].pcTaskName, (double)tasks[i].ulRunTimeCounter / total_runtime);
+        }
+    }
+#endif
+    free(tasks);
+#endif
+}
+
+static void write_broadcast_histogram(metrics_writer_t *w)
+{
+    uint32_t cumulative = 0;
+    uint32_t sum_us = 0;
+
+    writer_printf(w, "# HELP clipkit_broadcast_latency_seconds Time to push one clipboard update to all clients.\n"
+                     "# TYPE clipkit_broadcast_latency_seconds histogram\n");
+    for (size_t b = 0; b <= BROADCAST_BUCKET_COUNT; b++) {
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            cumulative += __atomic_load_n(&broadcast_hist[core][b], __ATOMIC_RELAXED);
+        }
+        if (b < BROADCAST_BUCKET_COUNT) {
+            writer_printf(w, "clipkit_broadcast_latency_seconds_bucket{le=\"%g\"} %lu\n",
+                          broadcast_buckets_us[b] / 1e6, (unsigned long)cumulative);
+        } else {
+            writer_printf(w, "clipkit_broadcast_latency_seconds_bucket{le=\"+Inf\"} %lu\n", (unsigned long)cumulative);
+        }
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        sum_us += __atomic_load_n(&broadcast_sum_us[core], __ATOMIC_RELAXED);
+    }
+    writer_printf(w, "clipkit_broadcast_latency_seconds_sum %.6f\n"
+                     "clipkit_broadcast_latency_seconds_count %lu\n",
+                  sum_us / 1e6, (unsigned long)cumulative);
+}
+
+/* HTTP GET Handler for "/metrics" */
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    metrics_writer_t w = { .req = req, .len = 0, .err = ESP_OK };
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    write_heap(&w);
+    write_tasks(&w);
+
+    int websocket_clients = 0, sse_clients = 0;
+    ws_server_get_client_counts(&websocket_clients, &sse_clients);
+    writer_printf(&w, "# HELP clipkit_live_clients Connected live-update clients.\n# TYPE clipkit_live_clients gauge\n"
+                      "clipkit_live_clients{transport=\"websocket\"} %d\n"
+                      "clipkit_live_clients{transport=\"sse\"} %d\n", websocket_clients, sse_clients);
+    writer_printf(&w, "# HELP clipkit_frames_sent_total Live-update frames sent.\n# TYPE clipkit_frames_sent_total counter\n"
+                      "clipkit_frames_sent_total{transport=\"websocket\"} %lu\n"
+                      "clipkit_frames_sent_total{transport=\"sse\"} %lu\n",
+                  (unsigned long)counter_total(METRIC_WS_FRAMES_SENT),
+                  (unsigned long)counter_total(METRIC_SSE_EVENTS_SENT));
+    writer_printf(&w, "# HELP clipkit_bytes_sent_total Live-update payload bytes sent.\n# TYPE clipkit_bytes_sent_total counter\n"
+                      "clipkit_bytes_sent_total{transport=\"websocket\"} %lu\n"
+                      "clipkit_bytes_sent_total{transport=\"sse\"} %lu\n",
+                  (unsigned long)counter_total(METRIC_WS_BYTES_SENT),
+                  (unsigned long)counter_total(METRIC_SSE_BYTES_SENT));
+    write_broadcast_histogram(&w);
+
+    writer_printf(&w, "# HELP clipkit_clipboard_version Current shared clipboard version.\n# TYPE clipkit_clipboard_version gauge\n"
+                      "clipkit_clipboard_version %lu\n", (unsigned long)clipboard_service_get_version());
+    write_counter(&w, "clipkit_clipboard_updates_total", "Shared clipboard updates.", METRIC_CLIPBOARD_UPDATES);
+    write_counter(&w, "clipkit_dns_queries_total", "DNS queries received.", METRIC_DNS_QUERIES);
+    write_counter(&w, "clipkit_dns_cache_hits_total", "Forwarded DNS queries answered from the cache.", METRIC_DNS_CACHE_HITS);
+    write_counter(&w, "clipkit_dns_upstream_queries_total", "DNS queries sent to the upstream resolver.", METRIC_DNS_UPSTREAM_QUERIES);
+    write_counter(&w, "clipkit_hid_keys_pressed_total", "Key presses sent over USB HID.", METRIC_HID_KEYS_PRESSED);
+    write_counter(&w, "clipkit_hid_reports_sent_total", "Keyboard reports sent over USB HID.", METRIC_HID_REPORTS_SENT);
+    writer_printf(&w, "# HELP clipkit_hid_first_key_latency_seconds Time from the last typing request to its first key report.\n"
+                      "# TYPE clipkit_hid_first_key_latency_seconds gauge\n"
+                      "clipkit_hid_first_key_latency_seconds %.6f\n", usb_hid_get_first_key_latency_us() / 1e6);
+    write_counter(&w, "clipkit_lcd_transactions_total", "Completed LCD color transfers.", METRIC_LCD_TRANSACTIONS);
+
+    writer_flush(&w);
+    if (w.err != ESP_OK) {
+        return w.err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static const httpd_uri_t metrics_uri = {
+    .uri       = "/metrics",
+    .method    = HTTP_GET,
+    .handler   = metrics_get_handler,
+    .user_ctx  = NULL
+};
+
+esp_err_t metrics_register(httpd_handle_t server)
+{
+    esp_err_t err = httpd_register_uri_handler(server, &metrics_uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /metrics: %s", esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,292 @@
+/*
+ * Flash-backed store for the USB keyboard payload
+ */
+#include <string.h>
+#include "payload_store.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "payload_store";
+
+#define PAYLOAD_MAGIC        0x55534250 // "PBSU"
+#define PAYLOAD_SECTOR_SIZE  4096
+#define PAYLOAD_DATA_OFFSET  PAYLOAD_SECTOR_SIZE
+#define PAYLOAD_VERIFY_CHUNK 256
+
+/*
+ * Firmware that predates compiled programs wrote 0 in program_length and left
+ * the rest of the sector erased, which reads as "no program".
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t length;
+    uint32_t crc;
+    uint32_t program_length;
+    uint32_t program_crc;
+    uint32_t program_tag;
+} payload_header_t;
+
+static const esp_partition_t *s_partition = NULL;
+static SemaphoreHandle_t s_mutex = NULL;
+static size_t s_length = 0;
+static size_t s_program_length = 0;
+static uint32_t s_program_tag = 0;
+static uint32_t s_generation = 0;
+
+// Write session state (valid while s_mutex is held by the writer)
+static size_t s_write_len = 0;
+static size_t s_write_pos = 0;
+static uint32_t s_write_crc = 0;
+static size_t s_program_pos = 0;
+static uint32_t s_program_crc = 0;
+static size_t s_program_erased = 0;     // Partition offset up to which the program area is erased
+static bool s_program_dropped = false;
+
+static size_t round_up_sector(size_t len)
+{
+    return (len + PAYLOAD_SECTOR_SIZE - 1) & ~(size_t)(PAYLOAD_SECTOR_SIZE - 1);
+}
+
+/* The program starts on the first sector after the text, so it can be erased on its own */
+static size_t program_offset(size_t text_len)
+{
+    return PAYLOAD_DATA_OFFSET + round_up_sector(text_len);
+}
+
+static bool payload_verify(size_t offset, size_t length, uint32_t expected)
+{
+    uint8_t buf[PAYLOAD_VERIFY_CHUNK];
+    uint32_t crc = 0;
+    for (size_t pos = 0; pos < length; pos += sizeof(buf)) {
+        size_t n = length - pos;
+        if (n > sizeof(buf)) n = sizeof(buf);
+        if (esp_partition_read(s_partition, offset + pos, buf, n) != ESP_OK) {
+            return false;
+        }
+        crc = esp_rom_crc32_le(crc, buf, n);
+    }
+    return crc == expected;
+}
+
+esp_err_t payload_store_init(void)
+{
+    if (s_mutex == NULL) {
+        s_mutex = xSemaphoreCreateMutex();
+        if (s_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                           PAYLOAD_STORE_PARTITION_LABEL);
+    if (s_partition == NULL) {
+        ESP_LOGE(TAG, "Partition '%s' not found", PAYLOAD_STORE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    payload_header_t hdr;
+    esp_err_t err = esp_partition_read(s_partition, 0, &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read header: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    s_length = 0;
+    s_program_length = 0;
+    if (hdr.magic == PAYLOAD_MAGIC && hdr.length <= payload_store_capacity()) {
+        if (payload_verify(PAYLOAD_DATA_OFFSET, hdr.length, hdr.crc)) {
+            s_length = hdr.length;
+            // Headers from before the tag existed leave it erased
+            s_program_tag = hdr.program_tag == UINT32_MAX ? 0 : hdr.program_tag;
+            ESP_LOGI(TAG, "Stored payload: %u bytes", (unsigned)s_length);
+        } else {
+            ESP_LOGW(TAG, "Stored payload failed CRC check, ignoring");
+        }
+    }
+
+    size_t offset = program_offset(s_length);
+    if (s_length > 0 && hdr.program_length > 0 && offset <= s_partition->size &&
+        hdr.program_length <= s_partition->size - offset) {
+        if (payload_verify(offset, hdr.program_length, hdr.program_crc)) {
+            s_program_length = hdr.program_length;
+            ESP_LOGI(TAG, "Stored program: %u bytes", (unsigned)s_program_length);
+        } else {
+            ESP_LOGW(TAG, "Stored program failed CRC check, ignoring");
+        }
+    }
+    return ESP_OK;
+}
+
+size_t payload_store_capacity(void)
+{
+    if (s_partition == NULL) return 0;
+    return s_partition->size - PAYLOAD_DATA_OFFSET;
+}
+
+esp_err_t payload_store_begin(size_t len)
+{
+    if (s_partition == NULL) return ESP_ERR_INVALID_STATE;
+    if (len > payload_store_capacity()) return ESP_ERR_INVALID_SIZE;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    s_generation++;
+    s_length = 0;
+    s_program_length = 0;
+
+    // Erasing the header sector invalidates the old payload first
+    esp_err_t err = esp_partition_erase_range(s_partition, 0, PAYLOAD_DATA_OFFSET + round_up_sector(len));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erase failed: %s", esp_err_to_name(err));
+        xSemaphoreGive(s_mutex);
+        return err;
+    }
+
+    s_write_len = len;
+    s_write_pos = 0;
+    s_write_crc = 0;
+    s_program_pos = 0;
+    s_program_crc = 0;
+    s_program_erased = program_offset(len);
+    s_program_dropped = false;
+    return ESP_OK; // Mutex stays held until finish/abort
+}
+
+esp_err_t payload_store_write(const void *data, size_t len)
+{
+    if (s_write_pos + len > s_write_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t err = esp_partition_write(s_partition, PAYLOAD_DATA_OFFSET + s_write_pos, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Write failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_write_crc = esp_rom_crc32_le(s_write_crc, data, len);
+    s_write_pos += len;
+    return ESP_OK;
+}
+
+esp_err_t payload_store_write_program(const void *data, size_t len)
+{
+    if (s_program_dropped) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t offset = program_offset(s_write_len) + s_program_pos;
+    if (offset > s_partition->size || len > s_partition->size - offset) {
+        ESP_LOGW(TAG, "Program does not fit after %u bytes, dropped", (unsigned)s_program_pos);
+        s_program_dropped = true;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Only erase the sectors the program actually reaches
+    esp_err_t err = ESP_OK;
+    if (offset + len > s_program_erased) {
+        size_t end = round_up_sector(offset + len);
+        err = esp_partition_erase_range(s_partition, s_program_erased, end - s_program_erased);
+        if (err == ESP_OK) {
+            s_program_erased = end;
+        }
+    }
+    if (err == ESP_OK) {
+        err = esp_partition_write(s_partition, offset, data, len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Program write failed: %s", esp_err_to_name(err));
+        s_program_dropped = true;
+        return err;
+    }
+    s_program_crc = esp_rom_crc32_le(s_program_crc, data, len);
+    s_program_pos += len;
+    return ESP_OK;
+}
+
+esp_err_t payload_store_finish(uint32_t program_tag)
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (s_write_pos == s_write_len) {
+        bool program = !s_program_dropped && s_program_pos > 0;
+        payload_header_t hdr = {
+            .magic = PAYLOAD_MAGIC,
+            .length = s_write_len,
+            .crc = s_write_crc,
+            .program_length = program ? s_program_pos : 0,
+            .program_crc = s_program_crc,
+            .program_tag = program_tag,
+        };
+        err = esp_partition_write(s_partition, 0, &hdr, sizeof(hdr));
+        if (err == ESP_OK) {
+            s_length = s_write_len;
+            s_program_length = hdr.program_length;
+            s_program_tag = program_tag;
+            ESP_LOGI(TAG, "Saved payload: %u bytes, program: %u bytes",
+                     (unsigned)s_length, (unsigned)s_program_length);
+        } else {
+            ESP_LOGE(TAG, "Header write failed: %s", esp_err_to_name(err));
+        }
+    }
+    xSemaphoreGive(s_mutex);
+    return err;
+}
+
+void payload_store_abort(void)
+{
+    ESP_LOGW(TAG, "Payload write aborted after %u bytes", (unsigned)s_write_pos);
+    xSemaphoreGive(s_mutex);
+}
+
+size_t payload_store_get_length(void)
+{
+    return s_length;
+}
+
+uint32_t payload_store_get_generation(void)
+{
+    return s_generation;
+}
+
+size_t payload_store_get_program_length(void)
+{
+    return s_program_length;
+}
+
+uint32_t payload_store_get_program_tag(void)
+{
+    return s_program_tag;
+}
+
+static esp_err_t payload_read_region(bool program, size_t offset, void *buf, size_t len, uint32_t generation)
+{
+    if (s_partition == NULL) return ESP_ERR_INVALID_STATE;
+
+    // Do not wait for a save in progress: the caller's data is stale anyway
+    if (xSemaphoreTake(s_mutex, 0) != pdTRUE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (generation != s_generation) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (offset + len > (program ? s_program_length : s_length)) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        size_t base = program ? program_offset(s_length) : PAYLOAD_DATA_OFFSET;
+        err = esp_partition_read(s_partition, base + offset, buf, len);
+    }
+    xSemaphoreGive(s_mutex);
+    return err;
+}
+
+esp_err_t payload_store_read(size_t offset, void *buf, size_t len, uint32_t generation)
+{
+    return payload_read_region(false, offset, buf, len, generation);
+}
+
+esp_err_t payload_store_read_program(size_t offset, void *buf, size_t len, uint32_t generation)
+{
+    return payload_read_region(true, offset, buf, len, generation);
+}
@@ -140,6 +140,14 @@ void ui_enter_action(void)
     }
 }
 
+void ui_enter_long_action(void)
+{
+    if (s_current_page == 3 && usb_hid_is_active()) {
+        // Page 3: Type the shared clipboard
+        usb_hid_type_clipboard();
+    }
+}
+
 // ================= State Updates =================
 
 void ui_update_wifi_ap(const char *ssid, const char *ip)
@@ -337,6 +345,9 @@ static void render_page3_usb(void)
         // Inactive Mode: Show Enable prompt
         lcd_draw_string(15, 30, "USB Keyboard", 0x07E0, 0x0000);
         lcd_draw_string(10, 60, "Status: Off", 0xF800, 0x0000); // Red
+        if (usb_hid_is_persistent()) {
+            lcd_draw_string(10, 75, "Always-on", 0xAAAA, 0x0000); // Enumerated, not armed
+        }
         lcd_draw_string(0, 90, "KEY1: Enable USB", 0xFFFF, 0x0000);
     }
 }
@@ -0,0 +1,166 @@
+/*
+ * CDC-ACM clipboard channel
+ * Raw clipboard get/put/subscribe over a virtual serial port, next to the
+ * keyboard interface. The TinyUSB callbacks only notify the CDC task; frames
+ * are parsed and answered there.
+ */
+#include "usb_cdc.h"
+#include "sdkconfig.h"
+
+#if CONFIG_TINYUSB_CDC_ENABLED
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "tinyusb.h"
+#include "tinyusb_cdc_acm.h"
+#include "clip_sync.h"
+#include "clipboard_service.h"
+
+static const char *TAG = "usb_cdc";
+
+#define USB_CDC_PORT        TINYUSB_CDC_ACM_0
+#define USB_CDC_READ_CHUNK  256
+#define USB_CDC_TIMEOUT_MS  100     // Give up on a write when the host stops reading
+
+// Task notification bits
+#define USB_CDC_EVT_RX      (1 << 0)
+#define USB_CDC_EVT_CHANGED (1 << 1)
+#define USB_CDC_EVT_RESET   (1 << 2)
+
+static TaskHandle_t s_cdc_task = NULL;
+static SemaphoreHandle_t s_cdc_lock = NULL;     // Held by the task while it uses the port
+static volatile bool s_cdc_started = false;
+static clip_sync_session_t s_session;   // Only used by the CDC task
+
+static void usb_cdc_send(const uint8_t *data, size_t len, void *arg)
+{
+    (void) arg;
+    while (len > 0 && s_cdc_started) {
+        size_t n = tinyusb_cdcacm_write_queue(USB_CDC_PORT, data, len);
+        data += n;
+        len -= n;
+        // Push out what is queued; if nothing fit and nothing drains, the host is not reading
+        if (tinyusb_cdcacm_write_flush(USB_CDC_PORT, pdMS_TO_TICKS(USB_CDC_TIMEOUT_MS)) != ESP_OK && n == 0) {
+            ESP_LOGW(TAG, "Host not reading, dropped %u bytes", (unsigned)len);
+            return;
+        }
+    }
+}
+
+static void usb_cdc_rx_cb(int itf, cdcacm_event_t *event)
+{
+    (void) itf;
+    (void) event;
+    xTaskNotify(s_cdc_task, USB_CDC_EVT_RX, eSetBits);
+}
+
+static void usb_cdc_line_state_cb(int itf, cdcacm_event_t *event)
+{
+    (void) itf;
+    if (!event->line_state_changed_data.dtr) {
+        // Port closed: forget half-received frames and subscriptions
+        xTaskNotify(s_cdc_task, USB_CDC_EVT_RESET, eSetBits);
+    }
+}
+
+static void usb_cdc_clipboard_changed(uint32_t version, void *arg)
+{
+    (void) version;
+    (void) arg;
+    xTaskNotify(s_cdc_task, USB_CDC_EVT_CHANGED, eSetBits);
+}
+
+static void usb_cdc_task(void *arg)
+{
+    uint8_t buf[USB_CDC_READ_CHUNK];
+    clip_sync_session_init(&s_session, usb_cdc_send, NULL);
+    while (1) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+        // usb_cdc_stop() takes the lock before deinit, so the port stays valid while held
+        xSemaphoreTake(s_cdc_lock, portMAX_DELAY);
+        if (!s_cdc_started) {
+            xSemaphoreGive(s_cdc_lock);
+            continue;
+        }
+        if (events & USB_CDC_EVT_RESET) {
+            clip_sync_session_init(&s_session, usb_cdc_send, NULL);
+        }
+        if (events & USB_CDC_EVT_RX) {
+            size_t n = 0;
+            while (s_cdc_started && tinyusb_cdcacm_read(USB_CDC_PORT, buf, sizeof(buf), &n) == ESP_OK && n > 0) {
+                clip_sync_feed(&s_session, buf, n);
+            }
+        }
+        if (events & USB_CDC_EVT_CHANGED) {
+            clip_sync_poll(&s_session);
+        }
+        xSemaphoreGive(s_cdc_lock);
+    }
+}
+
+void usb_cdc_init(void)
+{
+    if (s_cdc_task == NULL) {
+        s_cdc_lock = xSemaphoreCreateMutex();
+        if (s_cdc_lock == NULL) {
+            ESP_LOGE(TAG, "Failed to create lock");
+            return;
+        }
+        xTaskCreate(usb_cdc_task, "usb_cdc", 4096, NULL, 5, &s_cdc_task);
+        clipboard_service_add_listener(usb_cdc_clipboard_changed, NULL);
+    }
+}
+
+esp_err_t usb_cdc_start(void)
+{
+    if (s_cdc_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const tinyusb_config_cdcacm_t acm_cfg = {
+        .cdc_port = USB_CDC_PORT,
+        .callback_rx = usb_cdc_rx_cb,
+        .callback_rx_wanted_char = NULL,
+        .callback_line_state_changed = usb_cdc_line_state_cb,
+        .callback_line_coding_changed = NULL,
+    };
+    esp_err_t err = tinyusb_cdcacm_init(&acm_cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start CDC-ACM: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_cdc_started = true;
+    xTaskNotify(s_cdc_task, USB_CDC_EVT_RESET, eSetBits);
+    ESP_LOGI(TAG, "CDC-ACM clipboard channel started");
+    return ESP_OK;
+}
+
+void usb_cdc_stop(void)
+{
+    if (s_cdc_started) {
+        // Cuts a pending write short (at most one USB_CDC_TIMEOUT_MS flush), then wait for the task
+        s_cdc_started = false;
+        xSemaphoreTake(s_cdc_lock, portMAX_DELAY);
+        tinyusb_cdcacm_deinit(USB_CDC_PORT);
+        xSemaphoreGive(s_cdc_lock);
+    }
+}
+
+#else
+
+void usb_cdc_init(void)
+{
+}
+
+esp_err_t usb_cdc_start(void)
+{
+    return ESP_OK;
+}
+
+void usb_cdc_stop(void)
+{
+}
+
+#endif // CONFIG_TINYUSB_CDC_ENABLED
@@ -1,8 +1,12 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "usb_hid.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/semphr.h"
 #include "tinyusb.h"
 #include "tinyusb_default_config.h"
 #include "class/hid/hid_device.h"
@@ -12,32 +16,122 @@
 #include "soc/rtc_cntl_reg.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "payload_store.h"
+#include "clipboard_service.h"
+#include "keymap.h"
+#include "hid_program.h"
+#include "metrics.h"
+#include "usb_cdc.h"
+#include "usb_msc.h"
+#include "usb_hid_sync.h"
 
 static const char *TAG = "USB_HID";
-static bool s_usb_enabled = false;
-static char s_usb_string[USB_STRING_MAX_LEN + 1] = {0};
+static volatile bool s_usb_enabled = false;           // Armed: typing allowed
+static bool s_usb_installed = false;                   // TinyUSB driver installed, device attached
+static bool s_usb_persistent = false;                  // Stay installed while disarmed
+static SemaphoreHandle_t s_usb_mode_lock = NULL;       // Serializes arming and mode changes
+static volatile int64_t s_first_key_request_us = 0;    // Typing request still waiting for its first key
+static uint32_t s_first_key_latency_us = 0;
+static char s_usb_preview[USB_STRING_PREVIEW_LEN + 1] = {0};
+static TaskHandle_t s_usb_feed_task = NULL;
+static keymap_layout_t s_layout = KEYMAP_LAYOUT_US;
+static const keymap_key_t *volatile s_keymap = NULL;   // Table of s_layout, read by the feed task
+static bool s_layout_loaded = false;
+static hid_compiler_t s_save_compiler;                 // Compiles the string being saved
+static size_t s_unmapped = 0;                          // Characters the last saved string could not type
+static char s_save_error[64] = {0};                    // Macro syntax error of the last save
+static volatile bool s_hid_reset = false;              // Set by the feed task after a cut-short run
+
+#define USB_HID_FEED_CHUNK 256           // Bytes read from flash and handed over per call
+#define USB_HID_COMPILE_CHUNK 64        // Text compiled per step when no stored program fits
+#define USB_HID_TYPE_BATCH 64           // Program bytes the typing task takes per wake-up
+#define USB_HID_STREAM_SIZE 1024
+#define USB_HID_REPORT_TIMEOUT_MS 20    // Re-check the connection this often while the host is not polling
+#define USB_HID_WAIT_SPIN_US 1000       // Longest tail of a macro WAIT that is spun rather than slept
+#define USB_HID_ROLLOVER HID_PROGRAM_ROLLOVER
+
+// What the feed task is asked to type (task notification bits)
+#define USB_HID_FEED_PAYLOAD   (1 << 0)
+#define USB_HID_FEED_CLIPBOARD (1 << 1)
+
+// Stored programs are only valid for the format and layout they were compiled for
+#define USB_HID_TAG_MACROS 0x10000
+#define USB_HID_PROGRAM_TAG(layout, macros) \
+    ((HID_PROGRAM_FORMAT << 8) | (uint32_t)(layout) | ((macros) ? USB_HID_TAG_MACROS : 0))
+#define USB_HID_NVS_NAMESPACE "storage"
+#define USB_HID_NVS_LAYOUT_KEY "kbd_layout"
+#define USB_HID_NVS_PERSISTENT_KEY "usb_persist"
+#define USB_HID_MOUNT_TIMEOUT_MS 5000    // How long a typing request waits for the host to enumerate
 
 /************* TinyUSB descriptors ****************/
 
-#define TUSB_DESC_TOTAL_LEN      (TUD_CONFIG_DESC_LEN + CFG_TUD_HID * TUD_HID_DESC_LEN)
+// Interface numbers; the CDC-ACM clipboard channel takes a control and a data interface
+enum {
+    ITF_NUM_HID = 0,
+#if USB_HID_SYNC_ENABLED
+    ITF_NUM_HID_SYNC,
+#endif
+#if CONFIG_TINYUSB_CDC_ENABLED
+    ITF_NUM_CDC,
+    ITF_NUM_CDC_DATA,
+#endif
+#if CONFIG_TINYUSB_MSC_ENABLED
+    ITF_NUM_MSC,
+#endif
+    ITF_NUM_TOTAL
+};
+
+#if CONFIG_TINYUSB_CDC_ENABLED
+#define TUSB_DESC_CDC_LEN        TUD_CDC_DESC_LEN
+#else
+#define TUSB_DESC_CDC_LEN        0
+#endif
+#if CONFIG_TINYUSB_MSC_ENABLED
+#define TUSB_DESC_MSC_LEN        TUD_MSC_DESC_LEN
+#else
+#define TUSB_DESC_MSC_LEN        0
+#endif
+#if USB_HID_SYNC_ENABLED
+#define TUSB_DESC_HID_SYNC_LEN   TUD_HID_INOUT_DESC_LEN
+#else
+#define TUSB_DESC_HID_SYNC_LEN   0
+#endif
+#define TUSB_DESC_TOTAL_LEN      (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUSB_DESC_HID_SYNC_LEN + \
+                                  TUSB_DESC_CDC_LEN + TUSB_DESC_MSC_LEN)
+
+// The ESP32-S3 USB controller has four IN endpoints besides EP0
+#if 1 + USB_HID_SYNC_ENABLED + 2 * CONFIG_TINYUSB_CDC_ENABLED + CONFIG_TINYUSB_MSC_ENABLED > 4
+#error "Too many IN endpoints (ESP32-S3 has 4 besides EP0): disable CDC, MSC or the HID sync interface in sdkconfig"
+#endif
 
 // HID Report Descriptor for a standard keyboard
 static const uint8_t hid_report_descriptor[] = {
     TUD_HID_REPORT_DESC_KEYBOARD()
 };
 
+#if USB_HID_SYNC_ENABLED
+// Vendor-defined 64-byte input and output reports for the clipboard channel
+static const uint8_t hid_sync_report_descriptor[] = {
+    TUD_HID_REPORT_DESC_GENERIC_INOUT(USB_HID_SYNC_REPORT_SIZE)
+};
+#endif
+
 /**
  * @brief String descriptor
  */
-const char* hid_string_descriptor[5] = {
+const char* hid_string_descriptor[8] = {
     // array of pointer to string descriptors
     (char[]){0x09, 0x04},  // 0: is supported language is English (0x0409)
     "TinyUSB",             // 1: Manufacturer
     "TinyUSB Device",      // 2: Product
     "123456",              // 3: Serials, should use chip ID
     "Example HID interface",  // 4: HID
+    "Clipboard Sync",      // 5: CDC
+    "Clipboard Drive",     // 6: MSC
+    "Clipboard Sync HID",  // 7: HID sync
 };
 
 /**
@@ -45,10 +139,26 @@ const char* hid_string_descriptor[5] = {
  */
 static const uint8_t hid_configuration_descriptor[] = {
     // Configuration number, interface count, string index, total length, attribute, power in mA
-    TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
     // Interface number, string index, boot protocol, report descriptor len, EP In address, size & polling interval
-    TUD_HID_DESCRIPTOR(0, 4, false, sizeof(hid_report_descriptor), 0x81, 16, 10),
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 4, false, sizeof(hid_report_descriptor), 0x81, 16, USB_HID_POLL_INTERVAL_MS),
+
+#if USB_HID_SYNC_ENABLED
+    // Interface number, string index, protocol, report descriptor len, EP Out & In address, size & polling interval
+    TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_HID_SYNC, 7, HID_ITF_PROTOCOL_NONE, sizeof(hid_sync_report_descriptor),
+                             0x05, 0x85, USB_HID_SYNC_REPORT_SIZE, 1),
+#endif
+
+#if CONFIG_TINYUSB_CDC_ENABLED
+    // Interface number, string index, notification EP & size, data EP Out & In, size
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 5, 0x82, 8, 0x03, 0x83, 64),
+#endif
+
+#if CONFIG_TINYUSB_MSC_ENABLED
+    // Interface number, string index, EP Out & In address, EP size
+    TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 6, 0x04, 0x84, 64),
+#endif
 };
 
 /********* TinyUSB HID callbacks ***************/
@@ -56,6 +166,11 @@ static const uint8_t hid_configuration_descriptor[] = {
 // Invoked when received GET HID REPORT DESCRIPTOR request
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
 {
+#if USB_HID_SYNC_ENABLED
+    if (instance == USB_HID_SYNC_INSTANCE) {
+        return hid_sync_report_descriptor;
+    }
+#endif
     return hid_report_descriptor;
 }
 
@@ -70,9 +185,13 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
     return 0;
 }
 
-// Invoked when received SET_REPORT control request
+// Invoked when received SET_REPORT control request or data on the OUT endpoint
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
+    (void) report_id;
+    if (instance == USB_HID_SYNC_INSTANCE && report_type != HID_REPORT_TYPE_FEATURE) {
+        usb_hid_sync_receive(buffer, bufsize);
+    }
 }
 
 /********* Application ***************/
@@ -82,260 +201,861 @@ bool usb_hid_is_active(void)
     return s_usb_enabled;
 }
 
-void usb_hid_set_enabled(bool enabled)
+/* Take the PHY from USB-Serial-JTAG and enumerate. Called with s_usb_mode_lock held. */
+static esp_err_t usb_hid_install(void)
 {
-    if (enabled && !s_usb_enabled) {
-        ESP_LOGI(TAG, "Enabling USB HID - installing driver");
+    ESP_LOGI(TAG, "Installing USB driver");
+
+
+    // Restore PHY to USB OTG (TinyUSB)
+    // 1. Enable SW control of muxing USB OTG vs USJ
+    SET_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_HW_USB_PHY_SEL);
+    // 2. Select Internal USB FSLS PHY for USB OTG (1)
+    SET_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_USB_PHY_SEL);
+
+    tinyusb_config_t tusb_cfg = TINYUSB_DEFAULT_CONFIG();
+
+    tusb_cfg.descriptor.device = NULL;
+    tusb_cfg.descriptor.full_speed_config = hid_configuration_descriptor;
+    tusb_cfg.descriptor.string = hid_string_descriptor;
+    tusb_cfg.descriptor.string_count = sizeof(hid_string_descriptor) / sizeof(hid_string_descriptor[0]);
+
+#if (TUD_OPT_HIGH_SPEED)
+    tusb_cfg.descriptor.high_speed_config = hid_configuration_descriptor;
+#endif // TUD_OPT_HIGH_SPEED
+
+    esp_err_t err = tinyusb_driver_install(&tusb_cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install USB driver: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_usb_installed = true;
+    ESP_LOGI(TAG, "USB driver installed");
+    usb_cdc_start();
+    usb_msc_start();
+    usb_hid_sync_start();
+    return ESP_OK;
+}
+
+/* Give the PHY back to USB-Serial-JTAG. Called with s_usb_mode_lock held. */
+static void usb_hid_uninstall(void)
+{
+    ESP_LOGI(TAG, "Uninstalling USB driver");
+    usb_cdc_stop();
+    usb_msc_stop();
+    usb_hid_sync_stop();
+    esp_err_t err = tinyusb_driver_uninstall();
+    if (err == ESP_OK) {
+        s_usb_installed = false;
+        ESP_LOGI(TAG, "USB driver uninstalled");
         
-        // Restore PHY to USB OTG (TinyUSB)
-        // 1. Enable SW control of muxing USB OTG vs USJ
-        SET_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_HW_USB_PHY_SEL);
-        // 2. Select Internal USB FSLS PHY for USB OTG (1)
-        SET_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_USB_PHY_SEL);
+        // Restore USB Serial JTAG
+        // 1. Reset USB OTG (TinyUSB controller) to stop it from interfering
+        SET_PERI_REG_MASK(SYSTEM_PERIP_RST_EN0_REG, SYSTEM_USB_RST);
+        // 2. Disable USB OTG Clock
+        CLEAR_PERI_REG_MASK(SYSTEM_PERIP_CLK_EN0_REG, SYSTEM_USB_CLK_EN);
         
-        tinyusb_config_t tusb_cfg = TINYUSB_DEFAULT_CONFIG();
+        // 3. Enable USB Serial/JTAG Clock FIRST
+        SET_PERI_REG_MASK(SYSTEM_PERIP_CLK_EN1_REG, SYSTEM_USB_DEVICE_CLK_EN);
 
-        tusb_cfg.descriptor.device = NULL;
-        tusb_cfg.descriptor.full_speed_config = hid_configuration_descriptor;
-        tusb_cfg.descriptor.string = hid_string_descriptor;
-        tusb_cfg.descriptor.string_count = sizeof(hid_string_descriptor) / sizeof(hid_string_descriptor[0]);
+        // 4. Manually switch PHY to USB Serial/JTAG using RTC controller
+        // Enable SW control of muxing USB OTG vs USJ to the internal USB FSLS PHY
+        SET_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_HW_USB_PHY_SEL);
+        // 0 - Internal USB FSLS PHY is mapped to the USJ. USB Wrap mapped to external PHY
+        CLEAR_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_USB_PHY_SEL);
+
+        // 5. Reset USB Serial/JTAG controller
+        SET_PERI_REG_MASK(SYSTEM_PERIP_RST_EN1_REG, SYSTEM_USB_DEVICE_RST);
+        CLEAR_PERI_REG_MASK(SYSTEM_PERIP_RST_EN1_REG, SYSTEM_USB_DEVICE_RST);
+        
+        // 6. Select internal PHY for Serial/JTAG
+        USB_SERIAL_JTAG.conf0.phy_sel = 0; 
         
-    #if (TUD_OPT_HIGH_SPEED)
-        tusb_cfg.descriptor.high_speed_config = hid_configuration_descriptor;
-    #endif // TUD_OPT_HIGH_SPEED
+        // 7. Force Detach (Disable USB pads)
+        USB_SERIAL_JTAG.conf0.usb_pad_enable = 0;
+        vTaskDelay(pdMS_TO_TICKS(100)); // Wait for host to detect detach
 
-        esp_err_t err = tinyusb_driver_install(&tusb_cfg);
-        if (err == ESP_OK) {
+        // 8. Enable USB pads (Attach)
+        USB_SERIAL_JTAG.conf0.usb_pad_enable = 1; 
+
+        ESP_LOGI(TAG, "USB Serial JTAG restored");
+    } else {
+        ESP_LOGE(TAG, "Failed to uninstall USB driver: %s", esp_err_to_name(err));
+    }
+}
+
+/*
+ * Enabling arms typing. In on-demand mode it also installs the driver, and
+ * disabling uninstalls it; in persistent mode the device stays enumerated and
+ * this only flips the flag the typing tasks check.
+ */
+void usb_hid_set_enabled(bool enabled)
+{
+    if (s_usb_mode_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_usb_mode_lock, portMAX_DELAY);
+    if (enabled && !s_usb_enabled) {
+        if (s_usb_installed || usb_hid_install() == ESP_OK) {
             s_usb_enabled = true;
-            ESP_LOGI(TAG, "USB HID driver installed");
-        } else {
-            ESP_LOGE(TAG, "Failed to install USB HID driver: %s", esp_err_to_name(err));
+            ESP_LOGI(TAG, "USB keyboard armed");
         }
     } else if (!enabled && s_usb_enabled) {
-        ESP_LOGI(TAG, "Disabling USB HID - uninstalling driver");
-        esp_err_t err = tinyusb_driver_uninstall();
+        s_usb_enabled = false;
+        ESP_LOGI(TAG, "USB keyboard disarmed");
+        if (!s_usb_persistent) {
+            usb_hid_uninstall();
+        }
+    }
+    xSemaphoreGive(s_usb_mode_lock);
+}
+
+esp_err_t usb_hid_set_persistent(bool persistent)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(USB_HID_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_u8(handle, USB_HID_NVS_PERSISTENT_KEY, persistent);
         if (err == ESP_OK) {
-            s_usb_enabled = false;
-            ESP_LOGI(TAG, "USB HID driver uninstalled");
-            
-            // Restore USB Serial JTAG
-            // 1. Reset USB OTG (TinyUSB controller) to stop it from interfering
-            SET_PERI_REG_MASK(SYSTEM_PERIP_RST_EN0_REG, SYSTEM_USB_RST);
-            // 2. Disable USB OTG Clock
-            CLEAR_PERI_REG_MASK(SYSTEM_PERIP_CLK_EN0_REG, SYSTEM_USB_CLK_EN);
-            
-            // 3. Enable USB Serial/JTAG Clock FIRST
-            SET_PERI_REG_MASK(SYSTEM_PERIP_CLK_EN1_REG, SYSTEM_USB_DEVICE_CLK_EN);
-
-            // 4. Manually switch PHY to USB Serial/JTAG using RTC controller
-            // Enable SW control of muxing USB OTG vs USJ to the internal USB FSLS PHY
-            SET_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_HW_USB_PHY_SEL);
-            // 0 - Internal USB FSLS PHY is mapped to the USJ. USB Wrap mapped to external PHY
-            CLEAR_PERI_REG_MASK(RTC_CNTL_USB_CONF_REG, RTC_CNTL_SW_USB_PHY_SEL);
-
-            // 5. Reset USB Serial/JTAG controller
-            SET_PERI_REG_MASK(SYSTEM_PERIP_RST_EN1_REG, SYSTEM_USB_DEVICE_RST);
-            CLEAR_PERI_REG_MASK(SYSTEM_PERIP_RST_EN1_REG, SYSTEM_USB_DEVICE_RST);
-            
-            // 6. Select internal PHY for Serial/JTAG
-            USB_SERIAL_JTAG.conf0.phy_sel = 0; 
-            
-            // 7. Force Detach (Disable USB pads)
-            USB_SERIAL_JTAG.conf0.usb_pad_enable = 0;
-            vTaskDelay(pdMS_TO_TICKS(100)); // Wait for host to detect detach
-
-            // 8. Enable USB pads (Attach)
-            USB_SERIAL_JTAG.conf0.usb_pad_enable = 1; 
-
-            ESP_LOGI(TAG, "USB Serial JTAG restored");
-        } else {
-            ESP_LOGE(TAG, "Failed to uninstall USB HID driver: %s", esp_err_to_name(err));
+            err = nvs_commit(handle);
         }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save USB mode: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    xSemaphoreTake(s_usb_mode_lock, portMAX_DELAY);
+    s_usb_persistent = persistent;
+    if (persistent && !s_usb_installed) {
+        err = usb_hid_install();
+    } else if (!persistent && s_usb_installed && !s_usb_enabled) {
+        usb_hid_uninstall();
     }
+    xSemaphoreGive(s_usb_mode_lock);
+    ESP_LOGI(TAG, "USB mode: %s", persistent ? "persistent" : "on demand");
+    return err;
 }
 
-static void send_key(uint8_t modifier, uint8_t keycode)
+bool usb_hid_is_persistent(void)
 {
-    if (s_usb_enabled && tud_mounted()) {
-        uint8_t keys[6] = {keycode, 0, 0, 0, 0, 0};
-        tud_hid_n_keyboard_report(0, 0, modifier, keys);
-        vTaskDelay(pdMS_TO_TICKS(10));
-        
-        uint8_t empty[6] = {0};
-        tud_hid_n_keyboard_report(0, 0, 0, empty);
-        vTaskDelay(pdMS_TO_TICKS(10));
+    return s_usb_persistent;
+}
+
+uint32_t usb_hid_get_first_key_latency_us(void)
+{
+    return s_first_key_latency_us;
+}
+
+/********* Typing engine ***************/
+
+/*
+ * Text is typed from a keystroke program (hid_program.h): each op adds one key
+ * to the keys already held, so the host sees exactly one new key-down per report
+ * and in order, and up to USB_HID_ROLLOVER characters share a single release
+ * report. The program is compiled once when the string is saved; the typing task
+ * only follows it, including macro waits and repeats.
+ *
+ * Reports are paced by the host: the next one is queued as soon as the previous
+ * one has been polled (tud_hid_report_complete_cb) instead of after a fixed delay,
+ * so the typing rate follows the endpoint polling interval.
+ */
+typedef struct {
+    uint8_t modifier;
+    uint8_t count;
+    uint8_t keys[USB_HID_ROLLOVER];
+    bool pressed;                   // The host was last sent something other than an empty report
+} hid_chord_t;
+
+/*
+ * Interpreter state. Ops arrive a batch at a time, so an extended op may be
+ * split across batches and is collected in op[] first. A REPEAT body is copied
+ * into body[] until its END and then run from there; nothing is allocated.
+ */
+typedef struct {
+    uint8_t op[4];
+    uint8_t have;                   // Bytes of op[] collected
+    uint8_t need;                   // Length of the op being collected
+    uint8_t depth;                  // REPEAT nesting while a body is being captured
+    uint16_t count;                 // Passes of the captured body
+    size_t body_len;
+    bool overflow;
+    uint8_t body[HID_PROGRAM_MAX_LOOP];
+} hid_vm_t;
+
+static SemaphoreHandle_t s_report_done = NULL;
+
+// Invoked from the TinyUSB task when the host has polled a report
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    (void) report;
+    (void) len;
+    if (instance == USB_HID_SYNC_INSTANCE) {
+        usb_hid_sync_report_done();
+        return;
     }
+    xSemaphoreGive(s_report_done);
 }
 
-static void char_to_hid(char c, uint8_t *modifier, uint8_t *keycode)
+/* Queue a keyboard report once the endpoint is free. Returns false if the host went away. */
+static bool hid_send_report(uint8_t modifier, const uint8_t keys[USB_HID_ROLLOVER])
 {
-    *modifier = 0;
-    *keycode = 0;
-    
-    if (c >= 'a' && c <= 'z') {
-        *keycode = HID_KEY_A + (c - 'a');
-    } else if (c >= 'A' && c <= 'Z') {
-        *modifier = KEYBOARD_MODIFIER_LEFTSHIFT;
-        *keycode = HID_KEY_A + (c - 'A');
-    } else if (c >= '1' && c <= '9') {
-        *keycode = HID_KEY_1 + (c - '1');
-    } else if (c == '0') {
-        *keycode = HID_KEY_0;
+    while (!tud_hid_n_ready(0)) {
+        if (!s_usb_enabled || !tud_mounted()) {
+            return false;
+        }
+        xSemaphoreTake(s_report_done, pdMS_TO_TICKS(USB_HID_REPORT_TIMEOUT_MS));
+    }
+    if (!tud_hid_n_keyboard_report(0, 0, modifier, keys)) {
+        return false;
+    }
+    metrics_inc(METRIC_HID_REPORTS_SENT);
+    int64_t request_us = s_first_key_request_us;
+    if (request_us != 0 && keys[0] != 0) {
+        s_first_key_request_us = 0;
+        s_first_key_latency_us = esp_timer_get_time() - request_us;
+        ESP_LOGI(TAG, "First keystroke %lu ms after the request", (unsigned long)(s_first_key_latency_us / 1000));
+    }
+    return true;
+}
+
+/* Disarmed in persistent mode: the host is still attached, so let go of held keys */
+static void hid_force_release(void)
+{
+    static const uint8_t no_keys[USB_HID_ROLLOVER] = {0};
+    for (int tries = 0; tries < 5 && !tud_hid_n_ready(0); tries++) {
+        xSemaphoreTake(s_report_done, pdMS_TO_TICKS(USB_HID_REPORT_TIMEOUT_MS));
+    }
+    tud_hid_n_keyboard_report(0, 0, 0, no_keys);
+}
+
+/* Let go of all keys; the modifier stays selected for the keys that follow */
+static void hid_chord_release(hid_chord_t *chord)
+{
+    static const uint8_t no_keys[USB_HID_ROLLOVER] = {0};
+    if (chord->pressed) {
+        hid_send_report(0, no_keys);
+    }
+    chord->count = 0;
+    chord->pressed = false;
+    memset(chord->keys, 0, sizeof(chord->keys));
+}
+
+/*
+ * Pause for a macro WAIT. Timed from when the host has taken the last report,
+ * not from when it was queued. Sleeps in whole ticks and only spins a tail of
+ * up to USB_HID_WAIT_SPIN_US; a longer remainder is rounded up to a tick, so
+ * the pause can run over by less than one tick but never hogs the CPU.
+ */
+static void hid_wait(uint32_t ms)
+{
+    while (!tud_hid_n_ready(0) && s_usb_enabled && tud_mounted()) {
+        xSemaphoreTake(s_report_done, pdMS_TO_TICKS(USB_HID_REPORT_TIMEOUT_MS));
+    }
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    int64_t deadline = esp_timer_get_time() + (int64_t)ms * 1000;
+    int64_t left;
+    while ((left = deadline - esp_timer_get_time()) > 0 && s_usb_enabled) {
+        if (left <= USB_HID_WAIT_SPIN_US) {
+            esp_rom_delay_us(left);
+            break;
+        }
+        TickType_t ticks = (left - USB_HID_WAIT_SPIN_US + tick_us - 1) / tick_us;
+        vTaskDelay(ticks > pdMS_TO_TICKS(100) ? pdMS_TO_TICKS(100) : ticks);
+    }
+}
+
+static bool hid_chord_holds(const hid_chord_t *chord, uint8_t keycode)
+{
+    for (int i = 0; i < chord->count; i++) {
+        if (chord->keys[i] == keycode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Execute one complete op other than REPEAT/END */
+static void hid_run_op(hid_chord_t *chord, const uint8_t *op)
+{
+    if (hid_op_is_mod(op[0])) {
+        hid_chord_release(chord);
+        chord->modifier = op[0] & ~HID_OP_MOD;
+        return;
+    }
+    if (op[0] == HID_OP_EXT) {
+        if (op[1] == HID_EXT_WAIT) {
+            hid_chord_release(chord);
+            hid_wait(op[2] | (op[3] << 8));
+        } else if (op[1] == HID_EXT_PRESS) {
+            hid_send_report(chord->modifier, chord->keys);
+            chord->pressed = true;
+        }
+        return;
+    }
+    // The compiler never asks for this, but a chord released early by a stall may differ
+    if (chord->count == USB_HID_ROLLOVER || hid_chord_holds(chord, op[0])) {
+        hid_chord_release(chord);
+    }
+    chord->keys[chord->count++] = op[0];
+    chord->pressed = true;
+    hid_send_report(chord->modifier, chord->keys);
+    metrics_inc(METRIC_HID_KEYS_PRESSED);
+}
+
+static size_t hid_op_length(const uint8_t *op)
+{
+    return op[0] == HID_OP_EXT ? hid_ext_length(op[1]) : 1;
+}
+
+/* Run a captured REPEAT body; nested REPEATs are run from the same buffer */
+static void hid_run_body(hid_chord_t *chord, const uint8_t *body, size_t len, int depth)
+{
+    size_t i = 0;
+    while (i < len && s_usb_enabled) {
+        const uint8_t *op = body + i;
+        size_t n = hid_op_length(op);
+        if (op[0] != HID_OP_EXT || op[1] != HID_EXT_REPEAT) {
+            hid_run_op(chord, op);
+            i += n;
+            continue;
+        }
+
+        // Find the matching END
+        size_t start = i + n;
+        size_t end = start;
+        for (int nest = 1; end < len; end += hid_op_length(body + end)) {
+            if (body[end] == HID_OP_EXT && body[end + 1] == HID_EXT_REPEAT) {
+                nest++;
+            } else if (body[end] == HID_OP_EXT && body[end + 1] == HID_EXT_END && --nest == 0) {
+                break;
+            }
+        }
+        uint16_t count = op[2] | (op[3] << 8);
+        for (uint16_t k = 0; k < count && depth < HID_PROGRAM_MAX_DEPTH && s_usb_enabled; k++) {
+            hid_run_body(chord, body + start, end - start, depth + 1);
+        }
+        i = end + 2;
+    }
+}
+
+static void hid_vm_reset(hid_vm_t *vm, hid_chord_t *chord)
+{
+    vm->have = 0;
+    vm->depth = 0;
+    vm->body_len = 0;
+    vm->overflow = false;
+    memset(chord, 0, sizeof(*chord));
+}
+
+/* Feed one program byte to the interpreter */
+static void hid_vm_feed(hid_vm_t *vm, hid_chord_t *chord, uint8_t byte)
+{
+    if (vm->have == 0) {
+        vm->need = byte == HID_OP_EXT ? 2 : 1;
+    }
+    vm->op[vm->have++] = byte;
+    if (vm->have == 2 && vm->op[0] == HID_OP_EXT) {
+        vm->need = hid_ext_length(byte);
+    }
+    if (vm->have < vm->need) {
+        return;
+    }
+    size_t n = vm->have;
+    vm->have = 0;
+
+    bool repeat = vm->op[0] == HID_OP_EXT && vm->op[1] == HID_EXT_REPEAT;
+    bool end = vm->op[0] == HID_OP_EXT && vm->op[1] == HID_EXT_END;
+    if (vm->depth == 0) {
+        if (repeat) {
+            vm->depth = 1;
+            vm->count = vm->op[2] | (vm->op[3] << 8);
+            vm->body_len = 0;
+            vm->overflow = false;
+        } else if (!end) {
+            hid_run_op(chord, vm->op);
+        }
+        return;
+    }
+
+    // Capturing a REPEAT body
+    if (repeat) {
+        vm->depth++;
+    } else if (end && --vm->depth == 0) {
+        if (vm->overflow) {
+            ESP_LOGW(TAG, "REPEAT body longer than %d bytes, skipped", HID_PROGRAM_MAX_LOOP);
+            return;
+        }
+        for (uint16_t k = 0; k < vm->count && s_usb_enabled; k++) {
+            hid_run_body(chord, vm->body, vm->body_len, 1);
+        }
+        return;
+    }
+    if (vm->body_len + n <= sizeof(vm->body)) {
+        memcpy(vm->body + vm->body_len, vm->op, n);
+        vm->body_len += n;
     } else {
-        // Handle some common symbols
-        switch (c) {
-            case '!': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_1; break;
-            case '@': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_2; break;
-            case '#': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_3; break;
-            case '$': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_4; break;
-            case '%': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_5; break;
-            case '^': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_6; break;
-            case '&': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_7; break;
-            case '*': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_8; break;
-            case '(': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_9; break;
-            case ')': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_0; break;
-            case '-': *keycode = HID_KEY_MINUS; break;
-            case '_': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_MINUS; break;
-            case '=': *keycode = HID_KEY_EQUAL; break;
-            case '+': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_EQUAL; break;
-            case '[': *keycode = HID_KEY_BRACKET_LEFT; break;
-            case '{': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_BRACKET_LEFT; break;
-            case ']': *keycode = HID_KEY_BRACKET_RIGHT; break;
-            case '}': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_BRACKET_RIGHT; break;
-            case '\\': *keycode = HID_KEY_BACKSLASH; break;
-            case '|': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_BACKSLASH; break;
-            case ';': *keycode = HID_KEY_SEMICOLON; break;
-            case ':': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_SEMICOLON; break;
-            case '\'': *keycode = HID_KEY_APOSTROPHE; break;
-            case '\"': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_APOSTROPHE; break;
-            case ',': *keycode = HID_KEY_COMMA; break;
-            case '<': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_COMMA; break;
-            case '.': *keycode = HID_KEY_PERIOD; break;
-            case '>': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_PERIOD; break;
-            case '/': *keycode = HID_KEY_SLASH; break;
-            case '?': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_SLASH; break;
-            case ' ': *keycode = HID_KEY_SPACE; break;
-            case '\n': *keycode = HID_KEY_ENTER; break;
-            case '\r': *keycode = HID_KEY_ENTER; break;
-            // Map ASCII control codes to Function Keys
-            case 0x01: *keycode = HID_KEY_F1; break;
-            case 0x02: *keycode = HID_KEY_F2; break;
-            case 0x03: *keycode = HID_KEY_F3; break;
-            case 0x04: *keycode = HID_KEY_F4; break;
-            case 0x05: *keycode = HID_KEY_F5; break;
-            case 0x06: *keycode = HID_KEY_F6; break;
-            case 0x07: *keycode = HID_KEY_F7; break;
-            case 0x18: *keycode = HID_KEY_F8; break; // 0x08 is BS
-            case 0x19: *keycode = HID_KEY_F9; break; // 0x09 is TAB
-            case 0x1A: *keycode = HID_KEY_F10; break; // 0x0A is LF (Enter)
-            case 0x0B: *keycode = HID_KEY_F11; break;
-            case 0x0C: *keycode = HID_KEY_F12; break;
-            default: break;
+        vm->overflow = true;
+    }
+}
+
+esp_err_t usb_hid_set_layout(const char *name)
+{
+    keymap_layout_t layout;
+    if (name == NULL || !keymap_layout_from_name(name, &layout)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_layout = layout;
+    s_keymap = keymap_get_table(layout);
+    s_layout_loaded = true;
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(USB_HID_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_u8(handle, USB_HID_NVS_LAYOUT_KEY, (uint8_t)layout);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
         }
+        nvs_close(handle);
     }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) saving keyboard layout", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Keyboard layout set to %s", name);
+    return ESP_OK;
+}
+
+const char *usb_hid_get_layout(void)
+{
+    return keymap_layout_name(s_layout);
 }
 
-void usb_hid_set_string(const char *string)
+static void usb_hid_load_layout(void)
 {
-    if (string) {
-        strncpy(s_usb_string, string, USB_STRING_MAX_LEN);
-        s_usb_string[USB_STRING_MAX_LEN] = '\0';
-        ESP_LOGI(TAG, "USB String set to: %s", s_usb_string);
+    if (s_layout_loaded) {
+        return;
+    }
+    nvs_handle_t handle;
+    uint8_t layout = KEYMAP_LAYOUT_US;
+    if (nvs_open(USB_HID_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u8(handle, USB_HID_NVS_LAYOUT_KEY, &layout);
+        nvs_close(handle);
+    }
+    if (layout >= KEYMAP_LAYOUT_MAX) {
+        layout = KEYMAP_LAYOUT_US;
     }
+    s_layout = (keymap_layout_t)layout;
+    s_keymap = keymap_get_table(s_layout);
+    s_layout_loaded = true;
+    ESP_LOGI(TAG, "Keyboard layout: %s", keymap_layout_name(s_layout));
+}
+
+static void usb_hid_refresh_preview(void)
+{
+    size_t len = payload_store_get_length();
+    if (len > USB_STRING_PREVIEW_LEN) {
+        len = USB_STRING_PREVIEW_LEN;
+    }
+    if (len == 0 || payload_store_read(0, s_usb_preview, len, payload_store_get_generation()) != ESP_OK) {
+        len = 0;
+    }
+    s_usb_preview[len] = '\0';
 }
 
 const char *usb_hid_get_string(void)
 {
-    return s_usb_string;
+    return s_usb_preview;
+}
+
+size_t usb_hid_get_string_length(void)
+{
+    return payload_store_get_length();
+}
+
+/*
+ * The string is compiled into a keystroke program while it is being saved and
+ * the program is stored right after it, so typing needs no translation. The
+ * save session holds the payload store lock, which also guards s_save_compiler.
+ */
+esp_err_t usb_hid_save_begin(size_t len, bool macros)
+{
+    usb_hid_load_layout();
+    esp_err_t err = payload_store_begin(len);
+    if (err == ESP_OK) {
+        s_usb_preview[0] = '\0';
+        s_save_error[0] = '\0';
+        hid_compiler_init(&s_save_compiler, s_keymap, macros);
+    }
+    return err;
+}
+
+/* Record a macro syntax error for usb_hid_get_save_error() */
+static esp_err_t usb_hid_check_macros(void)
+{
+    if (s_save_compiler.error == NULL) {
+        return ESP_OK;
+    }
+    snprintf(s_save_error, sizeof(s_save_error), "Macro error at byte %u: %s",
+             (unsigned)s_save_compiler.error_offset, s_save_compiler.error);
+    ESP_LOGW(TAG, "%s", s_save_error);
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t usb_hid_save_append(const char *data, size_t len)
+{
+    esp_err_t err = payload_store_write(data, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t program[HID_PROGRAM_OUT_SIZE(USB_HID_COMPILE_CHUNK)];
+    for (size_t pos = 0; pos < len; pos += USB_HID_COMPILE_CHUNK) {
+        size_t n = len - pos;
+        if (n > USB_HID_COMPILE_CHUNK) n = USB_HID_COMPILE_CHUNK;
+        size_t out = hid_compiler_feed(&s_save_compiler, (const uint8_t *)data + pos, n, program);
+        // A program that does not fit is dropped; the string is then translated while typing
+        payload_store_write_program(program, out);
+    }
+    return usb_hid_check_macros();
+}
+
+esp_err_t usb_hid_save_finish(void)
+{
+    uint8_t program[1];
+    size_t out = hid_compiler_finish(&s_save_compiler, program);
+    if (usb_hid_check_macros() != ESP_OK) {
+        payload_store_abort();
+        usb_hid_refresh_preview();
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (out > 0) {
+        payload_store_write_program(program, out);
+    }
+
+    s_unmapped = s_save_compiler.unmapped;
+    if (s_unmapped > 0) {
+        ESP_LOGW(TAG, "%u characters cannot be typed with layout %s (first: U+%04X)",
+                 (unsigned)s_unmapped, keymap_layout_name(s_layout),
+                 (unsigned)s_save_compiler.first_unmapped);
+    }
+
+    esp_err_t err = payload_store_finish(USB_HID_PROGRAM_TAG(s_layout, s_save_compiler.macros));
+    usb_hid_refresh_preview();
+    return err;
+}
+
+size_t usb_hid_get_unmapped_count(void)
+{
+    return s_unmapped;
+}
+
+const char *usb_hid_get_save_error(void)
+{
+    return s_save_error;
+}
+
+void usb_hid_save_abort(void)
+{
+    payload_store_abort();
 }
 
 esp_err_t usb_hid_save_string(const char *string)
 {
     if (string == NULL) return ESP_ERR_INVALID_ARG;
     
-    // Update internal state
-    usb_hid_set_string(string);
-    
-    // Save to NVS
+    size_t len = strlen(string);
+    esp_err_t err = usb_hid_save_begin(len, false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) saving USB string", esp_err_to_name(err));
+        return err;
+    }
+    err = usb_hid_save_append(string, len);
+    if (err != ESP_OK) {
+        usb_hid_save_abort();
+        return err;
+    }
+    return usb_hid_save_finish();
+}
+
+/* Move a string saved by older firmware from NVS into the payload store */
+static void usb_hid_migrate_nvs_string(void)
+{
     nvs_handle_t my_handle;
     esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle", esp_err_to_name(err));
-        return err;
+        return;
     }
     
-    err = nvs_set_str(my_handle, "usb_str", string);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%s) setting NVS string", esp_err_to_name(err));
-    } else {
-        err = nvs_commit(my_handle);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Error (%s) committing NVS", esp_err_to_name(err));
+    size_t required_size = 0;
+    err = nvs_get_str(my_handle, "usb_str", NULL, &required_size);
+    if (err == ESP_OK && required_size > 0) {
+        char *buffer = malloc(required_size);
+        if (buffer && nvs_get_str(my_handle, "usb_str", buffer, &required_size) == ESP_OK) {
+            ESP_LOGI(TAG, "Migrating USB String from NVS to flash store");
+            if (usb_hid_save_string(buffer) == ESP_OK) {
+                nvs_erase_key(my_handle, "usb_str");
+                nvs_commit(my_handle);
+            }
         }
+        free(buffer);
     }
     
     nvs_close(my_handle);
-    return err;
 }
 
 esp_err_t usb_hid_load_string(void)
 {
-    nvs_handle_t my_handle;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
+    // A migrated string is compiled for the saved layout
+    usb_hid_load_layout();
+
+    esp_err_t err = payload_store_init();
     if (err != ESP_OK) {
-        if (err != ESP_ERR_NVS_NOT_FOUND) {
-             ESP_LOGE(TAG, "Error (%s) opening NVS handle", esp_err_to_name(err));
-        }
+        ESP_LOGE(TAG, "Error (%s) opening USB payload store", esp_err_to_name(err));
         return err;
     }
     
-    char buffer[USB_STRING_MAX_LEN + 1];
-    size_t required_size = sizeof(buffer);
-    err = nvs_get_str(my_handle, "usb_str", buffer, &required_size);
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Loaded USB String from NVS: %s", buffer);
-        usb_hid_set_string(buffer);
-    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGI(TAG, "No USB String found in NVS");
-    } else {
-        ESP_LOGE(TAG, "Error (%s) reading NVS string", esp_err_to_name(err));
+    if (payload_store_get_length() == 0) {
+        usb_hid_migrate_nvs_string();
     }
     
-    nvs_close(my_handle);
-    return err;
+    usb_hid_refresh_preview();
+    if (payload_store_get_length() == 0) {
+        ESP_LOGI(TAG, "No USB String stored");
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Loaded USB String (%u bytes)", (unsigned)payload_store_get_length());
+    return ESP_OK;
 }
 
-static QueueHandle_t s_usb_hid_queue = NULL;
+/*
+ * Pending program bytes flow from the feed task to the typing task through a
+ * stream buffer: the feed task hands over whole chunks in one call and blocks
+ * while the buffer is full, the typing task drains it in batches. One writer,
+ * one reader.
+ */
+static StreamBufferHandle_t s_usb_hid_stream = NULL;
 
 static void usb_hid_task(void *arg)
 {
-    char c;
+    static hid_vm_t vm;     // Too big for the stack with the loop buffer
+    hid_chord_t chord = {0};
+    uint8_t batch[USB_HID_TYPE_BATCH];
     while (1) {
-        if (xQueueReceive(s_usb_hid_queue, &c, portMAX_DELAY)) {
-            if (s_usb_enabled && tud_mounted()) {
-                uint8_t modifier = 0;
-                uint8_t keycode = 0;
-                char_to_hid(c, &modifier, &keycode);
-                if (keycode != 0) {
-                    send_key(modifier, keycode);
+        // Block only while no key is held; otherwise let go as soon as input runs dry
+        size_t n = xStreamBufferReceive(s_usb_hid_stream, batch, sizeof(batch),
+                                        chord.pressed ? 0 : portMAX_DELAY);
+        if (n == 0) {
+            hid_chord_release(&chord);
+            continue;
+        }
+        if (s_hid_reset) {
+            // The last run stopped mid-program; this batch starts a new one
+            s_hid_reset = false;
+            hid_chord_release(&chord);
+            hid_vm_reset(&vm, &chord);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!s_usb_enabled || !tud_mounted()) {
+                // Not connected: drop the input so nothing stale is typed later
+                if (chord.pressed && tud_mounted()) {
+                    hid_force_release();
                 }
-            } else {
-                // Drain queue if not connected to avoid stale data when re-connecting
-                // But maybe user wants it to type when connected?
-                // Let's just consume it.
+                hid_vm_reset(&vm, &chord);
+                break;
             }
+            hid_vm_feed(&vm, &chord, batch[i]);
         }
     }
 }
 
+/* Hand the stored program to the typing task. Returns false if it was cut short. */
+static bool usb_hid_feed_program(uint32_t generation)
+{
+    uint8_t chunk[USB_HID_FEED_CHUNK];
+    size_t len = payload_store_get_program_length();
+    for (size_t pos = 0; pos < len && s_usb_enabled; ) {
+        size_t n = len - pos;
+        if (n > sizeof(chunk)) n = sizeof(chunk);
+        if (payload_store_read_program(pos, chunk, n, generation) != ESP_OK) {
+            return false;
+        }
+        xStreamBufferSend(s_usb_hid_stream, chunk, n, portMAX_DELAY);
+        pos += n;
+    }
+    return s_usb_enabled;
+}
+
+static hid_compiler_t s_feed_compiler;  // Only used by the feed task
+
+/* Compile a piece of text and hand the result to the typing task */
+static void usb_hid_feed_compile(const char *text, size_t len)
+{
+    uint8_t program[HID_PROGRAM_OUT_SIZE(USB_HID_COMPILE_CHUNK)];
+    for (size_t i = 0; i < len; i += USB_HID_COMPILE_CHUNK) {
+        size_t m = len - i;
+        if (m > USB_HID_COMPILE_CHUNK) m = USB_HID_COMPILE_CHUNK;
+        size_t out = hid_compiler_feed(&s_feed_compiler, (const uint8_t *)text + i, m, program);
+        xStreamBufferSend(s_usb_hid_stream, program, out, portMAX_DELAY);
+    }
+}
+
+static void usb_hid_feed_finish(void)
+{
+    uint8_t program[1];
+    size_t out = hid_compiler_finish(&s_feed_compiler, program);
+    xStreamBufferSend(s_usb_hid_stream, program, out, portMAX_DELAY);
+}
+
+/* Compile the stored text on the way, for strings saved without a usable program */
+static bool usb_hid_feed_text(uint32_t generation, bool macros)
+{
+    char chunk[USB_HID_FEED_CHUNK];
+
+    hid_compiler_init(&s_feed_compiler, s_keymap, macros);
+    size_t len = payload_store_get_length();
+    for (size_t pos = 0; pos < len && s_usb_enabled; ) {
+        size_t n = len - pos;
+        if (n > sizeof(chunk)) n = sizeof(chunk);
+        if (payload_store_read(pos, chunk, n, generation) != ESP_OK) {
+            return false;
+        }
+        usb_hid_feed_compile(chunk, n);
+        pos += n;
+    }
+    if (!s_usb_enabled) {
+        return false;
+    }
+    usb_hid_feed_finish();
+    return true;
+}
+
+static bool usb_hid_feed_payload(void)
+{
+    uint32_t generation = payload_store_get_generation();
+    uint32_t tag = payload_store_get_program_tag();
+    bool macros = (tag & USB_HID_TAG_MACROS) != 0;
+    bool compiled = payload_store_get_program_length() > 0 &&
+                    tag == USB_HID_PROGRAM_TAG(s_layout, macros);
+    return compiled ? usb_hid_feed_program(generation) : usb_hid_feed_text(generation, macros);
+}
+
+/*
+ * Type the shared clipboard. Snapshots are immutable and reference counted, so
+ * the content is compiled straight from the snapshot in small pieces: nothing is
+ * copied and the clipboard stays free to change while the host is typing.
+ */
+static bool usb_hid_feed_clipboard(void)
+{
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) {
+        return true;
+    }
+    if (strncmp(snap->content_type, "text/", 5) != 0) {
+        ESP_LOGW(TAG, "Clipboard holds %s, not typing it", snap->content_type);
+        clipboard_service_release(snap);
+        return true;
+    }
+
+    ESP_LOGI(TAG, "Typing clipboard version %lu (%u bytes)", (unsigned long)snap->version, (unsigned)snap->len);
+    hid_compiler_init(&s_feed_compiler, s_keymap, false);
+    for (size_t pos = 0; pos < snap->len && s_usb_enabled; pos += USB_HID_FEED_CHUNK) {
+        size_t n = snap->len - pos;
+        if (n > USB_HID_FEED_CHUNK) n = USB_HID_FEED_CHUNK;
+        usb_hid_feed_compile(snap->content + pos, n);
+    }
+    bool done = s_usb_enabled;
+    if (done) {
+        usb_hid_feed_finish();
+    }
+    clipboard_service_release(snap);
+    return done;
+}
+
+/* In on-demand mode the host is still enumerating right after arming: wait for it */
+static bool usb_hid_wait_mounted(void)
+{
+    int64_t start = esp_timer_get_time();
+    while (!tud_mounted()) {
+        if (!s_usb_enabled || esp_timer_get_time() - start > USB_HID_MOUNT_TIMEOUT_MS * 1000LL) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    int64_t waited = esp_timer_get_time() - start;
+    if (waited > 0) {
+        ESP_LOGI(TAG, "Waited %lu ms for the host to enumerate", (unsigned long)(waited / 1000));
+    }
+    return true;
+}
+
+/* Streams the requested text to the typing task.
+ * Blocks on a full stream buffer instead of dropping characters. */
+static void usb_hid_feed_task(void *arg)
+{
+    while (1) {
+        uint32_t sources = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &sources, portMAX_DELAY);
+
+        if (!usb_hid_wait_mounted()) {
+            ESP_LOGW(TAG, "Host did not enumerate the keyboard, nothing typed");
+            s_first_key_request_us = 0;
+            continue;
+        }
+
+        bool done = true;
+        if (sources & USB_HID_FEED_PAYLOAD) {
+            done = usb_hid_feed_payload();
+        }
+        if (done && (sources & USB_HID_FEED_CLIPBOARD)) {
+            done = usb_hid_feed_clipboard();
+        }
+        if (!done) {
+            ESP_LOGW(TAG, "Text changed or USB disabled while typing, stopped");
+            // The typing task may be left mid-op: once it has taken everything, have it start over
+            while (!xStreamBufferIsEmpty(s_usb_hid_stream)) {
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+            s_hid_reset = true;
+        }
+    }
+}
+
+/* In persistent mode the device enumerates at boot and stays attached */
+static void usb_hid_load_mode(void)
+{
+    nvs_handle_t handle;
+    uint8_t persistent = 0;
+    if (nvs_open(USB_HID_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u8(handle, USB_HID_NVS_PERSISTENT_KEY, &persistent);
+        nvs_close(handle);
+    }
+    if (persistent) {
+        xSemaphoreTake(s_usb_mode_lock, portMAX_DELAY);
+        s_usb_persistent = true;
+        usb_hid_install();
+        xSemaphoreGive(s_usb_mode_lock);
+    }
+    ESP_LOGI(TAG, "USB mode: %s", persistent ? "persistent" : "on demand");
+}
+
 void usb_hid_init(void)
 {
-    if (s_usb_hid_queue == NULL) {
-        s_usb_hid_queue = xQueueCreate(1024, sizeof(char)); // Buffer for ~1000 chars
-        if (s_usb_hid_queue) {
+    if (s_usb_hid_stream == NULL) {
+        usb_hid_load_layout();
+        s_usb_mode_lock = xSemaphoreCreateMutex();
+        s_usb_hid_stream = xStreamBufferCreate(USB_HID_STREAM_SIZE, 1);
+        s_report_done = xSemaphoreCreateBinary();
+        if (s_usb_hid_stream && s_report_done) {
             xTaskCreate(usb_hid_task, "usb_hid", 4096, NULL, 5, NULL);
+            xTaskCreate(usb_hid_feed_task, "usb_hid_feed", 3072, NULL, 5, &s_usb_feed_task);
             ESP_LOGI(TAG, "USB HID Task started");
         }
+        usb_cdc_init();
+        usb_msc_init();
+        usb_hid_sync_init();
+        usb_hid_load_mode();
     }
 }
 
@@ -347,24 +1067,30 @@ void usb_hid_send_string(void)
         return;
     }
     
-    if (s_usb_hid_queue == NULL) {
-        ESP_LOGE(TAG, "USB HID queue not initialized");
+    if (s_usb_feed_task == NULL) {
+        ESP_LOGE(TAG, "USB HID typing task not initialized");
         return;
     }
 
-    ESP_LOGI(TAG, "Queueing string: %s", s_usb_string);
-    
-    const char *p = s_usb_string;
-    if (strlen(p) == 0) {
+    if (payload_store_get_length() == 0) {
         ESP_LOGW(TAG, "String is empty");
         return;
     }
     
-    while (*p) {
-        if (xQueueSend(s_usb_hid_queue, p, 0) != pdTRUE) {
-            ESP_LOGW(TAG, "USB HID Queue full, dropped char: %c", *p);
-        }
-        p++;
-    }
+    ESP_LOGI(TAG, "Queueing string (%u bytes)", (unsigned)payload_store_get_length());
+    s_first_key_request_us = esp_timer_get_time();
+    xTaskNotify(s_usb_feed_task, USB_HID_FEED_PAYLOAD, eSetBits);
 }
 
+esp_err_t usb_hid_type_clipboard(void)
+{
+    if (!s_usb_enabled || s_usb_feed_task == NULL) {
+        ESP_LOGW(TAG, "USB not enabled, cannot type clipboard");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(TAG, "Queueing shared clipboard");
+    s_first_key_request_us = esp_timer_get_time();
+    xTaskNotify(s_usb_feed_task, USB_HID_FEED_CLIPBOARD, eSetBits);
+    return ESP_OK;
+}
@@ -0,0 +1,208 @@
+/*
+ * Vendor HID clipboard channel
+ * Same protocol as the CDC port, over HID reports: output reports are
+ * unpacked into a stream buffer by the TinyUSB callback, the task feeds it to
+ * the clip_sync session and packs replies into input reports.
+ */
+#include "usb_hid_sync.h"
+
+#if USB_HID_SYNC_ENABLED
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "esp_log.h"
+#include "tinyusb.h"
+#include "class/hid/hid_device.h"
+#include "clip_sync.h"
+#include "clipboard_service.h"
+
+static const char *TAG = "usb_hid_sync";
+
+#define USB_HID_SYNC_DATA_LEN    (USB_HID_SYNC_REPORT_SIZE - 1)
+#define USB_HID_SYNC_RX_SIZE     (CLIP_SYNC_HEADER_LEN + CLIP_SYNC_MAX_PAYLOAD + 256)
+#define USB_HID_SYNC_TIMEOUT_MS  100    // Give up on a report the host does not poll
+
+// Task notification bits
+#define USB_HID_SYNC_EVT_RX      (1 << 0)
+#define USB_HID_SYNC_EVT_CHANGED (1 << 1)
+#define USB_HID_SYNC_EVT_RESET   (1 << 2)
+
+static TaskHandle_t s_sync_task = NULL;
+static StreamBufferHandle_t s_sync_rx = NULL;
+static SemaphoreHandle_t s_sync_report_done = NULL;
+static SemaphoreHandle_t s_sync_lock = NULL;    // Held by the task while it uses the interface
+static volatile bool s_sync_started = false;
+static clip_sync_session_t s_session;           // Only used by the sync task
+static uint8_t s_tx[USB_HID_SYNC_REPORT_SIZE];  // Input report being filled
+static bool s_tx_failed = false;                // Host stopped polling; drop the rest of the reply
+
+static void usb_hid_sync_flush(void)
+{
+    if (s_tx[0] == 0) {
+        return;
+    }
+    if (!s_sync_started) {
+        s_tx_failed = true;     // Being stopped: do not start another report
+    }
+    if (!s_tx_failed) {
+        TickType_t start = xTaskGetTickCount();
+        while (!tud_hid_n_ready(USB_HID_SYNC_INSTANCE)) {
+            if (!s_sync_started || !tud_mounted() ||
+                xTaskGetTickCount() - start > pdMS_TO_TICKS(USB_HID_SYNC_TIMEOUT_MS)) {
+                s_tx_failed = true;
+                break;
+            }
+            vTaskDelay(1);
+        }
+    }
+    if (!s_tx_failed) {
+        xSemaphoreTake(s_sync_report_done, 0);
+        if (!tud_hid_n_report(USB_HID_SYNC_INSTANCE, 0, s_tx, sizeof(s_tx)) ||
+            xSemaphoreTake(s_sync_report_done, pdMS_TO_TICKS(USB_HID_SYNC_TIMEOUT_MS)) != pdTRUE) {
+            s_tx_failed = true;
+        }
+    }
+    if (s_tx_failed) {
+        ESP_LOGW(TAG, "Host not reading, reply dropped");
+    }
+    memset(s_tx, 0, sizeof(s_tx));
+}
+
+static void usb_hid_sync_send(const uint8_t *data, size_t len, void *arg)
+{
+    (void) arg;
+    while (len > 0) {
+        size_t n = USB_HID_SYNC_DATA_LEN - s_tx[0];
+        if (n > len) n = len;
+        memcpy(s_tx + 1 + s_tx[0], data, n);
+        s_tx[0] += n;
+        data += n;
+        len -= n;
+        if (s_tx[0] == USB_HID_SYNC_DATA_LEN) {
+            usb_hid_sync_flush();
+        }
+    }
+}
+
+static void usb_hid_sync_clipboard_changed(uint32_t version, void *arg)
+{
+    (void) version;
+    (void) arg;
+    xTaskNotify(s_sync_task, USB_HID_SYNC_EVT_CHANGED, eSetBits);
+}
+
+static void usb_hid_sync_task(void *arg)
+{
+    uint8_t buf[128];
+    clip_sync_session_init(&s_session, usb_hid_sync_send, NULL);
+    while (1) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+        xSemaphoreTake(s_sync_lock, portMAX_DELAY);
+        if (!s_sync_started) {
+            xSemaphoreGive(s_sync_lock);
+            continue;
+        }
+        s_tx_failed = false;
+        if (events & USB_HID_SYNC_EVT_RESET) {
+            clip_sync_session_init(&s_session, usb_hid_sync_send, NULL);
+        }
+        if (events & USB_HID_SYNC_EVT_RX) {
+            size_t n;
+            while ((n = xStreamBufferReceive(s_sync_rx, buf, sizeof(buf), 0)) > 0) {
+                clip_sync_feed(&s_session, buf, n);
+            }
+        }
+        if (events & USB_HID_SYNC_EVT_CHANGED) {
+            clip_sync_poll(&s_session);
+        }
+        usb_hid_sync_flush();
+        xSemaphoreGive(s_sync_lock);
+    }
+}
+
+void usb_hid_sync_receive(const uint8_t *report, uint16_t len)
+{
+    if (s_sync_rx == NULL || len < 1) {
+        return;
+    }
+    size_t n = report[0];
+    if (n > len - 1 || n > USB_HID_SYNC_DATA_LEN) {
+        return;     // Not one of ours
+    }
+    // The callback must not block; the host waits for each reply, so this only overflows on misuse
+    if (xStreamBufferSend(s_sync_rx, report + 1, n, 0) != n) {
+        ESP_LOGW(TAG, "Receive buffer full");
+    }
+    xTaskNotify(s_sync_task, USB_HID_SYNC_EVT_RX, eSetBits);
+}
+
+void usb_hid_sync_report_done(void)
+{
+    xSemaphoreGive(s_sync_report_done);
+}
+
+void usb_hid_sync_init(void)
+{
+    if (s_sync_task == NULL) {
+        s_sync_rx = xStreamBufferCreate(USB_HID_SYNC_RX_SIZE, 1);
+        s_sync_report_done = xSemaphoreCreateBinary();
+        s_sync_lock = xSemaphoreCreateMutex();
+        if (s_sync_rx == NULL || s_sync_report_done == NULL || s_sync_lock == NULL) {
+            ESP_LOGE(TAG, "Failed to create buffers");
+            return;
+        }
+        xTaskCreate(usb_hid_sync_task, "usb_hid_sync", 4096, NULL, 5, &s_sync_task);
+        clipboard_service_add_listener(usb_hid_sync_clipboard_changed, NULL);
+    }
+}
+
+esp_err_t usb_hid_sync_start(void)
+{
+    if (s_sync_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xStreamBufferReset(s_sync_rx);
+    s_sync_started = true;
+    xTaskNotify(s_sync_task, USB_HID_SYNC_EVT_RESET, eSetBits);
+    ESP_LOGI(TAG, "HID clipboard channel started");
+    return ESP_OK;
+}
+
+void usb_hid_sync_stop(void)
+{
+    if (s_sync_started) {
+        // Cuts a pending reply short (at most one USB_HID_SYNC_TIMEOUT_MS report), then wait for the task
+        s_sync_started = false;
+        xSemaphoreTake(s_sync_lock, portMAX_DELAY);
+        xSemaphoreGive(s_sync_lock);
+    }
+}
+
+#else
+
+void usb_hid_sync_init(void)
+{
+}
+
+esp_err_t usb_hid_sync_start(void)
+{
+    return ESP_OK;
+}
+
+void usb_hid_sync_stop(void)
+{
+}
+
+void usb_hid_sync_receive(const uint8_t *report, uint16_t len)
+{
+}
+
+void usb_hid_sync_report_done(void)
+{
+}
+
+#endif // USB_HID_SYNC_ENABLED
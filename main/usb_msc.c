@@ -0,0 +1,556 @@
+/*
+ * USB mass-storage view of the clipboard
+ * A synthetic FAT12 volume that exists only as a function of the clipboard
+ * snapshots: every sector is rendered when the host reads it. Sectors the host
+ * writes are kept in a small overlay so its view stays consistent; once the
+ * writes settle, clipboard.txt is read back through the host's FAT and
+ * directory and, if it changed, becomes the new clipboard. Any clipboard
+ * change drops the overlay and is reported to the host as a media change.
+ */
+#include "usb_msc.h"
+#include "sdkconfig.h"
+
+#if CONFIG_TINYUSB_MSC_ENABLED
+
+#include <string.h>
+#include <stdio.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "tinyusb.h"
+#include "clipboard_service.h"
+
+/*
+ * The tud_msc_* callbacks are implemented here rather than through
+ * esp_tinyusb's storage wrapper (tinyusb_msc_*), which is never referenced
+ * and so not linked.
+ */
+
+static const char *TAG = "usb_msc";
+
+// Volume layout: boot sector, two one-sector FATs, root directory, data (one sector per cluster)
+#define MSC_SECTOR_SIZE   512
+#define MSC_NUM_FATS      2
+#define MSC_FAT_LBA       1
+#define MSC_ROOT_LBA      (MSC_FAT_LBA + MSC_NUM_FATS)
+#define MSC_ROOT_ENTRIES  32
+#define MSC_ENTRY_SIZE    32
+#define MSC_ROOT_SECTORS  (MSC_ROOT_ENTRIES * MSC_ENTRY_SIZE / MSC_SECTOR_SIZE)
+#define MSC_DATA_LBA      (MSC_ROOT_LBA + MSC_ROOT_SECTORS)
+#define MSC_CLUSTERS      (USB_MSC_SECTORS - MSC_DATA_LBA)
+#define MSC_FAT_EOC       0xFFF
+#define MSC_FAT_DATE      (((2025 - 1980) << 9) | (1 << 5) | 1)  // No clock: 2025-01-01
+
+// clipboard.txt, then history-1.txt ... each at a fixed run of clusters
+#define MSC_FILE_COUNT    (1 + CLIPBOARD_HISTORY_LEN)
+#define MSC_SLOT_CLUSTERS ((SHARED_CLIPBOARD_MAX_LEN + MSC_SECTOR_SIZE - 1) / MSC_SECTOR_SIZE)
+#define MSC_CLIPBOARD_NAME "clipboard.txt"
+#define MSC_LFN_CHARS     13
+
+_Static_assert(MSC_FILE_COUNT * MSC_SLOT_CLUSTERS <= MSC_CLUSTERS, "USB_MSC_SECTORS too small");
+_Static_assert((MSC_CLUSTERS + 2) * 3 / 2 <= MSC_SECTOR_SIZE, "FAT must fit in one sector");
+_Static_assert(1 + 2 * MSC_FILE_COUNT <= MSC_ROOT_ENTRIES, "Root directory too small");
+_Static_assert(CLIPBOARD_HISTORY_LEN <= 9, "History names are history-N.txt");
+
+// Byte offsets of the 13 UCS-2 characters in a long file name entry
+static const uint8_t s_lfn_pos[MSC_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static SemaphoreHandle_t s_msc_mutex = NULL;    // Guards the view, the overlay and s_sector
+static TaskHandle_t s_msc_task = NULL;
+static const clipboard_snapshot_t *s_view[MSC_FILE_COUNT];  // What the host was last shown
+static volatile bool s_media_changed = false;
+static bool s_ejected = false;
+static uint32_t s_overlay_lba[USB_MSC_OVERLAY_SECTORS];
+static uint8_t s_overlay[USB_MSC_OVERLAY_SECTORS][MSC_SECTOR_SIZE];
+static size_t s_overlay_count = 0;
+static uint8_t s_sector[MSC_SECTOR_SIZE];
+static uint8_t s_fat[MSC_SECTOR_SIZE];          // FAT as the host sees it, for reading back
+static uint8_t s_file[SHARED_CLIPBOARD_MAX_LEN];
+
+/************* Volume rendering ****************/
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static void fat12_set(uint8_t *fat, unsigned cluster, uint16_t value)
+{
+    uint8_t *p = fat + cluster + cluster / 2;
+    if (cluster & 1) {
+        p[0] = (p[0] & 0x0f) | (value << 4);
+        p[1] = value >> 4;
+    } else {
+        p[0] = value;
+        p[1] = (p[1] & 0xf0) | ((value >> 8) & 0x0f);
+    }
+}
+
+static uint16_t fat12_get(const uint8_t *fat, unsigned cluster)
+{
+    uint16_t v = get16(fat + cluster + cluster / 2);
+    return (cluster & 1) ? v >> 4 : v & 0xfff;
+}
+
+static size_t file_size(size_t file)
+{
+    return s_view[file] ? s_view[file]->len : 0;
+}
+
+static unsigned file_cluster(size_t file)
+{
+    return 2 + file * MSC_SLOT_CLUSTERS;
+}
+
+static void short_name(size_t file, uint8_t sfn[11])
+{
+    char name[12];
+    if (file == 0) {
+        memcpy(name, "CLIPBO~1TXT", 11);
+    } else {
+        snprintf(name, sizeof(name), "HISTOR~%uTXT", (unsigned)file);
+    }
+    memcpy(sfn, name, 11);
+}
+
+static uint8_t lfn_checksum(const uint8_t sfn[11])
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + sfn[i];
+    }
+    return sum;
+}
+
+static void render_boot(uint8_t *buf)
+{
+    buf[0] = 0xEB;
+    buf[1] = 0x3C;
+    buf[2] = 0x90;
+    memcpy(buf + 3, "MSDOS5.0", 8);
+    put16(buf + 11, MSC_SECTOR_SIZE);
+    buf[13] = 1;                                // Sectors per cluster
+    put16(buf + 14, MSC_FAT_LBA);               // Reserved sectors
+    buf[16] = MSC_NUM_FATS;
+    put16(buf + 17, MSC_ROOT_ENTRIES);
+    put16(buf + 19, USB_MSC_SECTORS);
+    buf[21] = 0xF8;                             // Media descriptor: fixed disk
+    put16(buf + 22, 1);                         // Sectors per FAT
+    put16(buf + 24, 1);                         // Sectors per track
+    put16(buf + 26, 1);                         // Heads
+    buf[36] = 0x80;                             // Drive number
+    buf[38] = 0x29;                             // Extended boot signature
+    put32(buf + 39, 0x434c4950);                // Volume serial
+    memcpy(buf + 43, "CLIPBOARD  ", 11);
+    memcpy(buf + 54, "FAT12   ", 8);
+    buf[510] = 0x55;
+    buf[511] = 0xAA;
+}
+
+static void render_fat(uint8_t *buf)
+{
+    fat12_set(buf, 0, 0xFF8);
+    fat12_set(buf, 1, MSC_FAT_EOC);
+    for (size_t file = 0; file < MSC_FILE_COUNT; file++) {
+        unsigned first = file_cluster(file);
+        unsigned n = (file_size(file) + MSC_SECTOR_SIZE - 1) / MSC_SECTOR_SIZE;
+        for (unsigned i = 0; i < n; i++) {
+            fat12_set(buf, first + i, i + 1 < n ? first + i + 1 : MSC_FAT_EOC);
+        }
+    }
+}
+
+/* Entry 0 is the volume label, then a long name entry and a short entry per file */
+static void render_entry(uint8_t *e, size_t index)
+{
+    if (index == 0) {
+        memcpy(e, "CLIPBOARD  ", 11);
+        e[11] = 0x08;
+        put16(e + 24, MSC_FAT_DATE);
+        return;
+    }
+    size_t file = (index - 1) / 2;
+    // History is filled newest first, so the files present are contiguous
+    if (file >= MSC_FILE_COUNT || (file > 0 && s_view[file] == NULL)) {
+        return;     // Zeroed entry ends the directory
+    }
+    uint8_t sfn[11];
+    short_name(file, sfn);
+
+    if ((index - 1) % 2 == 0) {
+        char name[MSC_LFN_CHARS + 1];
+        if (file == 0) {
+            strcpy(name, MSC_CLIPBOARD_NAME);
+        } else {
+            snprintf(name, sizeof(name), "history-%u.txt", (unsigned)file);
+        }
+        size_t len = strlen(name);
+        e[0] = 0x41;                            // Sequence 1, last long name entry
+        e[11] = 0x0F;
+        e[13] = lfn_checksum(sfn);
+        for (size_t i = 0; i < MSC_LFN_CHARS; i++) {
+            put16(e + s_lfn_pos[i], i < len ? (uint8_t)name[i] : (i == len ? 0x0000 : 0xFFFF));
+        }
+    } else {
+        memcpy(e, sfn, 11);
+        e[11] = file == 0 ? 0x20 : 0x21;        // Archive; history is read-only
+        put16(e + 16, MSC_FAT_DATE);
+        put16(e + 18, MSC_FAT_DATE);
+        put16(e + 24, MSC_FAT_DATE);
+        size_t size = file_size(file);
+        if (size > 0) {
+            put16(e + 26, file_cluster(file));
+        }
+        put32(e + 28, size);
+    }
+}
+
+static void render_data(uint32_t lba, uint8_t *buf)
+{
+    unsigned index = lba - MSC_DATA_LBA;
+    size_t file = index / MSC_SLOT_CLUSTERS;
+    if (file >= MSC_FILE_COUNT || s_view[file] == NULL) {
+        return;
+    }
+    size_t offset = (index % MSC_SLOT_CLUSTERS) * MSC_SECTOR_SIZE;
+    if (offset < s_view[file]->len) {
+        size_t n = s_view[file]->len - offset;
+        memcpy(buf, s_view[file]->content + offset, n < MSC_SECTOR_SIZE ? n : MSC_SECTOR_SIZE);
+    }
+}
+
+/* Must be called with s_msc_mutex held */
+static void read_sector(uint32_t lba, uint8_t *buf)
+{
+    for (size_t i = 0; i < s_overlay_count; i++) {
+        if (s_overlay_lba[i] == lba) {
+            memcpy(buf, s_overlay[i], MSC_SECTOR_SIZE);
+            return;
+        }
+    }
+
+    memset(buf, 0, MSC_SECTOR_SIZE);
+    if (lba == 0) {
+        render_boot(buf);
+    } else if (lba < MSC_ROOT_LBA) {
+        render_fat(buf);
+    } else if (lba < MSC_DATA_LBA) {
+        size_t first = (lba - MSC_ROOT_LBA) * (MSC_SECTOR_SIZE / MSC_ENTRY_SIZE);
+        for (size_t i = 0; i < MSC_SECTOR_SIZE / MSC_ENTRY_SIZE; i++) {
+            render_entry(buf + i * MSC_ENTRY_SIZE, first + i);
+        }
+    } else {
+        render_data(lba, buf);
+    }
+}
+
+/* Must be called with s_msc_mutex held */
+static bool write_sector(uint32_t lba, const uint8_t *buf)
+{
+    size_t i = 0;
+    while (i < s_overlay_count && s_overlay_lba[i] != lba) {
+        i++;
+    }
+    if (i == USB_MSC_OVERLAY_SECTORS) {
+        return false;
+    }
+    if (i == s_overlay_count) {
+        s_overlay_lba[i] = lba;
+        s_overlay_count++;
+    }
+    memcpy(s_overlay[i], buf, MSC_SECTOR_SIZE);
+    return true;
+}
+
+/* Must be called with s_msc_mutex held */
+static void view_refresh(void)
+{
+    for (size_t i = 0; i < MSC_FILE_COUNT; i++) {
+        clipboard_service_release(s_view[i]);
+        s_view[i] = clipboard_service_acquire_history(i);
+    }
+    s_overlay_count = 0;
+}
+
+/************* Reading clipboard.txt back ****************/
+
+/* Find clipboard.txt in the directory as the host last wrote it. Must be called with s_msc_mutex held. */
+static bool find_clipboard_file(unsigned *cluster, size_t *size)
+{
+    char lfn[2 * MSC_LFN_CHARS + 1] = {0};
+    bool have_lfn = false;
+    for (size_t sector = 0; sector < MSC_ROOT_SECTORS; sector++) {
+        read_sector(MSC_ROOT_LBA + sector, s_sector);
+        for (size_t j = 0; j < MSC_SECTOR_SIZE / MSC_ENTRY_SIZE; j++) {
+            const uint8_t *e = s_sector + j * MSC_ENTRY_SIZE;
+            if (e[0] == 0x00) {
+                return false;
+            }
+            if (e[0] == 0xE5) {
+                have_lfn = false;
+                continue;
+            }
+            if (e[11] == 0x0F) {
+                if (e[0] & 0x40) {
+                    memset(lfn, 0, sizeof(lfn));
+                }
+                size_t base = ((e[0] & 0x1f) - 1) * MSC_LFN_CHARS;
+                for (size_t i = 0; i < MSC_LFN_CHARS && base + i < sizeof(lfn) - 1; i++) {
+                    uint16_t ch = get16(e + s_lfn_pos[i]);
+                    lfn[base + i] = (ch == 0xFFFF) ? '\0' : (ch < 0x80 ? ch : '?');
+                }
+                have_lfn = true;
+                continue;
+            }
+            bool match = have_lfn ? strcasecmp(lfn, MSC_CLIPBOARD_NAME) == 0
+                                  : memcmp(e, "CLIPBO~1TXT", 11) == 0;
+            have_lfn = false;
+            if (match && !(e[11] & 0x18)) {
+                *cluster = get16(e + 26);
+                *size = get32(e + 28);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void usb_msc_apply_host_write(void)
+{
+    unsigned cluster = 0;
+    size_t size = 0;
+    bool changed = false;
+
+    xSemaphoreTake(s_msc_mutex, portMAX_DELAY);
+    if (!find_clipboard_file(&cluster, &size)) {
+        xSemaphoreGive(s_msc_mutex);
+        return;
+    }
+    if (size > SHARED_CLIPBOARD_MAX_LEN) {
+        xSemaphoreGive(s_msc_mutex);
+        ESP_LOGW(TAG, "clipboard.txt is %u bytes, limit is %d", (unsigned)size, SHARED_CLIPBOARD_MAX_LEN);
+        return;
+    }
+    read_sector(MSC_FAT_LBA, s_fat);
+    for (size_t pos = 0; pos < size; pos += MSC_SECTOR_SIZE) {
+        if (cluster < 2 || cluster >= 2 + MSC_CLUSTERS) {
+            xSemaphoreGive(s_msc_mutex);
+            ESP_LOGW(TAG, "clipboard.txt has a broken cluster chain");
+            return;
+        }
+        read_sector(MSC_DATA_LBA + cluster - 2, s_sector);
+        size_t n = size - pos;
+        memcpy(s_file + pos, s_sector, n < MSC_SECTOR_SIZE ? n : MSC_SECTOR_SIZE);
+        cluster = fat12_get(s_fat, cluster);
+    }
+    // Compare with what the host was shown, not the live clipboard: a host that
+    // only touched the directory must not roll back a newer change made elsewhere
+    changed = s_view[0] == NULL || s_view[0]->len != size || memcmp(s_view[0]->content, s_file, size) != 0;
+    xSemaphoreGive(s_msc_mutex);
+
+    if (changed) {
+        uint32_t version = 0;
+        if (clipboard_service_set_bytes(s_file, size, NULL, &version) == ESP_OK) {
+            ESP_LOGI(TAG, "Clipboard set from clipboard.txt (version %lu)", (unsigned long)version);
+        }
+    }
+}
+
+static void usb_msc_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Data, FAT and directory arrive in any order: wait for the host to finish
+        while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(USB_MSC_WRITE_SETTLE_MS)) > 0) {
+        }
+        usb_msc_apply_host_write();
+    }
+}
+
+static void usb_msc_clipboard_changed(uint32_t version, void *arg)
+{
+    (void) version;
+    (void) arg;
+    s_media_changed = true;
+}
+
+/********* TinyUSB MSC callbacks ***************/
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4])
+{
+    (void) lun;
+    memcpy(vendor_id, "Clipkit ", 8);
+    memcpy(product_id, "Clipboard Drive ", 16);
+    memcpy(product_rev, "1.0 ", 4);
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun)
+{
+    if (s_ejected) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00);     // Medium not present
+        return false;
+    }
+    if (s_media_changed) {
+        // Show the new clipboard and make the host drop its cached FAT and directory
+        s_media_changed = false;
+        xSemaphoreTake(s_msc_mutex, portMAX_DELAY);
+        view_refresh();
+        xSemaphoreGive(s_msc_mutex);
+        tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00); // Medium may have changed
+        return false;
+    }
+    return true;
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
+{
+    (void) lun;
+    *block_count = USB_MSC_SECTORS;
+    *block_size = MSC_SECTOR_SIZE;
+}
+
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject)
+{
+    (void) lun;
+    (void) power_condition;
+    if (load_eject) {
+        s_ejected = !start;
+    }
+    return true;
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
+{
+    (void) lun;
+    uint8_t *out = buffer;
+    uint32_t done = 0;
+    xSemaphoreTake(s_msc_mutex, portMAX_DELAY);
+    while (done < bufsize) {
+        if (lba >= USB_MSC_SECTORS) {
+            xSemaphoreGive(s_msc_mutex);
+            return -1;
+        }
+        read_sector(lba, s_sector);
+        uint32_t n = MSC_SECTOR_SIZE - offset;
+        if (n > bufsize - done) n = bufsize - done;
+        memcpy(out + done, s_sector + offset, n);
+        done += n;
+        offset = 0;
+        lba++;
+    }
+    xSemaphoreGive(s_msc_mutex);
+    return done;
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
+{
+    uint32_t done = 0;
+    xSemaphoreTake(s_msc_mutex, portMAX_DELAY);
+    while (done < bufsize) {
+        if (lba >= USB_MSC_SECTORS) {
+            break;
+        }
+        uint32_t n = MSC_SECTOR_SIZE - offset;
+        if (n > bufsize - done) n = bufsize - done;
+        read_sector(lba, s_sector);
+        memcpy(s_sector + offset, buffer + done, n);
+        if (!write_sector(lba, s_sector)) {
+            ESP_LOGW(TAG, "Write overlay full, rejecting sector %lu", (unsigned long)lba);
+            break;
+        }
+        done += n;
+        offset = 0;
+        lba++;
+    }
+    xSemaphoreGive(s_msc_mutex);
+
+    if (done < bufsize) {
+        tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0C, 0x00);     // Write error
+        return -1;
+    }
+    xTaskNotifyGive(s_msc_task);
+    return done;
+}
+
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, uint16_t bufsize)
+{
+    (void) buffer;
+    (void) bufsize;
+    switch (scsi_cmd[0]) {
+    case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+        return 0;
+    default:
+        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);  // Invalid command
+        return -1;
+    }
+}
+
+/********* Application ***************/
+
+void usb_msc_init(void)
+{
+    if (s_msc_task == NULL) {
+        s_msc_mutex = xSemaphoreCreateMutex();
+        if (s_msc_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create mutex");
+            return;
+        }
+        xTaskCreate(usb_msc_task, "usb_msc", 3072, NULL, 5, &s_msc_task);
+        clipboard_service_add_listener(usb_msc_clipboard_changed, NULL);
+    }
+}
+
+esp_err_t usb_msc_start(void)
+{
+    if (s_msc_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_msc_mutex, portMAX_DELAY);
+    view_refresh();
+    xSemaphoreGive(s_msc_mutex);
+    s_media_changed = false;
+    s_ejected = false;
+    ESP_LOGI(TAG, "Clipboard drive started (%d sectors)", USB_MSC_SECTORS);
+    return ESP_OK;
+}
+
+void usb_msc_stop(void)
+{
+    // Nothing to tear down: the callbacks stop with the driver
+}
+
+#else
+
+void usb_msc_init(void)
+{
+}
+
+esp_err_t usb_msc_start(void)
+{
+    return ESP_OK;
+}
+
+void usb_msc_stop(void)
+{
+}
+
+#endif // CONFIG_TINYUSB_MSC_ENABLED
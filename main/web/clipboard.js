@@ -0,0 +1,344 @@
+function utf8ToString(base64) {
+  try {
+    var binary = atob(base64);
+    var bytes = new Uint8Array(binary.length);
+    for (var i = 0; i < binary.length; i++) {
+      bytes[i] = binary.charCodeAt(i);
+    }
+    var decoder = new TextDecoder('utf-8');
+    return decoder.decode(bytes);
+  } catch(e) {
+    console.log('Error:', e);
+    return '';
+  }
+}
+function stringToUtf8Base64(str) {
+  return window.btoa(unescape(encodeURIComponent(str)));
+}
+var ws = null;
+var shareButton = null;
+var statusIndicator = null;
+var pendingId = null;
+var updateSeq = 0;
+var events = null;
+var wsFailures = 0;
+var WS_MAX_FAILURES = 3;
+var pendingContent = null;
+var knownVersion = null;
+var stateDb = null;
+// Last known content and version are kept in IndexedDB, so the page can render
+// immediately and the device only sends content when it actually changed.
+function openStateDb(callback) {
+  if (!window.indexedDB) {
+    callback();
+    return;
+  }
+  var req;
+  try {
+    req = indexedDB.open('clipkit', 1);
+  } catch (e) {
+    callback();
+    return;
+  }
+  req.onupgradeneeded = function() {
+    req.result.createObjectStore('state');
+  };
+  req.onsuccess = function() {
+    stateDb = req.result;
+    callback();
+  };
+  req.onerror = function() {
+    callback();
+  };
+}
+function loadState(callback) {
+  if (!stateDb) {
+    callback(null);
+    return;
+  }
+  var req = stateDb.transaction('state', 'readonly').objectStore('state').get('clipboard');
+  req.onsuccess = function() { callback(req.result || null); };
+  req.onerror = function() { callback(null); };
+}
+function saveState(version, content) {
+  knownVersion = version;
+  if (!stateDb) return;
+  try {
+    stateDb.transaction('state', 'readwrite').objectStore('state').put({version: version, content: content}, 'clipboard');
+  } catch (e) {
+    console.log('Failed to save state:', e);
+  }
+}
+function nextUpdateId() {
+  updateSeq++;
+  return Date.now().toString(36) + '-' + updateSeq + '-' + Math.random().toString(36).slice(2, 8);
+}
+function connectWebSocket() {
+  updateStatus('Connecting...');
+  disableShareButton();
+  
+  var protocol = window.location.protocol === 'https:' ? 'wss:' : 'ws:';
+  var wsUrl = protocol + '//' + window.location.host + '/ws';
+  ws = new WebSocket(wsUrl);
+  
+  var opened = false;
+  ws.onopen = function() {
+    opened = true;
+    wsFailures = 0;
+    console.log('WebSocket connected');
+    updateStatus('Connected');
+    enableShareButton();
+    try {
+      var msg = {type: 'get_state'};
+      if (knownVersion !== null) msg.version = knownVersion;
+      ws.send(JSON.stringify(msg));
+    } catch (e) {
+      console.log('Send error:', e);
+      updateStatus('Send Error: ' + e.message);
+    }
+  };
+  
+  ws.onmessage = function(event) {
+    handleMessage(event.data);
+  };
+  
+  ws.onclose = function() {
+    pendingId = null;
+    disableShareButton();
+    if (!opened && ++wsFailures >= WS_MAX_FAILURES && window.EventSource) {
+      // WebSockets look blocked on this network: fall back to Server-Sent Events
+      console.log('WebSocket unavailable, using Server-Sent Events');
+      ws = null;
+      connectEvents();
+      return;
+    }
+    console.log('WebSocket disconnected, reconnecting...');
+    updateStatus('Disconnected - Reconnecting...');
+    setTimeout(connectWebSocket, 2000);
+  };
+  
+  ws.onerror = function(error) {
+    console.log('WebSocket error:', error);
+    updateStatus('Connection Error');
+  };
+}
+function handleMessage(data) {
+  try {
+    var msg = JSON.parse(data);
+    if (msg.type === 'ack') {
+      if (msg.id === pendingId) {
+        pendingId = null;
+        saveState(msg.version, pendingContent);
+        showDelivered(msg.version);
+      }
+    } else if (msg.type === 'update' && typeof msg.content === 'string') {
+      var content = utf8ToString(msg.content);
+      var textarea = document.getElementById('clipboardContent');
+      if (textarea.value !== content) {
+        textarea.value = content;
+      }
+      updateFileLink(content);
+      saveState(msg.version, content);
+    } else if (msg.type === 'current') {
+      // Cached content is up to date
+      knownVersion = msg.version;
+    } else if (msg.type === 'typing') {
+      updateStatus(msg.status === 'queued' ? 'Typing on USB host...' : 'USB keyboard is off (enable it on the device)');
+      setTimeout(function() {
+        if (!pendingId && isConnected()) updateStatus('Connected');
+      }, 2000);
+    }
+  } catch(e) {
+    console.log('Error processing message:', e);
+  }
+}
+function isConnected() {
+  return (ws && ws.readyState === WebSocket.OPEN) || (events && events.readyState === EventSource.OPEN);
+}
+function showDelivered(version) {
+  updateStatus('Delivered (v' + version + ')');
+  setTimeout(function() {
+    if (!pendingId && isConnected()) updateStatus('Connected');
+  }, 2000);
+}
+function connectEvents() {
+  updateStatus('Connecting...');
+  // EventSource reconnects by itself and resumes with Last-Event-ID
+  events = new EventSource(knownVersion !== null ? '/events?since=' + knownVersion : '/events');
+  events.onopen = function() {
+    console.log('Event stream connected');
+    updateStatus('Connected');
+    enableShareButton();
+  };
+  events.addEventListener('update', function(event) {
+    handleMessage(event.data);
+  });
+  events.onerror = function() {
+    updateStatus('Disconnected - Reconnecting...');
+    disableShareButton();
+  };
+}
+function sendUpdateHttp(content) {
+  var id = nextUpdateId();
+  pendingId = id;
+  pendingContent = content;
+  var x = new XMLHttpRequest();
+  x.open('PUT', '/api/clipboard', true);
+  x.setRequestHeader('Content-Type', 'text/plain; charset=utf-8');
+  x.onload = function() {
+    if (pendingId !== id) return;
+    pendingId = null;
+    if (x.status >= 200 && x.status < 300) {
+      var etag = x.getResponseHeader('ETag') || '';
+      var version = parseInt(etag.replace(/[^0-9]/g, ''), 10);
+      if (!isNaN(version)) saveState(version, content);
+      showDelivered(isNaN(version) ? '?' : version);
+    } else {
+      updateStatus('Send Error: ' + x.status);
+    }
+  };
+  x.onerror = function() {
+    pendingId = null;
+    updateStatus('Send Error');
+  };
+  x.send(content);
+  updateStatus('Sending...');
+}
+function updateStatus(message) {
+  var el = document.getElementById('statusIndicator');
+  if (el) {
+    el.textContent = message;
+    if (message === 'Connected') el.style.color = 'green';
+    else if (message.indexOf('Error') !== -1 || message.indexOf('Disconnected') !== -1) el.style.color = 'red';
+    else el.style.color = '#666';
+  }
+}
+function enableShareButton() {
+  if (shareButton) {
+    shareButton.disabled = false;
+  }
+}
+function disableShareButton() {
+  if (shareButton) {
+    shareButton.disabled = true;
+  }
+}
+function sendUpdate(event) {
+  if (ws && ws.readyState === WebSocket.OPEN) {
+    event.preventDefault();
+    var content = document.getElementById('clipboardContent').value;
+    var base64 = stringToUtf8Base64(content);
+    pendingId = nextUpdateId();
+    pendingContent = content;
+    var msg = {type: 'update', id: pendingId, content: base64};
+    ws.send(JSON.stringify(msg));
+    updateStatus('Sending...');
+    console.log('Sent update via WebSocket');
+    return false;
+  }
+  if (events && events.readyState === EventSource.OPEN) {
+    event.preventDefault();
+    sendUpdateHttp(document.getElementById('clipboardContent').value);
+    return false;
+  }
+  return true;
+}
+function typeOnHost() {
+  if (ws && ws.readyState === WebSocket.OPEN) {
+    ws.send(JSON.stringify({type: 'type_clipboard'}));
+  } else {
+    updateStatus('Typing needs a WebSocket connection');
+  }
+}
+function copyContent() {
+  var copyText = document.getElementById("clipboardContent");
+  copyText.select();
+  copyText.setSelectionRange(0, 99999); /* For mobile devices */
+  try {
+    var successful = document.execCommand('copy');
+    var msg = successful ? 'Copied!' : 'Copy failed';
+    updateStatus(msg);
+    setTimeout(function() { 
+       if(isConnected()) updateStatus("Connected"); 
+    }, 2000);
+  } catch (err) {
+    console.log('Unable to copy');
+    updateStatus("Copy failed");
+  }
+}
+var FILE_NAME_MAX_LEN = 24;
+function updateFileLink(content) {
+  var el = document.getElementById('fileLink');
+  if (!el) return;
+  el.textContent = '';
+  if (/^\/files\/[A-Za-z0-9._-]+$/.test(content)) {
+    var a = document.createElement('a');
+    a.href = content;
+    a.textContent = 'Download ' + content.substring(7);
+    a.setAttribute('download', '');
+    el.appendChild(a);
+  }
+}
+function uploadFile() {
+  var input = document.getElementById('fileInput');
+  if (!input.files || !input.files.length) return;
+  var file = input.files[0];
+  // Keep in sync with the name rules in file_server.c
+  var name = file.name.replace(/[^A-Za-z0-9._-]/g, '_').replace(/^\.+/, '');
+  var dot = name.lastIndexOf('.');
+  if (name.length > FILE_NAME_MAX_LEN) {
+    var ext = dot > 0 ? name.substring(dot).substring(0, 6) : '';
+    name = name.substring(0, FILE_NAME_MAX_LEN - ext.length) + ext;
+  }
+  if (!name) name = 'file';
+  var x = new XMLHttpRequest();
+  // The browser streams the file from disk; the device streams it to flash
+  x.open('PUT', '/files/' + name + '?clip=1', true);
+  x.upload.onprogress = function(e) {
+    if (e.lengthComputable) updateStatus('Uploading ' + Math.round(e.loaded * 100 / e.total) + '%');
+  };
+  x.onload = function() {
+    if (x.status >= 200 && x.status < 300) {
+      updateStatus('Uploaded ' + name);
+    } else if (x.status === 413) {
+      updateStatus('Upload Error: not enough space');
+    } else {
+      updateStatus('Upload Error: ' + x.status);
+    }
+  };
+  x.onerror = function() {
+    updateStatus('Upload Error');
+  };
+  x.send(file);
+}
+function clearContent() {
+  var textarea = document.getElementById('clipboardContent');
+  textarea.value = '';
+}
+window.onload = function() {
+  var textarea = document.getElementById('clipboardContent');
+  shareButton = document.getElementById('shareButton');
+  statusIndicator = document.getElementById('statusIndicator');
+  
+  if ('serviceWorker' in navigator) {
+    // Only available in secure contexts; over plain HTTP the shell is revalidated with ETags instead
+    navigator.serviceWorker.register('/sw.js').catch(function(e) {
+      console.log('Service worker registration failed:', e);
+    });
+  }
+
+  openStateDb(function() {
+    loadState(function(state) {
+      if (state && typeof state.content === 'string') {
+        textarea.value = state.content;
+        updateFileLink(state.content);
+        knownVersion = state.version;
+      }
+      if (window.WebSocket) {
+        connectWebSocket();
+      } else {
+        connectEvents();
+      }
+    });
+  });
+};
@@ -0,0 +1,49 @@
+// Service worker for the shared clipboard page.
+// The page shell is served from cache and revalidated in the background; the
+// assets carry ETags, so an unchanged shell costs the device a 304 and no body.
+// Live content never goes through here: it comes over /ws or /events.
+var CACHE = 'clipkit-shell-v1';
+var SHELL = ['/clipboard', '/clipboard.js', '/style.css', '/manifest.json', '/icon.svg'];
+
+self.addEventListener('install', function(event) {
+  event.waitUntil(caches.open(CACHE).then(function(cache) {
+    return cache.addAll(SHELL);
+  }).then(function() {
+    return self.skipWaiting();
+  }));
+});
+
+self.addEventListener('activate', function(event) {
+  event.waitUntil(caches.keys().then(function(keys) {
+    return Promise.all(keys.filter(function(key) {
+      return key !== CACHE;
+    }).map(function(key) {
+      return caches.delete(key);
+    }));
+  }).then(function() {
+    return self.clients.claim();
+  }));
+});
+
+self.addEventListener('fetch', function(event) {
+  var url = new URL(event.request.url);
+  if (event.request.method !== 'GET' || url.origin !== self.location.origin ||
+      SHELL.indexOf(url.pathname) === -1) {
+    return;
+  }
+  event.respondWith(caches.open(CACHE).then(function(cache) {
+    return cache.match(url.pathname).then(function(cached) {
+      var update = fetch(event.request).then(function(response) {
+        if (response.ok) {
+          cache.put(url.pathname, response.clone());
+        }
+        return response;
+      });
+      if (cached) {
+        event.waitUntil(update.catch(function() {}));
+        return cached;
+      }
+      return update;
+    });
+  }));
+});
@@ -7,14 +7,46 @@
 #include "esp_wifi.h"
 #include "nvs_flash.h"
 #include "lwip/sockets.h"
+#include "mbedtls/sha256.h"
 #include "pages.h"
 #include "usb_hid.h"
+#include "keymap.h"
 #include "ui_manager.h"
 #include "clipboard_service.h"
 #include "ws_server.h"
+#include "clipboard_api.h"
+#include "web_worker.h"
+#include "file_server.h"
+#include "captive_portal.h"
+#include "metrics.h"
 
 static const char *TAG = "web_server";
 
+#define WS_UPDATE_ID_MAX_LEN 32
+#define SAVE_USB_CHUNK_LEN   512
+#define WEB_ASSET_ETAG_LEN   19 // Quoted 64-bit hex digest
+
+typedef struct {
+    const char *type;
+    const uint8_t *start;
+    const uint8_t *end;
+    char etag[WEB_ASSET_ETAG_LEN + 1];
+} web_asset_t;
+
+/* Gzip-compressed static assets served from flash with ETag revalidation */
+static web_asset_t web_assets[] = {
+    { "text/html",              index_html_gz_start,   index_html_gz_end },     // "/"
+    { "text/css",               style_css_gz_start,    style_css_gz_end },      // "/style.css"
+    { "application/javascript", clipboard_js_gz_start, clipboard_js_gz_end },   // "/clipboard.js"
+    { "text/html",              clipboard_html_gz_start, clipboard_html_gz_end }, // "/clipboard"
+    { "application/javascript", sw_js_gz_start,        sw_js_gz_end },          // "/sw.js"
+    { "application/manifest+json", manifest_json_gz_start, manifest_json_gz_end }, // "/manifest.json"
+    { "image/svg+xml",          icon_svg_gz_start,     icon_svg_gz_end },       // "/icon.svg"
+};
+
+static web_asset_t usb_saved_asset = { "text/html", usb_saved_html_gz_start, usb_saved_html_gz_end };
+static web_asset_t success_asset   = { "text/html", success_html_gz_start,   success_html_gz_end };
+
 static void url_decode(char *dst, const char *src, size_t max_len)
 {
     char a, b;
@@ -42,34 +74,77 @@ static void url_decode(char *dst, const char *src, size_t max_len)
     *dst++ = '\0';
 }
 
-static void broadcast_clipboard_update(void)
+/* Locate the string value of "key" in a flat JSON object. Values must not contain escaped quotes. */
+static char *json_find_string(char *json, const char *key, size_t *value_len)
 {
-    size_t base64_len = SHARED_CLIPBOARD_MAX_LEN * 2;
-    size_t resp_len = base64_len + 64;
-    
-    char *base64_content = malloc(base64_len);
-    if (base64_content == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for base64 content in broadcast");
-        return;
-    }
-    
-    if (clipboard_service_get_base64(base64_content, base64_len) != ESP_OK) {
-        free(base64_content);
-        return;
+    char pattern[24];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+
+    char *start = strstr(json, pattern);
+    if (start == NULL) return NULL;
+    start += strlen(pattern);
+
+    char *end = strchr(start, '"');
+    if (end == NULL) return NULL;
+
+    *value_len = end - start;
+    return start;
+}
+
+/* Locate the unsigned integer value of "key" in a flat JSON object */
+static bool json_find_uint(const char *json, const char *key, uint32_t *value)
+{
+    char pattern[24];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+    const char *start = strstr(json, pattern);
+    if (start == NULL) return false;
+    start += strlen(pattern);
+    if (!isdigit((int)*start)) return false;
+
+    *value = strtoul(start, NULL, 10);
+    return true;
+}
+
+static bool is_valid_update_id(const char *id, size_t len)
+{
+    if (len == 0 || len > WS_UPDATE_ID_MAX_LEN) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((int)id[i]) && id[i] != '-' && id[i] != '_') return false;
     }
-    
-    char *response = malloc(resp_len);
-    if (response == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for response in broadcast");
-        free(base64_content);
-        return;
+    return true;
+}
+
+static void send_update_ack(httpd_req_t *req, const char *id, uint32_t version)
+{
+    char response[WS_UPDATE_ID_MAX_LEN + 64];
+    int len = snprintf(response, sizeof(response), "{\"type\":\"ack\",\"id\":\"%s\",\"version\":%lu}",
+                       id, (unsigned long)version);
+
+    httpd_ws_frame_t ack_pkt = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)response,
+        .len = len,
+        .final = true
+    };
+    esp_err_t ret = httpd_ws_send_frame(req, &ack_pkt);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send ack: %s", esp_err_to_name(ret));
     }
-    
-    snprintf(response, resp_len, "{\"type\":\"update\",\"content\":\"%s\"}", base64_content);
-    ws_server_broadcast(response);
-    
-    free(base64_content);
-    free(response);
+}
+
+static void send_typing_status(httpd_req_t *req, const char *status)
+{
+    char response[48];
+    int len = snprintf(response, sizeof(response), "{\"type\":\"typing\",\"status\":\"%s\"}", status);
+
+    httpd_ws_frame_t pkt = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)response,
+        .len = len,
+        .final = true
+    };
+    httpd_ws_send_frame(req, &pkt);
 }
 
 static void ws_close_callback(httpd_handle_t hd, int sockfd)
@@ -125,42 +200,41 @@ static esp_err_t ws_handler(httpd_req_t *req)
         
         ESP_LOGI(TAG, "Received WebSocket message: %s", (char*)buf);
         
-        if (strncmp((char*)buf, "{\"type\":\"update\",\"content\":\"", 28) == 0) {
-            char *content_start = (char*)buf + 28;
-            char *content_end = strstr(content_start, "\"}");
-            if (content_end && content_end > content_start) {
-                // Terminate the base64 string
-                *content_end = '\0';
-                
-                if (clipboard_service_set_base64(content_start) == ESP_OK) {
-                    ESP_LOGI(TAG, "Updated shared clipboard via WebSocket");
-                    broadcast_clipboard_update();
-                }
+        size_t type_len = 0;
+        char *type = json_find_string((char*)buf, "type", &type_len);
+
+        if (type && type_len == 6 && strncmp(type, "update", 6) == 0) {
+            size_t id_len = 0;
+            size_t content_len = 0;
+            char *id = json_find_string((char*)buf, "id", &id_len);
+            char *content = json_find_string((char*)buf, "content", &content_len);
+            if (id && !is_valid_update_id(id, id_len)) {
+                ESP_LOGW(TAG, "Ignoring invalid update id");
+                id = NULL;
             }
-        } else if (strncmp((char*)buf, "{\"type\":\"get_state\"}", 20) == 0) {
-            size_t base64_len = SHARED_CLIPBOARD_MAX_LEN * 2;
-            char *base64_content = malloc(base64_len);
-            if (base64_content) {
-                if (clipboard_service_get_base64(base64_content, base64_len) == ESP_OK) {
-                    char *response = malloc(base64_len + 64);
-                    if (response) {
-                        snprintf(response, base64_len + 64, "{\"type\":\"update\",\"content\":\"%s\"}", base64_content);
-                        
-                        httpd_ws_frame_t response_pkt = {
-                            .type = HTTPD_WS_TYPE_TEXT,
-                            .payload = (uint8_t *)response,
-                            .len = strlen(response),
-                            .final = true
-                        };
-                        esp_err_t send_ret = httpd_ws_send_frame(req, &response_pkt);
-                        if (send_ret != ESP_OK) {
-                            ESP_LOGE(TAG, "Failed to send initial state: %s", esp_err_to_name(send_ret));
-                        }
-                        free(response);
+            if (content && content_len > 0) {
+                // Terminate the strings in place (both are followed by a closing quote)
+                content[content_len] = '\0';
+                if (id) id[id_len] = '\0';
+
+                uint32_t version = 0;
+                if (clipboard_service_set_base64(content, &version) == ESP_OK) {
+                    ESP_LOGI(TAG, "Updated shared clipboard via WebSocket (version %lu)", (unsigned long)version);
+                    if (id) {
+                        // The originator already has the content: confirm with a small ack only
+                        send_update_ack(req, id, version);
+                        ws_server_set_update_origin(version, httpd_req_to_sockfd(req));
                     }
                 }
-                free(base64_content);
             }
+        } else if (type && type_len == 9 && strncmp(type, "get_state", 9) == 0) {
+            // Clients send the version they restored from their local cache, if any
+            uint32_t known_version = 0;
+            bool has_known_version = json_find_uint((char*)buf, "version", &known_version);
+            ws_server_send_clipboard(req, has_known_version, known_version);
+        } else if (type && type_len == 14 && strncmp(type, "type_clipboard", 14) == 0) {
+            // Type the shared clipboard on the USB host
+            send_typing_status(req, usb_hid_type_clipboard() == ESP_OK ? "queued" : "usb_off");
         }
         
         free(buf);
@@ -169,12 +243,57 @@ static esp_err_t ws_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-/* HTTP GET Handler for root "/" */
-static esp_err_t root_get_handler(httpd_req_t *req)
+static void web_asset_compute_etag(web_asset_t *asset)
 {
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, index_html, HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
+    unsigned char digest[32];
+    mbedtls_sha256(asset->start, asset->end - asset->start, digest, 0);
+    snprintf(asset->etag, sizeof(asset->etag), "\"%02x%02x%02x%02x%02x%02x%02x%02x\"",
+             digest[0], digest[1], digest[2], digest[3], digest[4], digest[5], digest[6], digest[7]);
+}
+
+static void web_assets_init(void)
+{
+    for (int i = 0; i < sizeof(web_assets) / sizeof(web_assets[0]); i++) {
+        web_asset_compute_etag(&web_assets[i]);
+    }
+}
+
+/* Check whether the client's If-None-Match header matches the asset's ETag */
+static bool web_asset_not_modified(httpd_req_t *req, const web_asset_t *asset)
+{
+    char value[96];
+    size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+    if (len == 0 || len >= sizeof(value)) {
+        return false;
+    }
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    return strstr(value, asset->etag) != NULL || strcmp(value, "*") == 0;
+}
+
+static esp_err_t send_web_asset(httpd_req_t *req, const web_asset_t *asset)
+{
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset->start, asset->end - asset->start);
+}
+
+/* HTTP GET Handler for static assets (see web_assets) */
+static esp_err_t asset_get_handler(httpd_req_t *req)
+{
+    const web_asset_t *asset = (const web_asset_t *)req->user_ctx;
+
+    // Always revalidate, so a firmware update is picked up on the next visit
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+
+    if (web_asset_not_modified(req, asset)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    return send_web_asset(req, asset);
 }
 
 /* Simple 16x16 favicon.ico data */
@@ -216,115 +335,219 @@ static esp_err_t favicon_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-/* HTTP POST Handler for "/save_usb" */
+/* HTTP POST Handler for "/save_usb"
+ *
+ * The body is streamed in small pieces straight into the flash-backed payload
+ * store, so RAM use does not depend on the payload size. With "?macros=1" the
+ * {...} macro syntax is interpreted; a syntax error is answered with 400.
+ */
 static esp_err_t save_usb_post_handler(httpd_req_t *req)
 {
-    // Use heap allocation instead of stack for large buffer
-    char *buf = malloc(4096); // Increased buffer size to accommodate larger USB string
-    if (buf == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for USB string");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+    // Flash erase/write is slow: run on the worker pool
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, save_usb_post_handler);
     }
 
-    int ret, remaining = req->content_len;
-    int cur_len = 0;
+    char buf[SAVE_USB_CHUNK_LEN];
+    size_t remaining = req->content_len;
 
-    if (remaining >= 4096) {
-        free(buf);
+    bool macros = false;
+    char query[32];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        char value[4];
+        if (httpd_query_key_value(query, "macros", value, sizeof(value)) == ESP_OK) {
+            macros = strcmp(value, "1") == 0;
+        }
+    }
+
+    esp_err_t err = usb_hid_save_begin(remaining, macros);
+    if (err == ESP_ERR_INVALID_SIZE) {
+        httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LONG, "USB string too long");
+        return ESP_FAIL;
+    } else if (err != ESP_OK) {
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    while (cur_len < remaining) {
-        ret = httpd_req_recv(req, buf + cur_len, remaining - cur_len);
+    while (remaining > 0) {
+        int ret = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
         if (ret <= 0) {
+            usb_hid_save_abort();
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
                 httpd_resp_send_408(req);
             }
-            free(buf);
             return ESP_FAIL;
         }
-        cur_len += ret;
+        err = usb_hid_save_append(buf, ret);
+        if (err != ESP_OK) {
+            usb_hid_save_abort();
+            if (err == ESP_ERR_INVALID_ARG) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, usb_hid_get_save_error());
+            } else {
+                httpd_resp_send_500(req);
+            }
+            return ESP_FAIL;
+        }
+        remaining -= ret;
     }
-    buf[cur_len] = '\0';
 
-    ESP_LOGI(TAG, "Received USB String: %s", buf);
+    err = usb_hid_save_finish();
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, usb_hid_get_save_error());
+        return ESP_FAIL;
+    } else if (err != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
 
-    // Save USB String (and update HID module)
-    usb_hid_save_string(buf);
+    ESP_LOGI(TAG, "Received USB String (%u bytes)", (unsigned)req->content_len);
     
     // Refresh LCD if currently showing Page 3
     ui_refresh_usb_page();
     
-    free(buf); // Free the buffer
-    
-    httpd_resp_send(req, usb_saved_html, HTTPD_RESP_USE_STRLEN);
+    // Characters the keyboard layout cannot type, so the page can warn about them
+    char unmapped[12];
+    snprintf(unmapped, sizeof(unmapped), "%u", (unsigned)usb_hid_get_unmapped_count());
+    httpd_resp_set_hdr(req, "X-Unmapped-Chars", unmapped);
+    send_web_asset(req, &usb_saved_asset);
     return ESP_OK;
 }
 
-/* HTTP GET Handler for "/clipboard" - Get shared clipboard content */
-static esp_err_t clipboard_get_handler(httpd_req_t *req)
+/* HTTP GET Handler for "/keyboard_layout" */
+static esp_err_t keyboard_layout_get_handler(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "Handling /clipboard GET request");
-    
-    // Allocate memory for the response buffer
-    // Estimate: Template (~2KB) + Content (~1.5KB) + Margin
-    size_t buf_len = 8192;
-    char *resp_buf = malloc(buf_len);
-    if (resp_buf == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for response buffer");
-        httpd_resp_send_500(req);
+    char json[96];
+    int len = snprintf(json, sizeof(json), "{\"layout\":\"%s\",\"layouts\":[", usb_hid_get_layout());
+    for (int i = 0; i < KEYMAP_LAYOUT_MAX; i++) {
+        len += snprintf(json + len, sizeof(json) - len, "%s\"%s\"", i ? "," : "", keymap_layout_name(i));
+    }
+    len += snprintf(json + len, sizeof(json) - len, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, json, len);
+}
+
+/* HTTP POST Handler for "/keyboard_layout" - the body is the layout name */
+static esp_err_t keyboard_layout_post_handler(httpd_req_t *req)
+{
+    // NVS commit writes flash: run on the worker pool
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, keyboard_layout_post_handler);
+    }
+
+    char name[8];
+    if (req->content_len == 0 || req->content_len >= sizeof(name)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown layout");
         return ESP_FAIL;
     }
-    
-    size_t base64_len = SHARED_CLIPBOARD_MAX_LEN * 2;
-    char *base64_content = malloc(base64_len);
-    if (base64_content == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for base64 content");
-        free(resp_buf);
-        httpd_resp_send_500(req);
+    int ret = httpd_req_recv(req, name, req->content_len);
+    if (ret != req->content_len) {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_408(req);
+        }
         return ESP_FAIL;
     }
-    
-    if (clipboard_service_get_base64(base64_content, base64_len) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get base64 content");
-        free(base64_content);
-        free(resp_buf);
+    name[ret] = '\0';
+
+    esp_err_t err = usb_hid_set_layout(name);
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown layout");
+        return ESP_FAIL;
+    } else if (err != ESP_OK) {
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
-    
-    ESP_LOGI(TAG, "Base64 content length: %lu", (unsigned long)strlen(base64_content));
-    
-    int printed_len = snprintf(resp_buf, buf_len, clipboard_html_template, base64_content);
-    
-    if (printed_len < 0 || printed_len >= buf_len) {
-        ESP_LOGE(TAG, "Response buffer too small or snprintf error");
-        free(base64_content);
-        free(resp_buf);
+
+    httpd_resp_set_status(req, "204 No Content");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* HTTP GET Handler for "/usb_mode" */
+static esp_err_t usb_mode_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_sendstr(req, usb_hid_is_persistent() ? "{\"persistent\":true}" : "{\"persistent\":false}");
+}
+
+/* HTTP POST Handler for "/usb_mode" - the body is "persistent" or "on_demand" */
+static esp_err_t usb_mode_post_handler(httpd_req_t *req)
+{
+    // NVS commit writes flash and the driver may be (un)installed: run on the worker pool
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, usb_mode_post_handler);
+    }
+
+    char mode[12];
+    if (req->content_len == 0 || req->content_len >= sizeof(mode)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown mode");
+        return ESP_FAIL;
+    }
+    int ret = httpd_req_recv(req, mode, req->content_len);
+    if (ret != req->content_len) {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    mode[ret] = '\0';
+
+    bool persistent;
+    if (strcmp(mode, "persistent") == 0) {
+        persistent = true;
+    } else if (strcmp(mode, "on_demand") == 0) {
+        persistent = false;
+    } else {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown mode");
+        return ESP_FAIL;
+    }
+    if (usb_hid_set_persistent(persistent) != ESP_OK) {
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
+    ui_refresh_usb_page();
 
-    httpd_resp_set_type(req, "text/html; charset=utf-8");
-    esp_err_t res = httpd_resp_send(req, resp_buf, printed_len);
-    
-    free(base64_content);
-    free(resp_buf);
+    httpd_resp_set_status(req, "204 No Content");
+    return httpd_resp_send(req, NULL, 0);
+}
 
-    if (res != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send response: %s", esp_err_to_name(res));
-        return res;
+/* HTTP GET Handler for "/events" - Server-Sent Events stream of clipboard updates */
+static esp_err_t events_get_handler(httpd_req_t *req)
+{
+    char last_id[12];
+    bool has_last_id = false;
+    uint32_t last_version = 0;
+    if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", last_id, sizeof(last_id)) == ESP_OK) {
+        has_last_id = true;
+        last_version = strtoul(last_id, NULL, 10);
+    } else {
+        // A new EventSource cannot set Last-Event-ID: pages pass their cached version as ?since=
+        char query[32];
+        if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+            httpd_query_key_value(query, "since", last_id, sizeof(last_id)) == ESP_OK) {
+            has_last_id = true;
+            last_version = strtoul(last_id, NULL, 10);
+        }
     }
-    
-    ESP_LOGI(TAG, "Finished handling /clipboard GET request (len=%d)", printed_len);
-    return ESP_OK;
+
+    esp_err_t ret = ws_server_add_sse_client(req, has_last_id, last_version);
+    if (ret == ESP_ERR_NO_MEM) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    return ret;
 }
 
 /* HTTP POST Handler for "/connect" */
 static esp_err_t connect_post_handler(httpd_req_t *req)
 {
+    // Wi-Fi reconfiguration blocks: run on the worker pool
+    if (!web_worker_is_worker()) {
+        return web_worker_dispatch(req, connect_post_handler);
+    }
+
     char buf[256]; // Increased buffer size to accommodate encoded SSID/Password
     int ret, remaining = req->content_len;
     int cur_len = 0;
@@ -385,7 +608,7 @@ static esp_err_t connect_post_handler(httpd_req_t *req)
 
     ESP_ERROR_CHECK(esp_wifi_connect());
 
-    httpd_resp_send(req, success_html, HTTPD_RESP_USE_STRLEN);
+    send_web_asset(req, &success_asset);
     return ESP_OK;
 }
 
@@ -401,8 +624,22 @@ esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
 static const httpd_uri_t root = {
     .uri       = "/",
     .method    = HTTP_GET,
-    .handler   = root_get_handler,
-    .user_ctx  = NULL
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[0]
+};
+
+static const httpd_uri_t style_uri = {
+    .uri       = "/style.css",
+    .method    = HTTP_GET,
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[1]
+};
+
+static const httpd_uri_t clipboard_js_uri = {
+    .uri       = "/clipboard.js",
+    .method    = HTTP_GET,
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[2]
 };
 
 static const httpd_uri_t connect_uri = {
@@ -426,10 +663,66 @@ static const httpd_uri_t save_usb_uri = {
     .user_ctx  = NULL
 };
 
+static const httpd_uri_t keyboard_layout_get_uri = {
+    .uri       = "/keyboard_layout",
+    .method    = HTTP_GET,
+    .handler   = keyboard_layout_get_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t keyboard_layout_post_uri = {
+    .uri       = "/keyboard_layout",
+    .method    = HTTP_POST,
+    .handler   = keyboard_layout_post_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t usb_mode_get_uri = {
+    .uri       = "/usb_mode",
+    .method    = HTTP_GET,
+    .handler   = usb_mode_get_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t usb_mode_post_uri = {
+    .uri       = "/usb_mode",
+    .method    = HTTP_POST,
+    .handler   = usb_mode_post_handler,
+    .user_ctx  = NULL
+};
+
 static const httpd_uri_t clipboard_uri = {
     .uri       = "/clipboard",
     .method    = HTTP_GET,
-    .handler   = clipboard_get_handler,
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[3]
+};
+
+static const httpd_uri_t sw_js_uri = {
+    .uri       = "/sw.js",
+    .method    = HTTP_GET,
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[4]
+};
+
+static const httpd_uri_t manifest_uri = {
+    .uri       = "/manifest.json",
+    .method    = HTTP_GET,
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[5]
+};
+
+static const httpd_uri_t icon_uri = {
+    .uri       = "/icon.svg",
+    .method    = HTTP_GET,
+    .handler   = asset_get_handler,
+    .user_ctx  = &web_assets[6]
+};
+
+static const httpd_uri_t events_uri = {
+    .uri       = "/events",
+    .method    = HTTP_GET,
+    .handler   = events_get_handler,
     .user_ctx  = NULL
 };
 
@@ -447,20 +740,39 @@ httpd_handle_t start_webserver(void)
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.max_open_sockets = 7;
     config.lru_purge_enable = true;
-    config.stack_size = 8192; // Increase stack size to handle large buffers in save_usb_post_handler
-    config.max_uri_handlers = 12; // Ensure enough slots for all URI handlers
+    // Default stack size is enough: large request bodies are streamed in small chunks
+    config.max_uri_handlers = 32; // Ensure enough slots for all URI handlers
+    config.uri_match_fn = httpd_uri_match_wildcard; // Needed for /files/<name>
     config.close_fn = ws_close_callback;
 
+    web_assets_init();
+    web_worker_start();
+
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
         httpd_register_uri_handler(server, &root);
+        httpd_register_uri_handler(server, &style_uri);
+        httpd_register_uri_handler(server, &clipboard_js_uri);
         httpd_register_uri_handler(server, &connect_uri);
         httpd_register_uri_handler(server, &favicon_uri);
         httpd_register_uri_handler(server, &save_usb_uri);
+        httpd_register_uri_handler(server, &keyboard_layout_get_uri);
+        httpd_register_uri_handler(server, &keyboard_layout_post_uri);
+        httpd_register_uri_handler(server, &usb_mode_get_uri);
+        httpd_register_uri_handler(server, &usb_mode_post_uri);
         httpd_register_uri_handler(server, &clipboard_uri);
+        httpd_register_uri_handler(server, &sw_js_uri);
+        httpd_register_uri_handler(server, &manifest_uri);
+        httpd_register_uri_handler(server, &icon_uri);
+        httpd_register_uri_handler(server, &events_uri);
+        ws_server_start_broadcasts(server);
+        clipboard_api_register(server);
+        file_server_register(server);
+        captive_portal_register(server);
+        metrics_register(server);
         esp_err_t ws_ret = httpd_register_uri_handler(server, &ws_uri);
         if (ws_ret != ESP_OK) {
             ESP_LOGE(TAG, "Failed to register WebSocket handler: %s", esp_err_to_name(ws_ret));
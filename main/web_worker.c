@@ -0,0 +1,101 @@
+/*
+ * Worker pool for slow HTTP handlers
+ * Keeps the httpd task free for routing and WebSocket I/O
+ */
+#include "web_worker.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+
+static const char *TAG = "web_worker";
+
+typedef struct {
+    httpd_req_t *req;
+    web_worker_handler_t handler;
+} web_work_t;
+
+static QueueHandle_t s_work_queue = NULL;
+static TaskHandle_t s_workers[WEB_WORKER_COUNT];
+
+static void web_worker_task(void *arg)
+{
+    web_work_t work;
+    while (1) {
+        if (xQueueReceive(s_work_queue, &work, portMAX_DELAY)) {
+            work.handler(work.req);
+            if (httpd_req_async_handler_complete(work.req) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to complete async request");
+            }
+        }
+    }
+}
+
+esp_err_t web_worker_start(void)
+{
+    if (s_work_queue != NULL) {
+        return ESP_OK;
+    }
+
+    s_work_queue = xQueueCreate(WEB_WORKER_QUEUE_DEPTH, sizeof(web_work_t));
+    if (s_work_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create work queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < WEB_WORKER_COUNT; i++) {
+        if (xTaskCreate(web_worker_task, "web_worker", WEB_WORKER_STACK_SIZE, NULL, 5, &s_workers[i]) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start worker %d", i);
+            return ESP_FAIL;
+        }
+    }
+    ESP_LOGI(TAG, "Started %d web workers", WEB_WORKER_COUNT);
+    return ESP_OK;
+}
+
+bool web_worker_is_worker(void)
+{
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < WEB_WORKER_COUNT; i++) {
+        if (s_workers[i] == current) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static esp_err_t send_busy(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+esp_err_t web_worker_dispatch(httpd_req_t *req, web_worker_handler_t handler)
+{
+    if (s_work_queue == NULL) {
+        // No pool: run inline
+        return handler(req);
+    }
+
+    if (uxQueueSpacesAvailable(s_work_queue) == 0) {
+        ESP_LOGW(TAG, "Work queue full, rejecting %s", req->uri);
+        return send_busy(req);
+    }
+
+    web_work_t work = { .handler = handler };
+    esp_err_t err = httpd_req_async_handler_begin(req, &work.req);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to begin async request: %s", esp_err_to_name(err));
+        httpd_resp_send_500(req);
+        return err;
+    }
+
+    if (xQueueSend(s_work_queue, &work, 0) != pdTRUE) {
+        // Lost a race for the last slot: answer from the detached copy
+        ESP_LOGW(TAG, "Work queue full, rejecting %s", req->uri);
+        send_busy(work.req);
+        httpd_req_async_handler_complete(work.req);
+    }
+    return ESP_OK;
+}
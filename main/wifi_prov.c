@@ -13,6 +13,7 @@
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
 #include <time.h>
 #include <sys/time.h>
 #include "lwip/err.h"
@@ -23,9 +24,22 @@
 #include "usb_hid.h"
 #include "clipboard_service.h"
 #include "ws_server.h"
+#include "file_server.h"
+#include "captive_portal.h"
 #include "web_server.h"
 
 static const char *TAG = "wifi_prov";
+static esp_timer_handle_t s_ap_grace_timer = NULL;
+static volatile bool s_sta_connected = false;
+
+/* Grace period over: drop the SoftAP, unless the uplink was lost in the meantime */
+static void ap_grace_timer_callback(void *arg)
+{
+    if (s_sta_connected) {
+        ESP_LOGI(TAG, "Grace period over, stopping SoftAP");
+        esp_wifi_set_mode(WIFI_MODE_STA);
+    }
+}
 
 /* Event handler for WiFi events */
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
@@ -35,6 +49,7 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
         wifi_event_ap_staconnected_t* event = (wifi_event_ap_staconnected_t*) event_data;
         ESP_LOGI(TAG, "Station "MACSTR" joined, AID=%d",
                  MAC2STR(event->mac), event->aid);
+        captive_portal_station_joined();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED) {
         wifi_event_ap_stadisconnected_t* event = (wifi_event_ap_stadisconnected_t*) event_data;
         ESP_LOGI(TAG, "Station "MACSTR" left, AID=%d",
@@ -44,6 +59,8 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Got IP:" IPSTR, IP2STR(&event->ip_info.ip));
+        s_sta_connected = true;
+        captive_portal_set_online(true);
         
         // Initialize SNTP
         ESP_LOGI(TAG, "Initializing SNTP");
@@ -66,11 +83,24 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
         
         ui_update_wifi_sta((char*)conf.sta.ssid, (char*)conf.sta.password, ip_str, gw_str);
 
-        // Disable SoftAP to optimize performance
-        ESP_LOGI(TAG, "Connected to Router! Stopping SoftAP...");
-        esp_wifi_set_mode(WIFI_MODE_STA);
+        // Disable SoftAP to optimize performance; clients still joined first get the online answer
+        wifi_sta_list_t stations;
+        if (s_ap_grace_timer != NULL && esp_wifi_ap_get_sta_list(&stations) == ESP_OK && stations.num > 0) {
+            ESP_LOGI(TAG, "Connected to Router! Stopping SoftAP in %d ms (%d clients joined)",
+                     WIFI_PROV_AP_GRACE_MS, stations.num);
+            esp_timer_stop(s_ap_grace_timer);
+            esp_timer_start_once(s_ap_grace_timer, (uint64_t)WIFI_PROV_AP_GRACE_MS * 1000);
+        } else {
+            ESP_LOGI(TAG, "Connected to Router! Stopping SoftAP...");
+            esp_wifi_set_mode(WIFI_MODE_STA);
+        }
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         ESP_LOGI(TAG, "Station disconnected");
+        s_sta_connected = false;
+        if (s_ap_grace_timer != NULL) {
+            esp_timer_stop(s_ap_grace_timer);
+        }
+        captive_portal_set_online(false);
         
         ui_update_wifi_disconnected();
 
@@ -109,6 +139,12 @@ void wifi_prov_init(void)
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
+    const esp_timer_create_args_t grace_timer_args = {
+        .callback = ap_grace_timer_callback,
+        .name = "ap_grace"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&grace_timer_args, &s_ap_grace_timer));
+
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                         ESP_EVENT_ANY_ID,
                                                         &wifi_event_handler,
@@ -126,6 +162,7 @@ void wifi_prov_init(void)
     // Initialize Services
     ESP_ERROR_CHECK(clipboard_service_init());
     ws_server_init();
+    file_server_init();
     usb_hid_init();
 
     // Configure WiFi Mode
@@ -142,7 +179,7 @@ void wifi_prov_init(void)
             ESP_ERROR_CHECK(esp_wifi_start());
             ESP_ERROR_CHECK(esp_wifi_connect());
             
-            // Start DNS Server (even in STA mode, to be ready for AP fallback)
+            // Start DNS Server: caching forwarder for the LAN, captive portal on AP fallback
             start_dns_server();
 
             start_webserver();
@@ -1,22 +1,72 @@
 #include <string.h>
 #include <stdlib.h>
 #include "ws_server.h"
+#include "clipboard_service.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "metrics.h"
 #include "lwip/sockets.h"
 
 static const char *TAG = "ws_server";
 
+typedef enum {
+    CLIENT_KIND_WEBSOCKET,
+    CLIENT_KIND_SSE,
+} client_kind_t;
+
 typedef struct {
     httpd_handle_t handle;
     int fd;
     bool connected;
+    client_kind_t kind;
+    httpd_req_t *sse_req; // Async request kept open for the SSE stream
 } ws_client_t;
 
 static ws_client_t ws_clients[WEBSOCKET_CLIENT_MAX];
 static SemaphoreHandle_t ws_mutex = NULL;
 static bool ws_initialized = false;
+static esp_timer_handle_t sse_heartbeat_timer = NULL;
+static httpd_handle_t sse_server = NULL;
+static volatile int sse_client_count = 0;
+static httpd_handle_t broadcast_server = NULL;
+static volatile uint32_t broadcast_pending = 0;
+// Only touched on the server task, which also runs the broadcast
+static uint32_t origin_version = 0;
+static int origin_fd = -1;
+
+/* Must be called with ws_mutex held */
+static void client_release_locked(int i)
+{
+    if (ws_clients[i].sse_req) {
+        httpd_req_async_handler_complete(ws_clients[i].sse_req);
+        ws_clients[i].sse_req = NULL;
+        sse_client_count--;
+    }
+    ws_clients[i].connected = false;
+    ws_clients[i].fd = -1;
+    ws_clients[i].handle = NULL;
+}
+
+/* Must be called with ws_mutex held. Drops the client and closes its socket. */
+static void sse_client_drop_locked(int i)
+{
+    httpd_handle_t handle = ws_clients[i].handle;
+    int fd = ws_clients[i].fd;
+    client_release_locked(i);
+    httpd_sess_trigger_close(handle, fd);
+}
+
+static int find_free_slot_locked(void)
+{
+    for (int i = 0; i < WEBSOCKET_CLIENT_MAX; i++) {
+        if (!ws_clients[i].connected) {
+            return i;
+        }
+    }
+    return -1;
+}
 
 void ws_server_init(void)
 {
@@ -29,6 +79,8 @@ void ws_server_init(void)
             ws_clients[i].handle = NULL;
             ws_clients[i].fd = -1;
             ws_clients[i].connected = false;
+            ws_clients[i].kind = CLIENT_KIND_WEBSOCKET;
+            ws_clients[i].sse_req = NULL;
         }
         ws_initialized = true;
         xSemaphoreGive(ws_mutex);
@@ -57,15 +109,14 @@ int ws_server_add_client(httpd_handle_t handle, int fd)
     }
 
     // Add new client
-    for (int i = 0; i < WEBSOCKET_CLIENT_MAX; i++) {
-        if (!ws_clients[i].connected) {
-            ws_clients[i].handle = handle;
-            ws_clients[i].fd = fd;
-            ws_clients[i].connected = true;
-            index = i;
-            ESP_LOGI(TAG, "WebSocket client connected at index %d, fd=%d", i, fd);
-            break;
-        }
+    index = find_free_slot_locked();
+    if (index >= 0) {
+        ws_clients[index].handle = handle;
+        ws_clients[index].fd = fd;
+        ws_clients[index].connected = true;
+        ws_clients[index].kind = CLIENT_KIND_WEBSOCKET;
+        ws_clients[index].sse_req = NULL;
+        ESP_LOGI(TAG, "WebSocket client connected at index %d, fd=%d", index, fd);
     }
     xSemaphoreGive(ws_mutex);
     
@@ -83,10 +134,9 @@ void ws_server_remove_client(int fd)
     xSemaphoreTake(ws_mutex, portMAX_DELAY);
     for (int i = 0; i < WEBSOCKET_CLIENT_MAX; i++) {
         if (ws_clients[i].connected && ws_clients[i].fd == fd) {
-            ws_clients[i].connected = false;
-            ws_clients[i].fd = -1;
-            ws_clients[i].handle = NULL;
-            ESP_LOGI(TAG, "WebSocket client disconnected at index %d, fd=%d", i, fd);
+            ESP_LOGI(TAG, "%s client disconnected at index %d, fd=%d",
+                     ws_clients[i].kind == CLIENT_KIND_SSE ? "SSE" : "WebSocket", i, fd);
+            client_release_locked(i);
             break;
         }
     }
@@ -94,6 +144,11 @@ void ws_server_remove_client(int fd)
 }
 
 void ws_server_broadcast(const char *message)
+{
+    ws_server_broadcast_except(message, -1);
+}
+
+void ws_server_broadcast_except(const char *message, int exclude_fd)
 {
     if (ws_mutex == NULL || !ws_initialized) return;
     
@@ -106,26 +161,273 @@ void ws_server_broadcast(const char *message)
     
     xSemaphoreTake(ws_mutex, portMAX_DELAY);
     for (int i = 0; i < WEBSOCKET_CLIENT_MAX; i++) {
-        if (ws_clients[i].connected && ws_clients[i].handle != NULL) {
+        if (ws_clients[i].connected && ws_clients[i].handle != NULL &&
+            ws_clients[i].kind == CLIENT_KIND_WEBSOCKET) {
+            if (ws_clients[i].fd == exclude_fd) {
+                continue;
+            }
+
             // Check if the file descriptor is still valid
             int error = 0;
             socklen_t len = sizeof(error);
             if (getsockopt(ws_clients[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
                  ESP_LOGW(TAG, "Client %d (fd=%d) socket invalid, removing", i, ws_clients[i].fd);
-                 ws_clients[i].connected = false;
-                 ws_clients[i].handle = NULL;
-                 ws_clients[i].fd = -1;
+                 client_release_locked(i);
                  continue;
             }
 
             esp_err_t ret = httpd_ws_send_frame_async(ws_clients[i].handle, ws_clients[i].fd, &ws_pkt);
             if (ret != ESP_OK) {
                 ESP_LOGW(TAG, "Failed to send to client %d (fd=%d): %s", i, ws_clients[i].fd, esp_err_to_name(ret));
-                ws_clients[i].connected = false;
-                ws_clients[i].handle = NULL;
-                ws_clients[i].fd = -1;
+                client_release_locked(i);
+            } else {
+                metrics_inc(METRIC_WS_FRAMES_SENT);
+                metrics_add(METRIC_WS_BYTES_SENT, ws_pkt.len);
+            }
+        }
+    }
+    xSemaphoreGive(ws_mutex);
+}
+
+/* Send raw event-stream text to all SSE clients */
+static void sse_broadcast(const char *event)
+{
+    if (ws_mutex == NULL || !ws_initialized) return;
+
+    size_t len = strlen(event);
+    xSemaphoreTake(ws_mutex, portMAX_DELAY);
+    for (int i = 0; i < WEBSOCKET_CLIENT_MAX; i++) {
+        if (ws_clients[i].connected && ws_clients[i].sse_req != NULL) {
+            esp_err_t ret = httpd_resp_send_chunk(ws_clients[i].sse_req, event, len);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Failed to send to SSE client %d (fd=%d): %s", i, ws_clients[i].fd, esp_err_to_name(ret));
+                sse_client_drop_locked(i);
+            } else {
+                metrics_inc(METRIC_SSE_EVENTS_SENT);
+                metrics_add(METRIC_SSE_BYTES_SENT, len);
+            }
+        }
+    }
+    xSemaphoreGive(ws_mutex);
+}
+
+/* Runs on the httpd task so that a slow client does not block the timer task */
+static void sse_heartbeat_work(void *arg)
+{
+    sse_broadcast(": ping\n\n");
+}
+
+static void sse_heartbeat_timer_callback(void *arg)
+{
+    if (sse_client_count > 0 && sse_server) {
+        httpd_queue_work(sse_server, sse_heartbeat_work, NULL);
+    }
+}
+
+/* Build an update message for a snapshot. The caller frees the result. */
+static char *format_update_message(const clipboard_snapshot_t *snap)
+{
+    size_t resp_len = snap->base64_len + 64;
+    char *response = malloc(resp_len);
+    if (response == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for update message");
+        return NULL;
+    }
+
+    snprintf(response, resp_len, "{\"type\":\"update\",\"version\":%lu,\"content\":\"%s\"}",
+             (unsigned long)snap->version, snap->base64);
+    return response;
+}
+
+/* Build an SSE "update" event for a snapshot; the event id is the version. The caller frees the result. */
+static char *format_sse_event(const clipboard_snapshot_t *snap)
+{
+    size_t event_len = snap->base64_len + 96;
+    char *event = malloc(event_len);
+    if (event == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for SSE event");
+        return NULL;
+    }
+
+    snprintf(event, event_len, "id: %lu\nevent: update\ndata: {\"type\":\"update\",\"version\":%lu,\"content\":\"%s\"}\n\n",
+             (unsigned long)snap->version, (unsigned long)snap->version, snap->base64);
+    return event;
+}
+
+/* Runs on the server task; changes made before it runs go out as one update */
+static void broadcast_clipboard_work(void *arg)
+{
+    __atomic_store_n(&broadcast_pending, 0, __ATOMIC_RELEASE);
+    int64_t start_us = esp_timer_get_time();
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) return;
+
+    int exclude_fd = snap->version == origin_version ? origin_fd : -1;
+    char *response = format_update_message(snap);
+    char *event = sse_client_count > 0 ? format_sse_event(snap) : NULL;
+    clipboard_service_release(snap);
+
+    if (response) {
+        ws_server_broadcast_except(response, exclude_fd);
+        free(response);
+    }
+    if (event) {
+        sse_broadcast(event);
+        free(event);
+    }
+    metrics_observe_broadcast((uint32_t)(esp_timer_get_time() - start_us));
+}
+
+/* Clipboard listener: may run on any task, so it must not send anything itself */
+static void clipboard_changed(uint32_t version, void *arg)
+{
+    if (broadcast_server == NULL || __atomic_exchange_n(&broadcast_pending, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (httpd_queue_work(broadcast_server, broadcast_clipboard_work, NULL) != ESP_OK) {
+        __atomic_store_n(&broadcast_pending, 0, __ATOMIC_RELEASE);
+        ESP_LOGW(TAG, "Failed to queue clipboard broadcast");
+    }
+}
+
+esp_err_t ws_server_start_broadcasts(httpd_handle_t server)
+{
+    if (broadcast_server != NULL) {
+        broadcast_server = server;
+        return ESP_OK;
+    }
+    esp_err_t err = clipboard_service_add_listener(clipboard_changed, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register clipboard listener: %s", esp_err_to_name(err));
+        return err;
+    }
+    broadcast_server = server;
+    return ESP_OK;
+}
+
+void ws_server_set_update_origin(uint32_t version, int fd)
+{
+    origin_version = version;
+    origin_fd = fd;
+}
+
+void ws_server_get_client_counts(int *websocket, int *sse)
+{
+    int ws_count = 0, sse_count = 0;
+    if (ws_mutex != NULL) {
+        xSemaphoreTake(ws_mutex, portMAX_DELAY);
+        for (int i = 0; i < WEBSOCKET_CLIENT_MAX; i++) {
+            if (!ws_clients[i].connected) continue;
+            if (ws_clients[i].kind == CLIENT_KIND_SSE) {
+                sse_count++;
+            } else {
+                ws_count++;
             }
         }
+        xSemaphoreGive(ws_mutex);
+    }
+    *websocket = ws_count;
+    *sse = sse_count;
+}
+
+esp_err_t ws_server_send_clipboard(httpd_req_t *req, bool has_known_version, uint32_t known_version)
+{
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) return ESP_FAIL;
+
+    char *response;
+    if (has_known_version && snap->version == known_version) {
+        // Client is up to date (e.g. restored from its local cache): skip the content
+        response = malloc(48);
+        if (response) {
+            snprintf(response, 48, "{\"type\":\"current\",\"version\":%lu}", (unsigned long)snap->version);
+        }
+    } else {
+        response = format_update_message(snap);
+    }
+    clipboard_service_release(snap);
+    if (response == NULL) return ESP_ERR_NO_MEM;
+
+    httpd_ws_frame_t response_pkt = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)response,
+        .len = strlen(response),
+        .final = true
+    };
+    esp_err_t ret = httpd_ws_send_frame(req, &response_pkt);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send clipboard state: %s", esp_err_to_name(ret));
+    }
+    free(response);
+    return ret;
+}
+
+esp_err_t ws_server_add_sse_client(httpd_req_t *req, bool has_last_event_id, uint32_t last_event_id)
+{
+    if (ws_mutex == NULL || !ws_initialized) {
+        ws_server_init();
+    }
+    if (ws_mutex == NULL) return ESP_FAIL;
+
+    if (sse_heartbeat_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = sse_heartbeat_timer_callback,
+            .name = "sse_heartbeat"
+        };
+        if (esp_timer_create(&timer_args, &sse_heartbeat_timer) == ESP_OK) {
+            esp_timer_start_periodic(sse_heartbeat_timer, (uint64_t)SSE_HEARTBEAT_INTERVAL_S * 1000000);
+        }
+    }
+
+    // Format the initial event before taking the lock
+    const clipboard_snapshot_t *snap = clipboard_service_acquire();
+    if (snap == NULL) return ESP_FAIL;
+    char *event = NULL;
+    if (!has_last_event_id || last_event_id != snap->version) {
+        event = format_sse_event(snap);
+    }
+    clipboard_service_release(snap);
+
+    int fd = httpd_req_to_sockfd(req);
+    esp_err_t ret = ESP_OK;
+
+    // Hold the lock across registration so no broadcast can slip in between
+    // the initial state and the client becoming visible to sse_broadcast().
+    xSemaphoreTake(ws_mutex, portMAX_DELAY);
+    int index = find_free_slot_locked();
+    if (index < 0) {
+        xSemaphoreGive(ws_mutex);
+        free(event);
+        ESP_LOGW(TAG, "No available client slot for SSE");
+        return ESP_ERR_NO_MEM;
+    }
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    ret = httpd_resp_send_chunk(req, "retry: 2000\n\n", HTTPD_RESP_USE_STRLEN);
+
+    httpd_req_t *async_req = NULL;
+    if (ret == ESP_OK) {
+        ret = httpd_req_async_handler_begin(req, &async_req);
+    }
+    if (ret == ESP_OK && event) {
+        ret = httpd_resp_send_chunk(async_req, event, HTTPD_RESP_USE_STRLEN);
+        if (ret != ESP_OK) {
+            httpd_req_async_handler_complete(async_req);
+        }
+    }
+    if (ret == ESP_OK) {
+        ws_clients[index].handle = req->handle;
+        ws_clients[index].fd = fd;
+        ws_clients[index].connected = true;
+        ws_clients[index].kind = CLIENT_KIND_SSE;
+        ws_clients[index].sse_req = async_req;
+        sse_client_count++;
+        sse_server = req->handle;
+        ESP_LOGI(TAG, "SSE client connected at index %d, fd=%d", index, fd);
     }
     xSemaphoreGive(ws_mutex);
+
+    free(event);
+    return ret;
 }
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""DNS load generator for the captive-portal DNS server.
+
+Keeps a fixed number of queries in flight against the server, then reports
+queries per second and latency percentiles. Works against the device
+(192.168.4.1:53) or the host build (see dns_host.c).
+
+Use --min-qps / --max-p99-ms to turn it into a regression check: the exit
+status is non-zero when a threshold is missed.
+"""
+import argparse
+import random
+import select
+import socket
+import struct
+import sys
+import time
+
+QTYPES = {"A": 1, "AAAA": 28, "PTR": 12, "HTTPS": 65}
+
+NAMES = [
+    "connectivitycheck.gstatic.com",
+    "captive.apple.com",
+    "www.msftconnecttest.com",
+    "detectportal.firefox.com",
+    "example.com",
+]
+
+
+def encode_name(name):
+    out = b""
+    for label in name.split("."):
+        out += bytes([len(label)]) + label.encode()
+    return out + b"\0"
+
+
+def build_query(qid, name, qtype, edns):
+    header = struct.pack(">HHHHHH", qid, 0x0100, 1, 0, 0, 1 if edns else 0)
+    question = encode_name(name) + struct.pack(">HH", qtype, 1)
+    opt = b"\0" + struct.pack(">HHBBHH", 41, 1232, 0, 0, 0, 0) if edns else b""
+    return header + question + opt
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return float("nan")
+    index = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[index]
+
+
+def run(args):
+    qtypes = [QTYPES[t] for t in args.qtypes.split(",")]
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setblocking(False)
+    sock.connect((args.server, args.port))
+
+    in_flight = {}      # id -> send time
+    latencies = []
+    sent = lost = errors = 0
+    next_id = random.randrange(0x10000)
+
+    def send_one():
+        nonlocal next_id, sent
+        while next_id in in_flight:
+            next_id = (next_id + 1) & 0xFFFF
+        qid = next_id
+        next_id = (next_id + 1) & 0xFFFF
+        query = build_query(qid, random.choice(NAMES), random.choice(qtypes), args.edns)
+        in_flight[qid] = time.perf_counter()
+        sock.send(query)
+        sent += 1
+
+    start = time.perf_counter()
+    deadline = start + args.duration
+    while True:
+        now = time.perf_counter()
+        if now >= deadline:
+            break
+        while len(in_flight) < args.concurrency:
+            send_one()
+
+        readable, _, _ = select.select([sock], [], [], 0.01)
+        if readable:
+            while True:
+                try:
+                    resp = sock.recv(2048)
+                except BlockingIOError:
+                    break
+                now = time.perf_counter()
+                if len(resp) < 12:
+                    errors += 1
+                    continue
+                qid, flags = struct.unpack(">HH", resp[:4])
+                sent_at = in_flight.pop(qid, None)
+                if sent_at is None:
+                    continue
+                if not flags & 0x8000:
+                    errors += 1
+                latencies.append(now - sent_at)
+
+        # Queries unanswered for too long count as lost and free their slot
+        expired = [qid for qid, t in in_flight.items() if now - t > args.timeout]
+        for qid in expired:
+            del in_flight[qid]
+            lost += 1
+
+    elapsed = time.perf_counter() - start
+    latencies.sort()
+    qps = len(latencies) / elapsed
+    p50 = percentile(latencies, 50) * 1000
+    p99 = percentile(latencies, 99) * 1000
+
+    print(f"server        {args.server}:{args.port}")
+    print(f"duration      {elapsed:.1f} s, concurrency {args.concurrency}")
+    print(f"sent          {sent}")
+    print(f"answered      {len(latencies)} ({qps:.0f} qps)")
+    print(f"lost          {lost}")
+    print(f"errors        {errors}")
+    print(f"latency p50   {p50:.3f} ms")
+    print(f"latency p99   {p99:.3f} ms")
+
+    failed = False
+    if args.min_qps and qps < args.min_qps:
+        print(f"FAIL: {qps:.0f} qps is below {args.min_qps}")
+        failed = True
+    if args.max_p99_ms and p99 > args.max_p99_ms:
+        print(f"FAIL: p99 {p99:.3f} ms is above {args.max_p99_ms} ms")
+        failed = True
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--server", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=53)
+    parser.add_argument("--duration", type=float, default=5.0, help="seconds")
+    parser.add_argument("--concurrency", type=int, default=16, help="queries kept in flight")
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds before a query counts as lost")
+    parser.add_argument("--qtypes", default="A,AAAA,HTTPS", help="comma-separated mix of " + ",".join(QTYPES))
+    parser.add_argument("--edns", action="store_true", help="send an EDNS0 OPT record")
+    parser.add_argument("--min-qps", type=float, default=0)
+    parser.add_argument("--max-p99-ms", type=float, default=0)
+    sys.exit(run(parser.parse_args()))
+
+
+if __name__ == "__main__":
+    main()
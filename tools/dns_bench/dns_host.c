@@ -0,0 +1,81 @@
+/*
+ * Host build of the DNS server (main/dns_server.c and main/dns_forwarder.c) for benchmarking.
+ *
+ * The server sources are compiled unmodified against the small ESP-IDF shim in
+ * shim/; sockets are the host's, so the numbers measure the parser, cache and
+ * response paths, not lwIP or Wi-Fi.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -DDNS_PORT=5353 -Itools/dns_bench/shim -Imain/include \
+ *       tools/dns_bench/dns_host.c main/dns_server.c main/dns_forwarder.c -lpthread -o /tmp/dns_host
+ *   /tmp/dns_host &
+ *   python3 tools/dns_bench/dns_bench.py --port 5353
+ *
+ * Environment:
+ *   DNS_HOST_AP_IP     SoftAP address handed out in captive answers (default 192.168.4.1)
+ *   DNS_HOST_STA_IP    Station address; when set, queries from outside the AP subnet
+ *                      (e.g. 127.0.0.1) go through the caching forwarder
+ *   DNS_HOST_UPSTREAM  Upstream resolver as ip:port, e.g. 127.0.0.1:5354 for fake_upstream.py
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "esp_netif.h"
+#include "dns_forwarder.h"
+#include "metrics.h"
+
+void dns_server_task(void *pvParameters);
+
+uint32_t metrics_counters[portNUM_PROCESSORS][METRIC_COUNTER_MAX];
+
+static const char *getenv_or(const char *name, const char *fallback)
+{
+    const char *value = getenv(name);
+    return value ? value : fallback;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    return (esp_netif_t *)if_key;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+    memset(ip_info, 0, sizeof(*ip_info));
+    if (strcmp((const char *)esp_netif, "WIFI_AP_DEF") == 0) {
+        ip_info->ip.addr = inet_addr(getenv_or("DNS_HOST_AP_IP", "192.168.4.1"));
+        ip_info->netmask.addr = inet_addr("255.255.255.0");
+    } else if (getenv("DNS_HOST_STA_IP")) {
+        ip_info->ip.addr = inet_addr(getenv("DNS_HOST_STA_IP"));
+        ip_info->netmask.addr = inet_addr("255.255.255.0");
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    (void)esp_netif;
+    (void)type;
+    memset(dns, 0, sizeof(*dns));
+    return ESP_FAIL;    // No DHCP on the host: use DNS_HOST_UPSTREAM
+}
+
+int main(void)
+{
+    srandom(getpid());     // Upstream query IDs come from esp_random()
+    const char *upstream = getenv("DNS_HOST_UPSTREAM");
+    if (upstream) {
+        char addr[32];
+        const char *colon = strchr(upstream, ':');
+        size_t n = colon ? (size_t)(colon - upstream) : strlen(upstream);
+        if (n >= sizeof(addr)) {
+            n = sizeof(addr) - 1;
+        }
+        memcpy(addr, upstream, n);
+        addr[n] = '\0';
+        dns_forwarder_set_upstream(inet_addr(addr), colon ? atoi(colon + 1) : 53);
+    }
+    dns_server_task(NULL);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Stand-in upstream resolver for testing the station-mode DNS forwarder.
+
+Answers A queries with a fixed address, names starting with "nx" with
+NXDOMAIN, and every other type with NODATA; negative answers carry an SOA so
+the forwarder may cache them. Each query received is logged, which makes cache
+hits (no log line) and coalescing (one line for many clients) visible.
+
+    python3 tools/dns_bench/fake_upstream.py --port 5354 --delay 0.2 &
+    DNS_HOST_STA_IP=192.168.1.50 DNS_HOST_UPSTREAM=127.0.0.1:5354 /tmp/dns_host &
+    python3 tools/dns_bench/dns_bench.py --port 5353 --qtypes A,AAAA
+"""
+import argparse
+import socket
+import struct
+import threading
+import time
+
+
+def skip_question(msg):
+    offset = 12
+    while msg[offset] != 0:
+        offset += msg[offset] + 1
+    return offset + 5
+
+
+def build_answer(query, args):
+    qid, flags = struct.unpack(">HH", query[:4])
+    question_end = skip_question(query)
+    name_len = question_end - 4 - 12
+    qtype = struct.unpack(">H", query[question_end - 4:question_end - 2])[0]
+    first_label = query[13:13 + query[12]].lower()
+
+    rcode = 0
+    answers = b""
+    authority = b""
+    if first_label.startswith(b"nx"):
+        rcode = 3
+    elif qtype == 1:
+        rdata = socket.inet_aton(args.address)
+        answers = struct.pack(">HHHIH", 0xC00C, 1, 1, args.ttl, len(rdata)) + rdata
+    if not answers:
+        soa = b"\0\0" + struct.pack(">IIIII", 1, 3600, 600, 86400, args.negative_ttl)
+        authority = struct.pack(">HHHIH", 0xC00C, 6, 1, args.negative_ttl, len(soa)) + soa
+
+    header = struct.pack(">HHHHHH", qid, 0x8180 | (flags & 0x0100) | rcode, 1,
+                         1 if answers else 0, 1 if authority else 0, 0)
+    return header + query[12:12 + name_len + 4] + answers + authority
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=5354)
+    parser.add_argument("--address", default="93.184.216.34", help="address returned for A queries")
+    parser.add_argument("--ttl", type=int, default=300)
+    parser.add_argument("--negative-ttl", type=int, default=60, help="SOA TTL and MINIMUM")
+    parser.add_argument("--delay", type=float, default=0.0, help="seconds to wait before answering")
+    parser.add_argument("--drop", action="store_true", help="never answer (exercises retries and SERVFAIL)")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", args.port))
+    received = 0
+    while True:
+        query, addr = sock.recvfrom(2048)
+        received += 1
+        print(f"{received:6d} {time.strftime('%H:%M:%S')} query id={struct.unpack('>H', query[:2])[0]:5d} "
+              f"{len(query)} bytes", flush=True)
+        if args.drop:
+            continue
+        response = build_answer(query, args)
+        if args.delay:
+            threading.Timer(args.delay, sock.sendto, (response, addr)).start()
+        else:
+            sock.sendto(response, addr)
+
+
+if __name__ == "__main__":
+    main()
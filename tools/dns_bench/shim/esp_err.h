@@ -0,0 +1,5 @@
+#pragma once
+/* Host shim: just enough of ESP-IDF to build main/dns_server.c on Linux */
+typedef int esp_err_t;
+#define ESP_OK    0
+#define ESP_FAIL -1
@@ -0,0 +1,10 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define portNUM_PROCESSORS 1
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))    // 1 tick = 1 ms on the host
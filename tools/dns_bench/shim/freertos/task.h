@@ -0,0 +1,32 @@
+#pragma once
+#include <pthread.h>
+#include "FreeRTOS.h"
+typedef pthread_t *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static inline void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(*task);
+}
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                     UBaseType_t prio, TaskHandle_t *handle)
+{
+    static pthread_t thread;
+    (void)name; (void)stack; (void)prio;
+    pthread_create(&thread, NULL, (void *(*)(void *))fn, arg);
+    if (handle) {
+        *handle = &thread;
+    }
+    return pdPASS;
+}
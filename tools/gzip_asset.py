@@ -0,0 +1,26 @@
+#!/usr/bin/env python3
+"""Compress a web asset for embedding into the firmware.
+
+The output is deterministic (no file name, mtime fixed to 0) so that the
+ETag derived from the compressed bytes only changes when the asset does.
+"""
+import gzip
+import sys
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write('usage: gzip_asset.py <input> <output>\n')
+        return 1
+
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(gzip.compress(data, compresslevel=9, mtime=0))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,614 @@
+/*
+ * Host harness for the USB keyboard typing engine (main/usb_hid.c).
+ *
+ * usb_hid.c, hid_program.c, keymap.c and payload_store.c are compiled
+ * unmodified against the shim in shim/ and the mock TinyUSB device below. A
+ * simulated host polls the keyboard endpoint once per interval, takes the
+ * queued report and completes it, like the USB controller does, and turns
+ * every new key-down into the character it types on the selected layout. The
+ * result is compared with the payload; for each typing strategy the harness
+ * prints characters per second, reports sent, keys dropped or extra, and the
+ * time from the request to the first key.
+ *
+ * Strategies:
+ *   program    Stored string typed from the keystroke program compiled when saving
+ *   text       Stored string compiled while typing (saved for another layout)
+ *   clipboard  Shared clipboard compiled from the snapshot while typing
+ *
+ * The layout tables themselves are checked by tools/keymap_check; here they
+ * are trusted for decoding, so this measures the compiler and the report loop.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -Itools/hid_bench/shim -Imain/include tools/hid_bench/hid_host.c \
+ *       main/usb_hid.c main/hid_program.c main/keymap.c main/payload_store.c \
+ *       main/usb_cdc.c main/usb_msc.c main/usb_hid_sync.c -lpthread -o /tmp/hid_host
+ *   /tmp/hid_host [-i poll_ms] [-l layout] [-e enum_ms] [-p] [-s strategy] [file] 2>/dev/null
+ *
+ *   -i  Host polling interval in ms, fractions allowed (default USB_HID_POLL_INTERVAL_MS)
+ *   -l  Keyboard layout: us, uk, de, fr (default us)
+ *   -e  Time the host takes to enumerate the device after it attaches (default 0)
+ *   -p  Persistent USB mode: the device is attached once, before the first request
+ *   -s  Run only this strategy
+ *
+ * Without a file a built-in sample is typed. The exit status is non-zero if a
+ * strategy dropped or garbled any key.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "nvs.h"
+#include "tinyusb.h"
+#include "soc/usb_serial_jtag_struct.h"
+#include "usb_hid.h"
+#include "keymap.h"
+#include "clipboard_service.h"
+#include "metrics.h"
+
+#define HOST_PARTITION_SIZE (1024 * 1024)
+#define HOST_REPORT_LEN     8
+#define HOST_IDLE_MS        200     // No report for this long after a release: typing is over
+#define HOST_START_MS       10000   // Give up when nothing is typed for this long
+
+uint32_t metrics_counters[portNUM_PROCESSORS][METRIC_COUNTER_MAX];
+usb_serial_jtag_dev_t USB_SERIAL_JTAG;
+
+/************* ESP-IDF services ****************/
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    static esp_partition_t partition;
+    (void)type; (void)subtype; (void)label;
+    if (partition.data == NULL) {
+        partition.size = HOST_PARTITION_SIZE;
+        partition.data = malloc(HOST_PARTITION_SIZE);
+        memset(partition.data, 0xff, HOST_PARTITION_SIZE);
+    }
+    return &partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t len)
+{
+    if (offset > part->size || len > part->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, part->data + offset, len);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset, const void *src, size_t len)
+{
+    if (offset > part->size || len > part->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(part->data + offset, src, len);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t len)
+{
+    if (offset > part->size || len > part->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(part->data + offset, 0xff, len);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    usleep(us);
+}
+
+// One namespace of u8 settings is all usb_hid.c keeps
+static struct {
+    char key[16];
+    uint8_t value;
+} s_nvs[8];
+
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    (void)ns; (void)mode;
+    *handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    (void)handle;
+    for (size_t i = 0; i < sizeof(s_nvs) / sizeof(s_nvs[0]); i++) {
+        if (s_nvs[i].key[0] == '\0' || strcmp(s_nvs[i].key, key) == 0) {
+            snprintf(s_nvs[i].key, sizeof(s_nvs[i].key), "%s", key);
+            s_nvs[i].value = value;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value)
+{
+    (void)handle;
+    for (size_t i = 0; i < sizeof(s_nvs) / sizeof(s_nvs[0]); i++) {
+        if (strcmp(s_nvs[i].key, key) == 0) {
+            *value = s_nvs[i].value;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *len)
+{
+    (void)handle; (void)key; (void)value; (void)len;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    (void)handle; (void)key;
+    return ESP_OK;
+}
+
+/************* Clipboard ****************/
+
+static clipboard_snapshot_t s_clipboard = { .version = 1, .content = "", .content_type = "text/plain" };
+
+const clipboard_snapshot_t *clipboard_service_acquire(void)
+{
+    return &s_clipboard;
+}
+
+void clipboard_service_release(const clipboard_snapshot_t *snap)
+{
+    (void)snap;
+}
+
+/************* Mock TinyUSB device and polling host ****************/
+
+static pthread_mutex_t s_usb_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool s_attached = false;
+static int64_t s_attach_us = 0;
+static int64_t s_enum_us = 0;           // Enumeration time after attaching
+static int64_t s_poll_ns = 1000000;
+static bool s_report_queued = false;    // Report waiting for the next poll
+static uint8_t s_report[HOST_REPORT_LEN];
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t *config)
+{
+    (void)config;
+    pthread_mutex_lock(&s_usb_lock);
+    s_attached = true;
+    s_attach_us = esp_timer_get_time();
+    s_report_queued = false;
+    pthread_mutex_unlock(&s_usb_lock);
+    return ESP_OK;
+}
+
+esp_err_t tinyusb_driver_uninstall(void)
+{
+    pthread_mutex_lock(&s_usb_lock);
+    s_attached = false;
+    pthread_mutex_unlock(&s_usb_lock);
+    return ESP_OK;
+}
+
+static bool mounted_locked(void)
+{
+    return s_attached && esp_timer_get_time() - s_attach_us >= s_enum_us;
+}
+
+bool tud_mounted(void)
+{
+    pthread_mutex_lock(&s_usb_lock);
+    bool mounted = mounted_locked();
+    pthread_mutex_unlock(&s_usb_lock);
+    return mounted;
+}
+
+bool tud_hid_n_ready(uint8_t instance)
+{
+    pthread_mutex_lock(&s_usb_lock);
+    bool ready = instance == 0 && mounted_locked() && !s_report_queued;
+    pthread_mutex_unlock(&s_usb_lock);
+    return ready;
+}
+
+bool tud_hid_n_keyboard_report(uint8_t instance, uint8_t report_id, uint8_t modifier, const uint8_t keycode[6])
+{
+    (void)report_id;
+    pthread_mutex_lock(&s_usb_lock);
+    bool queued = instance == 0 && mounted_locked() && !s_report_queued;
+    if (queued) {
+        s_report[0] = modifier;
+        s_report[1] = 0;
+        memcpy(s_report + 2, keycode, 6);
+        s_report_queued = true;
+    }
+    pthread_mutex_unlock(&s_usb_lock);
+    return queued;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len)
+{
+    (void)instance; (void)report_id; (void)report; (void)len;
+    return false;
+}
+
+/*
+ * What the host makes of the reports. s_rev[modifier][key] is the character a
+ * key types, from the layout table; a dead key waits for the next key-down and
+ * yields its own character when that is Space.
+ */
+#define REV_DEAD 0x8000
+
+static uint16_t s_rev[256][256];    // Code point + 1, | REV_DEAD; 0 = nothing
+
+typedef struct {
+    uint8_t held[6];
+    uint16_t dead;                  // Pending dead key character, 0 if none
+    uint32_t *text;
+    size_t len;
+    size_t cap;
+    size_t reports;
+    size_t keydowns;
+    size_t unknown;                 // Key-downs the layout does not type anything with
+    int64_t first_key_us;
+    int64_t last_report_us;
+    bool last_empty;
+} host_decoder_t;
+
+static host_decoder_t s_host;
+
+static void host_build_rev(const keymap_key_t *table)
+{
+    memset(s_rev, 0, sizeof(s_rev));
+    for (uint32_t cp = 0; cp < KEYMAP_TABLE_SIZE; cp++) {
+        keymap_key_t key = table[cp];
+        uint8_t mod = key.modifier & ~KEYMAP_DEAD;
+        // The lowest code point wins, e.g. '\n' over '\r' for Enter
+        if (key.keycode != 0 && s_rev[mod][key.keycode] == 0) {
+            s_rev[mod][key.keycode] = (cp + 1) | ((key.modifier & KEYMAP_DEAD) ? REV_DEAD : 0);
+        }
+    }
+}
+
+static void host_emit(uint32_t cp)
+{
+    if (s_host.len == s_host.cap) {
+        s_host.cap = s_host.cap ? s_host.cap * 2 : 4096;
+        s_host.text = realloc(s_host.text, s_host.cap * sizeof(uint32_t));
+    }
+    s_host.text[s_host.len++] = cp;
+}
+
+static void host_key_down(uint8_t modifier, uint8_t keycode)
+{
+    s_host.keydowns++;
+    uint16_t entry = s_rev[modifier][keycode];
+    if (s_host.dead) {
+        host_emit(s_host.dead - 1);
+        s_host.dead = 0;
+        if (keycode == HID_KEY_SPACE && modifier == 0) {
+            return;
+        }
+    }
+    if (entry == 0) {
+        s_host.unknown++;
+    } else if (entry & REV_DEAD) {
+        s_host.dead = entry & ~REV_DEAD;
+    } else {
+        host_emit(entry - 1);
+    }
+}
+
+static void host_decode(const uint8_t *report, int64_t now)
+{
+    const uint8_t *keys = report + 2;
+    bool empty = true;
+    for (int i = 0; i < 6; i++) {
+        if (keys[i] == 0) {
+            continue;
+        }
+        empty = false;
+        if (memchr(s_host.held, keys[i], sizeof(s_host.held)) == NULL) {
+            if (s_host.first_key_us == 0) {
+                s_host.first_key_us = now;
+            }
+            host_key_down(report[0], keys[i]);
+        }
+    }
+    memcpy(s_host.held, keys, sizeof(s_host.held));
+    s_host.reports++;
+    s_host.last_report_us = now;
+    s_host.last_empty = empty;
+}
+
+/* The host controller: one IN token per interval, on a fixed schedule */
+static void *host_poll_thread(void *arg)
+{
+    (void)arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        next.tv_nsec += s_poll_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        uint8_t report[HOST_REPORT_LEN];
+        pthread_mutex_lock(&s_usb_lock);
+        bool polled = s_report_queued && mounted_locked();
+        if (polled) {
+            memcpy(report, s_report, sizeof(report));
+            s_report_queued = false;
+            host_decode(report, esp_timer_get_time());
+        }
+        pthread_mutex_unlock(&s_usb_lock);
+        if (polled) {
+            tud_hid_report_complete_cb(0, report, sizeof(report));
+        }
+    }
+    return NULL;
+}
+
+/************* Runs ****************/
+
+typedef enum {
+    STRATEGY_PROGRAM,
+    STRATEGY_TEXT,
+    STRATEGY_CLIPBOARD,
+    STRATEGY_MAX
+} strategy_t;
+
+static const char *const s_strategy_names[STRATEGY_MAX] = { "program", "text", "clipboard" };
+
+static const char s_sample[] =
+    "The quick brown fox jumps over the lazy dog. THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG!\n"
+    "0123456789 ~!@#$%^&*()_+ `-=[]\\{}|;':\",./<>?\n"
+    "Bookkeeper committee: aa bb ccc dddd eeeee, \"all keys repeat\" -- sells ssh https://example.com/a?b=c&d=e\n"
+    "int main(void) { return printf(\"%d\\n\", 42) > 0 ? 0 : 1; }\n"
+    "Caf\xc3\xa9 na\xc3\xafve \xc3\xbc\xc3\xb6\xc3\xa4 \xc3\x9f \xc2\xa3 \xc2\xb0 \xc2\xa7 \xc2\xb5 \xc3\xa0\xc3\xa8\xc3\xb9 \xc3\xa7 ^^ `` \xc2\xb4\n";
+
+/* Expected host text: what each typeable character of the payload comes out as */
+static uint32_t *expected_text(const char *payload, size_t len, const keymap_key_t *table, size_t *out_len)
+{
+    uint32_t *text = malloc((len + 1) * sizeof(uint32_t));
+    keymap_utf8_t utf8 = { 0 };
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t cp;
+        if (!keymap_utf8_decode(&utf8, (uint8_t)payload[i], &cp)) {
+            continue;
+        }
+        keymap_key_t key = keymap_lookup(table, cp);
+        if (key.keycode != 0) {
+            uint16_t entry = s_rev[key.modifier & ~KEYMAP_DEAD][key.keycode];
+            text[n++] = (entry & ~REV_DEAD) - 1;
+        }
+    }
+    *out_len = n;
+    return text;
+}
+
+/*
+ * Align the decoded text with the expected one. Keys go missing rather than
+ * appear, so a greedy walk is exact for drops; whatever does not line up is
+ * counted as extra.
+ */
+static void compare_text(const uint32_t *expected, size_t expected_len, size_t *dropped, size_t *extra)
+{
+    size_t i = 0;
+    size_t j = 0;
+    *dropped = 0;
+    *extra = 0;
+    while (i < s_host.len && j < expected_len) {
+        if (s_host.text[i] == expected[j]) {
+            i++;
+            j++;
+        } else if (j + 1 < expected_len && s_host.text[i] == expected[j + 1]) {
+            (*dropped)++;
+            j++;
+        } else {
+            (*extra)++;
+            i++;
+        }
+    }
+    *dropped += expected_len - j;
+    *extra += s_host.len - i;
+}
+
+static void save_payload(const char *payload, const char *layout, const char *save_layout)
+{
+    usb_hid_set_layout(save_layout);
+    if (usb_hid_save_string(payload) != ESP_OK) {
+        fprintf(stderr, "Saving the payload failed\n");
+        exit(2);
+    }
+    usb_hid_set_layout(layout);
+}
+
+/* Type the payload once; returns false if anything was dropped or garbled */
+static bool run_strategy(strategy_t strategy, const char *payload, const char *layout, const keymap_key_t *table)
+{
+    if (strategy == STRATEGY_PROGRAM) {
+        save_payload(payload, layout, layout);
+    } else if (strategy == STRATEGY_TEXT) {
+        // A program compiled for another layout is not used: the text is compiled again while typing
+        save_payload(payload, layout, strcmp(layout, "us") == 0 ? "uk" : "us");
+    } else {
+        s_clipboard.content = payload;
+        s_clipboard.len = strlen(payload);
+        s_clipboard.version++;
+    }
+
+    pthread_mutex_lock(&s_usb_lock);
+    free(s_host.text);
+    memset(&s_host, 0, sizeof(s_host));
+    pthread_mutex_unlock(&s_usb_lock);
+    memset(metrics_counters, 0, sizeof(metrics_counters));
+
+    usb_hid_set_enabled(true);
+    int64_t start = esp_timer_get_time();
+    if (strategy == STRATEGY_CLIPBOARD) {
+        usb_hid_type_clipboard();
+    } else {
+        usb_hid_send_string();
+    }
+
+    int64_t idle_us = HOST_IDLE_MS * 1000LL + 20 * s_poll_ns / 1000;
+    while (1) {
+        usleep(10000);
+        pthread_mutex_lock(&s_usb_lock);
+        int64_t now = esp_timer_get_time();
+        bool done = s_host.reports > 0 ? s_host.last_empty && now - s_host.last_report_us > idle_us
+                                       : now - start > HOST_START_MS * 1000LL;
+        pthread_mutex_unlock(&s_usb_lock);
+        if (done) {
+            break;
+        }
+    }
+    usb_hid_set_enabled(false);
+
+    size_t expected_len;
+    size_t dropped;
+    size_t extra;
+    uint32_t *expected = expected_text(payload, strlen(payload), table, &expected_len);
+    compare_text(expected, expected_len, &dropped, &extra);
+    free(expected);
+
+    double seconds = s_host.reports ? (s_host.last_report_us - start) / 1e6 : 0;
+    printf("%-10s %7zu %8zu %9.2f %9.1f %9.1f %8zu %6zu\n", s_strategy_names[strategy], s_host.len,
+           s_host.reports, s_host.reports ? (double)s_host.keydowns / s_host.reports : 0,
+           seconds > 0 ? s_host.len / seconds : 0,
+           s_host.first_key_us ? (s_host.first_key_us - start) / 1000.0 : 0, dropped, extra + s_host.unknown);
+    if (metrics_counters[0][METRIC_HID_REPORTS_SENT] != s_host.reports) {
+        printf("  firmware counted %lu reports, host saw %zu\n",
+               (unsigned long)metrics_counters[0][METRIC_HID_REPORTS_SENT], s_host.reports);
+    }
+    return dropped == 0 && extra == 0 && s_host.unknown == 0 && s_host.len == expected_len;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    size_t cap = 65536;
+    size_t len = 0;
+    char *data = malloc(cap + 1);
+    size_t n;
+    while ((n = fread(data + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            data = realloc(data, cap + 1);
+        }
+    }
+    fclose(f);
+    data[len] = '\0';
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    double poll_ms = USB_HID_POLL_INTERVAL_MS;
+    const char *layout = "us";
+    bool persistent = false;
+    int only = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:l:e:ps:")) != -1) {
+        switch (opt) {
+        case 'i':
+            poll_ms = atof(optarg);
+            break;
+        case 'l':
+            layout = optarg;
+            break;
+        case 'e':
+            s_enum_us = atol(optarg) * 1000LL;
+            break;
+        case 'p':
+            persistent = true;
+            break;
+        case 's':
+            for (int i = 0; i < STRATEGY_MAX; i++) {
+                if (strcmp(optarg, s_strategy_names[i]) == 0) {
+                    only = i;
+                }
+            }
+            if (only < 0) {
+                fprintf(stderr, "Unknown strategy %s\n", optarg);
+                return 2;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-i poll_ms] [-l layout] [-e enum_ms] [-p] [-s strategy] [file]\n", argv[0]);
+            return 2;
+        }
+    }
+    keymap_layout_t layout_id;
+    if (poll_ms <= 0 || !keymap_layout_from_name(layout, &layout_id)) {
+        fprintf(stderr, "Bad polling interval or layout\n");
+        return 2;
+    }
+    s_poll_ns = (int64_t)(poll_ms * 1e6);
+    const char *payload = optind < argc ? read_file(argv[optind]) : s_sample;
+    const keymap_key_t *table = keymap_get_table(layout_id);
+    host_build_rev(table);
+
+    pthread_t host;
+    pthread_create(&host, NULL, host_poll_thread, NULL);
+    usb_hid_init();
+    usb_hid_load_string();
+    if (persistent) {
+        // Attached at boot: the host has long enumerated the device by the first request
+        usb_hid_set_persistent(true);
+        usleep(s_enum_us);
+    }
+
+    printf("layout %s, poll %.3f ms, enumeration %lld ms, %s mode, %zu bytes\n", layout, poll_ms,
+           (long long)(s_enum_us / 1000), persistent ? "persistent" : "on-demand", strlen(payload));
+    printf("%-10s %7s %8s %9s %9s %9s %8s %6s\n", "strategy", "chars", "reports", "keys/rpt", "chars/s",
+           "first ms", "dropped", "extra");
+    bool ok = true;
+    for (int i = 0; i < STRATEGY_MAX; i++) {
+        if (only < 0 || only == i) {
+            ok &= run_strategy((strategy_t)i, payload, layout, table);
+        }
+    }
+    return ok ? 0 : 1;
+}
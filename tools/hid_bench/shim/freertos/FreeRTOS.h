@@ -0,0 +1,54 @@
+#pragma once
+/*
+ * Host shim: FreeRTOS on pthreads. 1 tick = 1 ms; blocking calls wait on a
+ * condition variable with a CLOCK_MONOTONIC deadline.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define portNUM_PROCESSORS 1
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY      UINT32_MAX
+#define pdFALSE            0
+#define pdTRUE             1
+#define pdPASS             1
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+
+static inline void shim_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Wait on cond (mutex held) until woken or the deadline; returns false on timeout */
+static inline bool shim_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline)
+{
+    if (deadline == NULL) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) == 0;
+}
+
+/* Deadline ticks from now; NULL (wait forever) for portMAX_DELAY */
+static inline const struct timespec *shim_deadline(struct timespec *ts, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ticks / 1000;
+    ts->tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+    return ts;
+}
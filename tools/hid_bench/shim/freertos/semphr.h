@@ -0,0 +1,48 @@
+#pragma once
+#include <stdlib.h>
+#include "FreeRTOS.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned count;
+} shim_semaphore_t;
+typedef shim_semaphore_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t shim_semaphore_create(unsigned count)
+{
+    shim_semaphore_t *sem = calloc(1, sizeof(*sem));
+    pthread_mutex_init(&sem->lock, NULL);
+    shim_cond_init(&sem->cond);
+    sem->count = count;
+    return sem;
+}
+
+// A mutex is a binary semaphore that starts given; no priority inheritance on the host
+#define xSemaphoreCreateBinary() shim_semaphore_create(0)
+#define xSemaphoreCreateMutex()  shim_semaphore_create(1)
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    struct timespec ts;
+    const struct timespec *deadline = shim_deadline(&ts, ticks);
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count == 0 && ticks != 0 && shim_cond_wait(&sem->cond, &sem->lock, deadline)) {
+    }
+    BaseType_t got = sem->count > 0;
+    if (got) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return got;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    BaseType_t given = sem->count == 0;
+    sem->count = 1;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+    return given;
+}
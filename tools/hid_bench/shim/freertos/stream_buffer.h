@@ -0,0 +1,96 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *data;
+    size_t size;
+    size_t head;        // Next byte to read
+    size_t used;
+} shim_stream_t;
+typedef shim_stream_t *StreamBufferHandle_t;
+
+static inline StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger)
+{
+    (void)trigger;      // Always 1 in the firmware
+    shim_stream_t *sb = calloc(1, sizeof(*sb));
+    sb->data = malloc(size);
+    sb->size = size;
+    pthread_mutex_init(&sb->lock, NULL);
+    shim_cond_init(&sb->cond);
+    return sb;
+}
+
+/* Writes as much as fits, waiting for space until the timeout */
+static inline size_t xStreamBufferSend(StreamBufferHandle_t sb, const void *data, size_t len, TickType_t ticks)
+{
+    struct timespec ts;
+    const struct timespec *deadline = shim_deadline(&ts, ticks);
+    const uint8_t *src = data;
+    size_t sent = 0;
+    pthread_mutex_lock(&sb->lock);
+    while (sent < len) {
+        while (sb->used == sb->size) {
+            if (ticks == 0 || !shim_cond_wait(&sb->cond, &sb->lock, deadline)) {
+                goto out;
+            }
+        }
+        size_t tail = (sb->head + sb->used) % sb->size;
+        size_t n = sb->size - sb->used;
+        if (n > sb->size - tail) n = sb->size - tail;
+        if (n > len - sent) n = len - sent;
+        memcpy(sb->data + tail, src + sent, n);
+        sb->used += n;
+        sent += n;
+        pthread_cond_broadcast(&sb->cond);
+    }
+out:
+    pthread_mutex_unlock(&sb->lock);
+    return sent;
+}
+
+static inline size_t xStreamBufferReceive(StreamBufferHandle_t sb, void *buf, size_t len, TickType_t ticks)
+{
+    struct timespec ts;
+    const struct timespec *deadline = shim_deadline(&ts, ticks);
+    uint8_t *dst = buf;
+    size_t got = 0;
+    pthread_mutex_lock(&sb->lock);
+    while (sb->used == 0 && ticks != 0 && shim_cond_wait(&sb->cond, &sb->lock, deadline)) {
+    }
+    while (got < len && sb->used > 0) {
+        size_t n = sb->size - sb->head;
+        if (n > sb->used) n = sb->used;
+        if (n > len - got) n = len - got;
+        memcpy(dst + got, sb->data + sb->head, n);
+        sb->head = (sb->head + n) % sb->size;
+        sb->used -= n;
+        got += n;
+    }
+    if (got > 0) {
+        pthread_cond_broadcast(&sb->cond);
+    }
+    pthread_mutex_unlock(&sb->lock);
+    return got;
+}
+
+static inline BaseType_t xStreamBufferIsEmpty(StreamBufferHandle_t sb)
+{
+    pthread_mutex_lock(&sb->lock);
+    BaseType_t empty = sb->used == 0;
+    pthread_mutex_unlock(&sb->lock);
+    return empty;
+}
+
+static inline BaseType_t xStreamBufferReset(StreamBufferHandle_t sb)
+{
+    pthread_mutex_lock(&sb->lock);
+    sb->head = 0;
+    sb->used = 0;
+    pthread_cond_broadcast(&sb->cond);
+    pthread_mutex_unlock(&sb->lock);
+    return pdPASS;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <stdlib.h>
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef enum { eNoAction, eSetBits } eNotifyAction;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t bits;
+    bool pending;
+} shim_task_t;
+typedef shim_task_t *TaskHandle_t;
+
+static __thread shim_task_t *shim_current_task;
+
+typedef struct {
+    TaskFunction_t fn;
+    void *arg;
+    shim_task_t *task;
+} shim_task_start_t;
+
+static inline void *shim_task_entry(void *p)
+{
+    shim_task_start_t start = *(shim_task_start_t *)p;
+    free(p);
+    shim_current_task = start.task;
+    start.fn(start.arg);
+    return NULL;
+}
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { ticks / 1000, (long)(ticks % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                     UBaseType_t prio, TaskHandle_t *handle)
+{
+    (void)name; (void)stack; (void)prio;
+    shim_task_t *task = calloc(1, sizeof(*task));
+    shim_task_start_t *start = malloc(sizeof(*start));
+    pthread_mutex_init(&task->lock, NULL);
+    shim_cond_init(&task->cond);
+    *start = (shim_task_start_t){ fn, arg, task };
+    if (handle) {
+        *handle = task;
+    }
+    pthread_create(&task->thread, NULL, shim_task_entry, start);
+    return pdPASS;
+}
+
+static inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t bits, eNotifyAction action)
+{
+    (void)action;
+    pthread_mutex_lock(&task->lock);
+    task->bits |= bits;
+    task->pending = true;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+static inline BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value,
+                                         TickType_t ticks)
+{
+    shim_task_t *task = shim_current_task;
+    struct timespec ts;
+    const struct timespec *deadline = shim_deadline(&ts, ticks);
+    pthread_mutex_lock(&task->lock);
+    if (!task->pending) {
+        task->bits &= ~clear_on_entry;
+    }
+    while (!task->pending && shim_cond_wait(&task->cond, &task->lock, deadline)) {
+    }
+    BaseType_t got = task->pending;
+    if (value) {
+        *value = task->bits;
+    }
+    if (got) {
+        task->bits &= ~clear_on_exit;
+        task->pending = false;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return got;
+}
@@ -0,0 +1,5 @@
+#pragma once
+/* Host shim: keyboard interface only; the CDC, MSC and HID sync channels build as no-ops */
+#define CONFIG_TINYUSB_CDC_ENABLED 0
+#define CONFIG_TINYUSB_MSC_ENABLED 0
+#define CONFIG_TINYUSB_HID_COUNT 1
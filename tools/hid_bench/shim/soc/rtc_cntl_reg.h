@@ -0,0 +1,5 @@
+#pragma once
+#include "soc/usb_serial_jtag_reg.h"
+#define RTC_CNTL_USB_CONF_REG       0
+#define RTC_CNTL_SW_HW_USB_PHY_SEL  0
+#define RTC_CNTL_SW_USB_PHY_SEL     0
@@ -0,0 +1,10 @@
+#pragma once
+#include "soc/usb_serial_jtag_reg.h"
+#define SYSTEM_PERIP_RST_EN0_REG  0
+#define SYSTEM_PERIP_RST_EN1_REG  0
+#define SYSTEM_PERIP_CLK_EN0_REG  0
+#define SYSTEM_PERIP_CLK_EN1_REG  0
+#define SYSTEM_USB_RST            0
+#define SYSTEM_USB_CLK_EN         0
+#define SYSTEM_USB_DEVICE_CLK_EN  0
+#define SYSTEM_USB_DEVICE_RST     0
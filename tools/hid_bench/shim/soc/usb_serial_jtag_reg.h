@@ -0,0 +1,4 @@
+#pragma once
+/* Host shim: the PHY switch in main/usb_hid.c touches registers; on the host it does nothing */
+#define SET_PERI_REG_MASK(reg, mask)   ((void)0)
+#define CLEAR_PERI_REG_MASK(reg, mask) ((void)0)
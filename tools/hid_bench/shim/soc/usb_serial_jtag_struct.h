@@ -0,0 +1,8 @@
+#pragma once
+typedef struct {
+    struct {
+        int phy_sel;
+        int usb_pad_enable;
+    } conf0;
+} usb_serial_jtag_dev_t;
+extern usb_serial_jtag_dev_t USB_SERIAL_JTAG;
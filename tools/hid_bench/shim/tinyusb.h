@@ -0,0 +1,16 @@
+#pragma once
+#include "esp_err.h"
+#include "tusb.h"
+
+typedef struct {
+    struct {
+        const void *device;
+        const uint8_t *full_speed_config;
+        const uint8_t *high_speed_config;
+        const char **string;
+        int string_count;
+    } descriptor;
+} tinyusb_config_t;
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t *config);
+esp_err_t tinyusb_driver_uninstall(void);
@@ -0,0 +1,2 @@
+#pragma once
+#define TINYUSB_DEFAULT_CONFIG() { 0 }
@@ -0,0 +1,24 @@
+#pragma once
+/*
+ * Host shim: descriptor macros only have to produce some bytes, the device
+ * functions are the mock in hid_host.c
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "class/hid/hid.h"
+
+#define TUD_OPT_HIGH_SPEED                   0
+#define TUD_CONFIG_DESC_LEN                  9
+#define TUD_HID_DESC_LEN                     25
+#define TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP   0x20
+#define TUD_CONFIG_DESCRIPTOR(...)           9, 2
+#define TUD_HID_DESCRIPTOR(...)              9, 4
+#define TUD_HID_REPORT_DESC_KEYBOARD(...)    0x05, 0x01
+
+bool tud_mounted(void);
+bool tud_hid_n_ready(uint8_t instance);
+bool tud_hid_n_keyboard_report(uint8_t instance, uint8_t report_id, uint8_t modifier, const uint8_t keycode[6]);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len);
+
+// Implemented by main/usb_hid.c
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
@@ -0,0 +1,341 @@
+/*
+ * Host check for the keyboard layout tables (main/keymap.c).
+ *
+ * For every layout, each character in the table is typed on a model of that
+ * layout (which character each key produces, plain / Shift / AltGr) and must
+ * come back unchanged; every printable ASCII character must be typeable. The
+ * US table must also agree with the switch-based char_to_hid() it replaced,
+ * kept below as legacy_char_to_hid(). Finally both are timed on the same text.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -Itools/keymap_check/shim -Imain/include \
+ *       tools/keymap_check/keymap_check.c main/keymap.c -o /tmp/keymap_check
+ *   /tmp/keymap_check
+ *
+ * The exit status is non-zero if any check fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "class/hid/hid.h"
+#include "keymap.h"
+
+#define SHIFT KEYBOARD_MODIFIER_LEFTSHIFT
+#define ALTGR KEYBOARD_MODIFIER_RIGHTALT
+
+/* What one key types on the host: plain, with Shift, with AltGr (0 = nothing) */
+typedef struct {
+    uint8_t keycode;
+    uint8_t plain;
+    uint8_t shift;
+    uint8_t altgr;
+} key_output_t;
+
+/* Keys whose output differs between layouts; letters are added separately */
+static const key_output_t model_us[] = {
+    { HID_KEY_GRAVE, '`', '~', 0 },
+    { HID_KEY_1, '1', '!', 0 }, { HID_KEY_2, '2', '@', 0 }, { HID_KEY_3, '3', '#', 0 },
+    { HID_KEY_4, '4', '$', 0 }, { HID_KEY_5, '5', '%', 0 }, { HID_KEY_6, '6', '^', 0 },
+    { HID_KEY_7, '7', '&', 0 }, { HID_KEY_8, '8', '*', 0 }, { HID_KEY_9, '9', '(', 0 },
+    { HID_KEY_0, '0', ')', 0 }, { HID_KEY_MINUS, '-', '_', 0 }, { HID_KEY_EQUAL, '=', '+', 0 },
+    { HID_KEY_BRACKET_LEFT, '[', '{', 0 }, { HID_KEY_BRACKET_RIGHT, ']', '}', 0 },
+    { HID_KEY_BACKSLASH, '\\', '|', 0 },
+    { HID_KEY_SEMICOLON, ';', ':', 0 }, { HID_KEY_APOSTROPHE, '\'', '"', 0 },
+    { HID_KEY_COMMA, ',', '<', 0 }, { HID_KEY_PERIOD, '.', '>', 0 }, { HID_KEY_SLASH, '/', '?', 0 },
+    { 0 }
+};
+
+static const key_output_t model_uk[] = {
+    { HID_KEY_GRAVE, '`', 0xAC, 0xA6 },
+    { HID_KEY_1, '1', '!', 0 }, { HID_KEY_2, '2', '"', 0 }, { HID_KEY_3, '3', 0xA3, 0 },
+    { HID_KEY_4, '4', '$', 0 }, { HID_KEY_5, '5', '%', 0 }, { HID_KEY_6, '6', '^', 0 },
+    { HID_KEY_7, '7', '&', 0 }, { HID_KEY_8, '8', '*', 0 }, { HID_KEY_9, '9', '(', 0 },
+    { HID_KEY_0, '0', ')', 0 }, { HID_KEY_MINUS, '-', '_', 0 }, { HID_KEY_EQUAL, '=', '+', 0 },
+    { HID_KEY_BRACKET_LEFT, '[', '{', 0 }, { HID_KEY_BRACKET_RIGHT, ']', '}', 0 },
+    { HID_KEY_EUROPE_1, '#', '~', 0 }, { HID_KEY_EUROPE_2, '\\', '|', 0 },
+    { HID_KEY_SEMICOLON, ';', ':', 0 }, { HID_KEY_APOSTROPHE, '\'', '@', 0 },
+    { HID_KEY_COMMA, ',', '<', 0 }, { HID_KEY_PERIOD, '.', '>', 0 }, { HID_KEY_SLASH, '/', '?', 0 },
+    { 0 }
+};
+
+static const key_output_t model_de[] = {
+    { HID_KEY_GRAVE, '^', 0xB0, 0 },
+    { HID_KEY_1, '1', '!', 0 }, { HID_KEY_2, '2', '"', 0xB2 }, { HID_KEY_3, '3', 0xA7, 0xB3 },
+    { HID_KEY_4, '4', '$', 0 }, { HID_KEY_5, '5', '%', 0 }, { HID_KEY_6, '6', '&', 0 },
+    { HID_KEY_7, '7', '/', '{' }, { HID_KEY_8, '8', '(', '[' }, { HID_KEY_9, '9', ')', ']' },
+    { HID_KEY_0, '0', '=', '}' }, { HID_KEY_MINUS, 0xDF, '?', '\\' }, { HID_KEY_EQUAL, 0xB4, '`', 0 },
+    { HID_KEY_BRACKET_LEFT, 0xFC, 0xDC, 0 }, { HID_KEY_BRACKET_RIGHT, '+', '*', '~' },
+    { HID_KEY_EUROPE_1, '#', '\'', 0 }, { HID_KEY_EUROPE_2, '<', '>', '|' },
+    { HID_KEY_SEMICOLON, 0xF6, 0xD6, 0 }, { HID_KEY_APOSTROPHE, 0xE4, 0xC4, 0 },
+    { HID_KEY_COMMA, ',', ';', 0 }, { HID_KEY_PERIOD, '.', ':', 0 }, { HID_KEY_SLASH, '-', '_', 0 },
+    { HID_KEY_Q, 'q', 'Q', '@' }, { HID_KEY_M, 'm', 'M', 0xB5 },
+    { HID_KEY_Y, 'z', 'Z', 0 }, { HID_KEY_Z, 'y', 'Y', 0 },
+    { 0 }
+};
+
+static const key_output_t model_fr[] = {
+    { HID_KEY_GRAVE, 0xB2, 0, 0 },
+    { HID_KEY_1, '&', '1', 0 }, { HID_KEY_2, 0xE9, '2', '~' }, { HID_KEY_3, '"', '3', '#' },
+    { HID_KEY_4, '\'', '4', '{' }, { HID_KEY_5, '(', '5', '[' }, { HID_KEY_6, '-', '6', '|' },
+    { HID_KEY_7, 0xE8, '7', '`' }, { HID_KEY_8, '_', '8', '\\' }, { HID_KEY_9, 0xE7, '9', '^' },
+    { HID_KEY_0, 0xE0, '0', '@' }, { HID_KEY_MINUS, ')', 0xB0, ']' }, { HID_KEY_EQUAL, '=', '+', '}' },
+    { HID_KEY_BRACKET_LEFT, '^', 0xA8, 0 }, { HID_KEY_BRACKET_RIGHT, '$', 0xA3, 0xA4 },
+    { HID_KEY_EUROPE_1, '*', 0xB5, 0 }, { HID_KEY_EUROPE_2, '<', '>', 0 },
+    { HID_KEY_SEMICOLON, 'm', 'M', 0 }, { HID_KEY_APOSTROPHE, 0xF9, '%', 0 },
+    { HID_KEY_M, ',', '?', 0 }, { HID_KEY_COMMA, ';', '.', 0 }, { HID_KEY_PERIOD, ':', '/', 0 },
+    { HID_KEY_SLASH, '!', 0xA7, 0 },
+    { HID_KEY_A, 'q', 'Q', 0 }, { HID_KEY_Q, 'a', 'A', 0 },
+    { HID_KEY_W, 'z', 'Z', 0 }, { HID_KEY_Z, 'w', 'W', 0 },
+    { 0 }
+};
+
+static const key_output_t *const models[KEYMAP_LAYOUT_MAX] = {
+    [KEYMAP_LAYOUT_US] = model_us,
+    [KEYMAP_LAYOUT_UK] = model_uk,
+    [KEYMAP_LAYOUT_DE] = model_de,
+    [KEYMAP_LAYOUT_FR] = model_fr,
+};
+
+/* Character typed by a key on the modelled layout, or -1 */
+static int model_type(const key_output_t *model, uint8_t modifier, uint8_t keycode)
+{
+    modifier &= ~KEYMAP_DEAD;   // Dead key + Space gives the key's own character
+    for (const key_output_t *k = model; k->keycode; k++) {
+        if (k->keycode == keycode) {
+            uint8_t c = modifier == 0 ? k->plain : modifier == SHIFT ? k->shift :
+                        modifier == ALTGR ? k->altgr : 0;
+            return c ? c : -1;
+        }
+    }
+    // Letters not listed by the layout are on their QWERTY keys
+    if (keycode >= HID_KEY_A && keycode <= HID_KEY_Z) {
+        if (modifier == 0) {
+            return 'a' + keycode - HID_KEY_A;
+        } else if (modifier == SHIFT) {
+            return 'A' + keycode - HID_KEY_A;
+        }
+    }
+    if (keycode == HID_KEY_SPACE && modifier == 0) {
+        return ' ';
+    }
+    if (keycode == HID_KEY_ENTER && modifier == 0) {
+        return '\n';
+    }
+    return -1;
+}
+
+/* The switch keymap_us replaced, verbatim */
+static void legacy_char_to_hid(char c, uint8_t *modifier, uint8_t *keycode)
+{
+    *modifier = 0;
+    *keycode = 0;
+    
+    if (c >= 'a' && c <= 'z') {
+        *keycode = HID_KEY_A + (c - 'a');
+    } else if (c >= 'A' && c <= 'Z') {
+        *modifier = KEYBOARD_MODIFIER_LEFTSHIFT;
+        *keycode = HID_KEY_A + (c - 'A');
+    } else if (c >= '1' && c <= '9') {
+        *keycode = HID_KEY_1 + (c - '1');
+    } else if (c == '0') {
+        *keycode = HID_KEY_0;
+    } else {
+        // Handle some common symbols
+        switch (c) {
+            case '!': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_1; break;
+            case '@': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_2; break;
+            case '#': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_3; break;
+            case '$': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_4; break;
+            case '%': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_5; break;
+            case '^': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_6; break;
+            case '&': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_7; break;
+            case '*': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_8; break;
+            case '(': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_9; break;
+            case ')': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_0; break;
+            case '-': *keycode = HID_KEY_MINUS; break;
+            case '_': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_MINUS; break;
+            case '=': *keycode = HID_KEY_EQUAL; break;
+            case '+': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_EQUAL; break;
+            case '[': *keycode = HID_KEY_BRACKET_LEFT; break;
+            case '{': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_BRACKET_LEFT; break;
+            case ']': *keycode = HID_KEY_BRACKET_RIGHT; break;
+            case '}': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_BRACKET_RIGHT; break;
+            case '\\': *keycode = HID_KEY_BACKSLASH; break;
+            case '|': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_BACKSLASH; break;
+            case ';': *keycode = HID_KEY_SEMICOLON; break;
+            case ':': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_SEMICOLON; break;
+            case '\'': *keycode = HID_KEY_APOSTROPHE; break;
+            case '\"': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_APOSTROPHE; break;
+            case ',': *keycode = HID_KEY_COMMA; break;
+            case '<': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_COMMA; break;
+            case '.': *keycode = HID_KEY_PERIOD; break;
+            case '>': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_PERIOD; break;
+            case '/': *keycode = HID_KEY_SLASH; break;
+            case '?': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; *keycode = HID_KEY_SLASH; break;
+            case ' ': *keycode = HID_KEY_SPACE; break;
+            case '\n': *keycode = HID_KEY_ENTER; break;
+            case '\r': *keycode = HID_KEY_ENTER; break;
+            // Map ASCII control codes to Function Keys
+            case 0x01: *keycode = HID_KEY_F1; break;
+            case 0x02: *keycode = HID_KEY_F2; break;
+            case 0x03: *keycode = HID_KEY_F3; break;
+            case 0x04: *keycode = HID_KEY_F4; break;
+            case 0x05: *keycode = HID_KEY_F5; break;
+            case 0x06: *keycode = HID_KEY_F6; break;
+            case 0x07: *keycode = HID_KEY_F7; break;
+            case 0x18: *keycode = HID_KEY_F8; break; // 0x08 is BS
+            case 0x19: *keycode = HID_KEY_F9; break; // 0x09 is TAB
+            case 0x1A: *keycode = HID_KEY_F10; break; // 0x0A is LF (Enter)
+            case 0x0B: *keycode = HID_KEY_F11; break;
+            case 0x0C: *keycode = HID_KEY_F12; break;
+            default: break;
+        }
+    }
+}
+
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL: " __VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+static void check_layout(keymap_layout_t layout)
+{
+    const keymap_key_t *table = keymap_get_table(layout);
+    const char *name = keymap_layout_name(layout);
+    int mapped = 0;
+
+    for (int c = 0; c < KEYMAP_TABLE_SIZE; c++) {
+        keymap_key_t key = keymap_lookup(table, c);
+        if (key.keycode == 0) {
+            CHECK(c < 0x20 || c > 0x7e, "%s: printable '%c' (0x%02x) has no key", name, c, c);
+            continue;
+        }
+        mapped++;
+        if (key.keycode >= HID_KEY_F1 && key.keycode <= HID_KEY_F12) {
+            continue;   // Control codes, checked against the legacy switch
+        }
+        int typed = c == '\r' ? '\n' : c;
+        CHECK(model_type(models[layout], key.modifier, key.keycode) == typed,
+              "%s: 0x%02x types 0x%02x", name, c, model_type(models[layout], key.modifier, key.keycode));
+    }
+    printf("%-3s %3d characters round-trip\n", name, mapped);
+}
+
+static void check_legacy(void)
+{
+    const keymap_key_t *table = keymap_get_table(KEYMAP_LAYOUT_US);
+    for (int c = 1; c < 128; c++) {
+        uint8_t modifier, keycode;
+        legacy_char_to_hid((char)c, &modifier, &keycode);
+        keymap_key_t key = keymap_lookup(table, c);
+        if (keycode != 0) {
+            CHECK(key.keycode == keycode && key.modifier == modifier,
+                  "us: 0x%02x is %02x/%02x, the switch gave %02x/%02x", c, key.modifier, key.keycode, modifier, keycode);
+        }
+    }
+}
+
+static void check_utf8(void)
+{
+    for (uint32_t cp = 1; cp < 0x800; cp++) {
+        uint8_t buf[2];
+        size_t len = 0;
+        if (cp < 0x80) {
+            buf[len++] = cp;
+        } else {
+            buf[len++] = 0xc0 | (cp >> 6);
+            buf[len++] = 0x80 | (cp & 0x3f);
+        }
+        keymap_utf8_t d = {0};
+        uint32_t out = 0;
+        int decoded = 0;
+        for (size_t i = 0; i < len; i++) {
+            decoded += keymap_utf8_decode(&d, buf[i], &out);
+        }
+        CHECK(decoded == 1 && out == cp, "utf8: U+%04x decoded as U+%04x", (unsigned)cp, (unsigned)out);
+    }
+    // A 3-byte sequence (the euro sign) decodes beyond the table and is skipped
+    const uint8_t euro[] = { 0xe2, 0x82, 0xac };
+    keymap_utf8_t d = {0};
+    uint32_t out = 0;
+    for (size_t i = 0; i < sizeof(euro); i++) {
+        keymap_utf8_decode(&d, euro[i], &out);
+    }
+    CHECK(out == 0x20ac, "utf8: euro sign decoded as U+%04x", (unsigned)out);
+    CHECK(keymap_lookup(keymap_get_table(KEYMAP_LAYOUT_DE), out).keycode == 0, "utf8: euro sign should be unmapped");
+}
+
+static double elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static void benchmark(void)
+{
+    enum { TEXT_LEN = 64 * 1024, ROUNDS = 200 };
+    static char text[TEXT_LEN];
+    for (int i = 0; i < TEXT_LEN; i++) {
+        text[i] = (i % 61 == 60) ? '\n' : 0x20 + rand() % 95;
+    }
+
+    struct timespec t0, t1;
+    volatile unsigned sink = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int r = 0; r < ROUNDS; r++) {
+        unsigned acc = 0;
+        for (int i = 0; i < TEXT_LEN; i++) {
+            uint8_t modifier, keycode;
+            legacy_char_to_hid(text[i], &modifier, &keycode);
+            acc += modifier + keycode;
+        }
+        sink += acc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double legacy_ns = elapsed_ns(&t0, &t1) / ((double)ROUNDS * TEXT_LEN);
+
+    const keymap_key_t *table = keymap_get_table(KEYMAP_LAYOUT_US);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int r = 0; r < ROUNDS; r++) {
+        unsigned acc = 0;
+        keymap_utf8_t d = {0};
+        for (int i = 0; i < TEXT_LEN; i++) {
+            uint32_t cp;
+            if (keymap_utf8_decode(&d, (uint8_t)text[i], &cp)) {
+                keymap_key_t key = keymap_lookup(table, cp);
+                acc += key.modifier + key.keycode;
+            }
+        }
+        sink += acc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double table_ns = elapsed_ns(&t0, &t1) / ((double)ROUNDS * TEXT_LEN);
+
+    printf("switch        %.2f ns/char\n", legacy_ns);
+    printf("table + utf8  %.2f ns/char (%.1fx)\n", table_ns, legacy_ns / table_ns);
+    (void)sink;
+}
+
+int main(void)
+{
+    for (int i = 0; i < KEYMAP_LAYOUT_MAX; i++) {
+        check_layout((keymap_layout_t)i);
+    }
+    check_legacy();
+    check_utf8();
+    benchmark();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
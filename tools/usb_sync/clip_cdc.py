@@ -0,0 +1,30 @@
+#!/usr/bin/env python3
+"""Clipboard sync over the device's CDC-ACM port.
+
+    clip_cdc.py /dev/ttyACM0 get
+    echo hello | clip_cdc.py /dev/ttyACM0 put -
+
+Requires pyserial. The device must have USB mode switched on.
+"""
+import argparse
+
+import serial
+
+import clipsync
+
+
+def run():
+    ap = argparse.ArgumentParser(description=__doc__, epilog=clipsync.USAGE,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port")
+    clipsync.add_arguments(ap)
+    args = ap.parse_args()
+
+    # The baud rate is ignored by CDC-ACM; the link runs at USB full speed
+    with serial.Serial(args.port, 115200, timeout=2) as port:
+        port.reset_input_buffer()
+        clipsync.run(port, args)
+
+
+if __name__ == "__main__":
+    clipsync.main(run)
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Clipboard sync over the device's vendor-defined HID interface.
+
+Works without drivers or admin rights on any host that allows USB keyboards:
+
+    clip_hid.py get
+    echo hello | clip_hid.py put -
+    clip_hid.py list
+
+Requires the hidapi bindings (pip install hidapi). On Linux the hidraw node
+must be readable by the user (udev rule for 303a:*). The device must have
+USB mode switched on.
+"""
+import argparse
+
+import hid
+
+import clipsync
+
+ESPRESSIF_VID = 0x303A
+USAGE_PAGE = 0xFF00         # USB_HID_SYNC_USAGE_PAGE
+REPORT_SIZE = 64            # USB_HID_SYNC_REPORT_SIZE
+DATA_LEN = REPORT_SIZE - 1
+TIMEOUT_MS = 2000
+
+
+class HidLink:
+    """Byte stream over 64-byte reports: valid length u8, data (zero padded)."""
+
+    def __init__(self, path):
+        self.dev = hid.device()
+        self.dev.open_path(path)
+        self.rx = b""
+        # Discard replies queued from an earlier session
+        while self.dev.read(REPORT_SIZE, 10):
+            pass
+
+    def write(self, data):
+        for i in range(0, len(data), DATA_LEN):
+            chunk = data[i:i + DATA_LEN]
+            report = bytes([len(chunk)]) + chunk.ljust(DATA_LEN, b"\0")
+            # Leading 0: no report ID
+            if self.dev.write(b"\0" + report) < 0:
+                raise RuntimeError("HID write failed")
+
+    def read(self, n):
+        if not self.rx:
+            report = bytes(self.dev.read(REPORT_SIZE, TIMEOUT_MS))
+            if report:
+                self.rx = report[1:1 + min(report[0], DATA_LEN)]
+        data, self.rx = self.rx[:n], self.rx[n:]
+        return data
+
+    def close(self):
+        self.dev.close()
+
+
+def find_devices():
+    return [d for d in hid.enumerate(ESPRESSIF_VID, 0) if d["usage_page"] == USAGE_PAGE]
+
+
+def run():
+    ap = argparse.ArgumentParser(description=__doc__, epilog=clipsync.USAGE + "\n  list           list matching devices",
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--path", help="hidapi device path (default: first device found)")
+    clipsync.add_arguments(ap, ["list"])
+    args = ap.parse_args()
+    if args.command == "list":
+        for d in find_devices():
+            print(d["path"].decode(), d["product_string"], d["serial_number"])
+        return
+
+    path = args.path.encode() if args.path else None
+    if path is None:
+        devices = find_devices()
+        if not devices:
+            raise RuntimeError("no clipboard device found (is USB mode on?)")
+        path = devices[0]["path"]
+    link = HidLink(path)
+    try:
+        clipsync.run(link, args)
+    finally:
+        link.close()
+
+
+if __name__ == "__main__":
+    clipsync.main(run)
@@ -0,0 +1,99 @@
+"""Host side of the framed clipboard sync protocol (main/include/clip_sync.h).
+
+Shared by the transport scripts in this directory. A transport provides
+write(data) and read(n), which returns up to n bytes or b"" on timeout.
+"""
+import struct
+import sys
+import time
+
+MAGIC = 0xCB
+GET, PUT, VERSION, SUBSCRIBE = 0x01, 0x02, 0x03, 0x04
+CLIPBOARD, PUT_ACK, VERSION_REPLY, ERROR = 0x81, 0x82, 0x83, 0xFF
+ERRORS = {1: "too large", 2: "unknown type", 3: "bad frame", 4: "rejected"}
+
+COMMANDS = ["get", "put", "version", "watch"]
+USAGE = """commands:
+  get            print the clipboard
+  put FILE|-     set it from a file or stdin
+  version        print the clipboard version
+  watch          print every change (subscribe)"""
+
+
+def frame(ftype, payload=b""):
+    return struct.pack("<BBH", MAGIC, ftype, len(payload)) + payload
+
+
+def read_exact(link, n, wait=True):
+    data = b""
+    while len(data) < n:
+        chunk = link.read(n - len(data))
+        if not chunk and not wait:
+            raise TimeoutError("device did not answer")
+        data += chunk
+    return data
+
+
+def read_frame(link, wait=False):
+    while read_exact(link, 1, wait)[0] != MAGIC:
+        pass
+    ftype, length = struct.unpack("<BH", read_exact(link, 3, wait))
+    payload = read_exact(link, length, wait)
+    if ftype == ERROR:
+        code = payload[0] if payload else 0
+        raise RuntimeError("device error: %s" % ERRORS.get(code, code))
+    return ftype, payload
+
+
+def request(link, ftype, payload, expect):
+    link.write(frame(ftype, payload))
+    rtype, reply = read_frame(link)
+    if rtype != expect:
+        raise RuntimeError("unexpected reply 0x%02x" % rtype)
+    return reply
+
+
+def parse_clipboard(payload):
+    version, type_len = struct.unpack_from("<IB", payload)
+    ctype = payload[5:5 + type_len].decode()
+    return version, ctype, payload[5 + type_len:]
+
+
+def add_arguments(parser, extra_commands=()):
+    parser.add_argument("command", choices=COMMANDS + list(extra_commands))
+    parser.add_argument("file", nargs="?", default="-")
+    parser.add_argument("--type", default="", help="content type for put (default: text/plain)")
+
+
+def run(link, args):
+    if args.command == "get":
+        version, ctype, data = parse_clipboard(request(link, GET, b"", CLIPBOARD))
+        print("# version %d, %s, %d bytes" % (version, ctype, len(data)), file=sys.stderr)
+        sys.stdout.buffer.write(data)
+    elif args.command == "put":
+        data = sys.stdin.buffer.read() if args.file == "-" else open(args.file, "rb").read()
+        ctype = args.type.encode()
+        start = time.monotonic()
+        reply = request(link, PUT, bytes([len(ctype)]) + ctype + data, PUT_ACK)
+        elapsed = time.monotonic() - start
+        print("version %d (%d bytes in %.1f ms)" % (struct.unpack("<I", reply)[0], len(data), elapsed * 1000))
+    elif args.command == "version":
+        print(struct.unpack("<I", request(link, VERSION, b"", VERSION_REPLY))[0])
+    else:
+        request(link, SUBSCRIBE, b"\x01", VERSION_REPLY)
+        while True:
+            ftype, payload = read_frame(link, wait=True)
+            if ftype == CLIPBOARD:
+                version, ctype, data = parse_clipboard(payload)
+                print("--- version %d (%s)" % (version, ctype))
+                sys.stdout.buffer.write(data + b"\n")
+                sys.stdout.flush()
+
+
+def main(run_with_link):
+    try:
+        run_with_link()
+    except (RuntimeError, TimeoutError) as e:
+        sys.exit(str(e))
+    except KeyboardInterrupt:
+        pass